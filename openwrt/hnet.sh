@@ -21,6 +21,8 @@ proto_hnet_init_config() {
     proto_config_add_string 'dnsname'
     proto_config_add_int 'keepalive_interval'
     proto_config_add_int 'trickle_k'
+    proto_config_add_boolean 'trickle_adaptive'
+    proto_config_add_string 'stream_peer'
     proto_config_add_boolean 'ip4uplinklimit'
 }
 
@@ -28,8 +30,8 @@ proto_hnet_setup() {
     local interface="$1"
     local device="$2"
 
-    local dhcpv4_clientid dhcpv6_clientid reqaddress reqprefix prefix link_id iface_id ip6assign ip4assign disable_pa ula_default_router keepalive_interval trickle_k dnsname mode ip4uplinklimit
-    json_get_vars dhcpv4_clientid dhcpv6_clientid reqaddress reqprefix prefix link_id iface_id ip6assign ip4assign disable_pa ula_default_router keepalive_interval trickle_k dnsname mode ip4uplinklimit
+    local dhcpv4_clientid dhcpv6_clientid reqaddress reqprefix prefix link_id iface_id ip6assign ip4assign disable_pa ula_default_router keepalive_interval trickle_k trickle_adaptive stream_peer dnsname mode ip4uplinklimit
+    json_get_vars dhcpv4_clientid dhcpv6_clientid reqaddress reqprefix prefix link_id iface_id ip6assign ip4assign disable_pa ula_default_router keepalive_interval trickle_k trickle_adaptive stream_peer dnsname mode ip4uplinklimit
 
     logger -t proto-hnet "proto_hnet_setup $device/$interface"
 
@@ -51,6 +53,8 @@ proto_hnet_setup() {
     [ "$ula_default_router" = "1" ] && json_add_boolean ula_default_router 1
     [ -n "$keepalive_interval" ] && json_add_int keepalive_interval $keepalive_interval
     [ -n "$trickle_k" ] && json_add_int trickle_k $trickle_k
+    [ "$trickle_adaptive" = 1 ] && json_add_boolean trickle_adaptive 1
+    [ -n "$stream_peer" ] && json_add_string stream_peer "$stream_peer"
     [ -n "$ip6assign" ] && json_add_string ip6assign "$ip6assign"
     [ -n "$ip4assign" ] && json_add_string ip4assign "$ip4assign"
     [ -n "$reqaddress" ] && json_add_string reqaddress "$reqaddress"
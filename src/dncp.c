@@ -36,10 +36,194 @@ void dncp_schedule(dncp o)
   o->immediate_scheduled = true;
 }
 
+static int _compare_edges(const void *a, const void *b)
+{
+  dncp_edge e1 = (dncp_edge) a, e2 = (dncp_edge) b;
+
+  /* All neighbor TLVs have same length */
+  return memcmp(tlv_data(e1->a), tlv_data(e2->a), tlv_len(e1->a));
+}
+
+/* Find the first edge whose TLV content starts with key. */
+static dncp_edge _node_find_edge(dncp_node n, void *key, int len)
+{
+  int lo = 0, hi = n->num_edges;
+
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+
+      if (memcmp(tlv_data(n->edges[mid].a), key, len) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo < n->num_edges && !memcmp(tlv_data(n->edges[lo].a), key, len))
+    return &n->edges[lo];
+  return NULL;
+}
+
+/* Mark the node, and nodes it claims as neighbors, as needing edge
+ * re-resolution. Bidirectional edge to this node can appear or
+ * disappear only at them. If seed is set, they are also added as
+ * starting points for the next (incremental) prune. */
+static void _node_dirty_edge_peers(dncp_node n, bool seed)
+{
+  dncp o = n->dncp;
+  dncp_node n2;
+  int i;
+
+  n->edges_dirty = true;
+  if (seed && list_empty(&n->in_prune_seeds))
+    list_add_tail(&n->in_prune_seeds, &o->prune_seeds);
+  for (i = 0 ; i < n->num_edges ; i++)
+    if ((n2 = dncp_find_node_by_node_id(o,
+                                        dncp_tlv_get_node_id(o,
+                                                             n->edges[i].ne),
+                                        false)))
+      {
+        n2->edges_dirty = true;
+        if (seed && list_empty(&n2->in_prune_seeds))
+          list_add_tail(&n2->in_prune_seeds, &o->prune_seeds);
+      }
+}
+
+/* Replace the edges with ones based on the new TLV container a. The
+ * old tlv_container must be still valid at this point. The added and
+ * removed flags are set if any neighbor TLV appeared or disappeared. */
+static void _node_parse_edges(dncp_node n, struct tlv_attr *a,
+                              bool *added, bool *removed)
+{
+  dncp_edge edges = NULL;
+  dncp_t_neighbor ne;
+  struct tlv_attr *a2;
+  int cnt = 0, i = 0, j = 0;
+
+  tlv_for_each_attr(a2, a)
+    if (dncp_tlv_neighbor(n->dncp, a2))
+      cnt++;
+  if (cnt && !(edges = malloc(cnt * sizeof(*edges))))
+    {
+      L_ERR("unable to allocate %d edges for %s", cnt, DNCP_NODE_REPR(n));
+      cnt = 0;
+    }
+  if (cnt)
+    {
+      tlv_for_each_attr(a2, a)
+        if ((ne = dncp_tlv_neighbor(n->dncp, a2)))
+          {
+            dncp_edge e = &edges[i++];
+            e->a = a2;
+            e->ne = ne;
+            e->peer = NULL;
+          }
+      qsort(edges, cnt, sizeof(*edges), _compare_edges);
+    }
+
+  /* Both are sorted -> merge-walk to see what changed. */
+  *added = *removed = false;
+  i = 0;
+  while (i < n->num_edges || j < cnt)
+    {
+      int r = i == n->num_edges ? 1 : j == cnt ? -1 :
+        _compare_edges(&n->edges[i], &edges[j]);
+      if (r <= 0)
+        i++;
+      if (r >= 0)
+        j++;
+      if (r < 0)
+        *removed = true;
+      else if (r > 0)
+        *added = true;
+    }
+  free(n->edges);
+  n->edges = edges;
+  n->num_edges = cnt;
+}
+
+dncp_edge dncp_node_get_edges(dncp_node n)
+{
+  dncp o = n->dncp;
+  int nidlen = DNCP_NI_LEN(o);
+  int klen = nidlen + sizeof(dncp_t_neighbor_s);
+  unsigned char key[DNCP_NI_MAX_LEN + sizeof(dncp_t_neighbor_s)];
+  dncp_t_neighbor kne = (dncp_t_neighbor)(key + nidlen);
+  dncp_node n2;
+  int i;
+
+  if (!n->edges_dirty)
+    return n->edges;
+  memcpy(key, &n->node_id, nidlen);
+  for (i = 0 ; i < n->num_edges ; i++)
+    {
+      dncp_edge e = &n->edges[i];
+
+      /* The reverse TLV has the endpoint identifiers swapped. */
+      kne->neighbor_ep_id = e->ne->ep_id;
+      kne->ep_id = e->ne->neighbor_ep_id;
+      n2 = dncp_find_node_by_node_id(o, dncp_tlv_get_node_id(o, e->ne),
+                                     false);
+      e->peer = n2 && _node_find_edge(n2, key, klen) ? n2 : NULL;
+    }
+  n->edges_dirty = false;
+  return n->edges;
+}
+
+dncp_edge dncp_node_find_edges_to(dncp_node n, void *ni)
+{
+  return _node_find_edge(n, ni, DNCP_NI_LEN(n->dncp));
+}
+
+dncp_node dncp_node_find_neigh_bidir(dncp_node n, dncp_t_neighbor ne)
+{
+  if (!n)
+    return NULL;
+  int klen = DNCP_NI_LEN(n->dncp) + sizeof(*ne);
+  dncp_node_get_edges(n);
+  dncp_edge e = _node_find_edge(n, dncp_tlv_get_node_id(n->dncp, ne), klen);
+  return e ? e->peer : NULL;
+}
+
+static bool _tlvs_have_keepalive(struct tlv_attr *container)
+{
+  struct tlv_attr *a;
+
+  if (container)
+    tlv_for_each_attr(a, container)
+      if (tlv_id(a) == DNCP_T_KEEPALIVE_INTERVAL)
+        return true;
+  return false;
+}
+
+/* Local neighbors cache the keepalive interval their peer publishes;
+ * recalculate it (soon) for the ones whose peer is n. */
+static void _node_invalidate_neighbor_intervals(dncp_node n)
+{
+  dncp o = n->dncp;
+  dncp_node own = o->own_node;
+  int nidlen = DNCP_NI_LEN(o);
+  dncp_edge e = dncp_node_find_edges_to(own, &n->node_id);
+
+  for (; e && e < own->edges + own->num_edges
+         && !memcmp(tlv_data(e->a), &n->node_id, nidlen) ; e++)
+    {
+      dncp_tlv t = dncp_find_tlv(o, DNCP_T_NEIGHBOR,
+                                 tlv_data(e->a), tlv_len(e->a));
+      dncp_neighbor ne = t ? dncp_tlv_get_extra(t) : NULL;
+
+      if (!ne)
+        continue;
+      ne->keepalive_interval_valid = false;
+      if (ne->heap_index)
+        dncp_neighbor_schedule(o, ne, 0);
+    }
+}
+
 void dncp_node_set(dncp_node n, uint32_t update_number,
                    hnetd_time_t t, struct tlv_attr *a)
 {
   struct tlv_attr *a_valid = a;
+  uint32_t old_update_number = n->update_number;
 
   L_DEBUG("dncp_node_set %s update #%d %p (@%lld (-%lld))",
           DNCP_NODE_REPR(n), (int) update_number, a,
@@ -87,10 +271,34 @@ void dncp_node_set(dncp_node n, uint32_t update_number,
   /* If the pointer changed, handle it */
   if (n->tlv_container != a)
     {
+      bool added, removed;
+
       if (n->last_reachable_prune == n->dncp->last_prune)
         dncp_notify_subscribers_tlvs_changed(n, n->tlv_container_valid,
                                              a_valid);
-      if (n->tlv_container)
+      _node_dirty_edge_peers(n, false);
+      _node_parse_edges(n, a, &added, &removed);
+      /* Lost neighbors may render reachable nodes unreachable; that
+       * requires full prune. Gained ones can be handled
+       * incrementally, starting from the affected nodes. */
+      if (removed && n->last_reachable_prune == n->dncp->last_prune)
+        n->dncp->graph_full_dirty = true;
+      _node_dirty_edge_peers(n, added);
+      if (n->dncp->own_node && n != n->dncp->own_node
+          && (_tlvs_have_keepalive(n->tlv_container)
+              || _tlvs_have_keepalive(a)))
+        _node_invalidate_neighbor_intervals(n);
+      if (a && n->tlv_container && n->dncp->ext->conf.node_data_delta)
+        {
+          /* Peers that have the old version can be sent just the
+           * difference. */
+          dncp_calculate_node_data_hash(n);
+          free(n->prev_tlv_container);
+          n->prev_tlv_container = n->tlv_container;
+          n->prev_update_number = old_update_number;
+          n->prev_node_data_hash = n->node_data_hash;
+        }
+      else if (n->tlv_container)
         free(n->tlv_container);
 
       n->tlv_container = a;
@@ -102,6 +310,9 @@ void dncp_node_set(dncp_node n, uint32_t update_number,
 
   /* _anything_ we do here dirties network hash. */
   n->dncp->network_hash_dirty = true;
+  if (list_empty(&n->in_network_hash_dirty))
+    list_add_tail(&n->in_network_hash_dirty,
+                  &n->dncp->network_hash_dirty_nodes);
 
   dncp_schedule(n->dncp);
 }
@@ -120,6 +331,15 @@ static void update_node(__unused struct vlist_tree *t,
   if (n_old)
     {
       dncp_node_set(n_old, 0, 0, NULL);
+      list_del(&n_old->in_network_hash_dirty);
+      o->network_hash_full_dirty = true;
+      list_del(&n_old->in_prune_seeds);
+      if (n_old->last_reachable_prune == o->last_prune)
+        o->graph_full_dirty = true;
+      /* Others may still refer to it as their peer. */
+      _node_dirty_edge_peers(n_old, false);
+      free(n_old->edges);
+      free(n_old->prev_tlv_container);
       if (n_old->tlv_index)
         free(n_old->tlv_index);
       free(n_old);
@@ -145,6 +365,61 @@ compare_tlvs(const void *a, const void *b, void *ptr __unused)
   return tlv_attr_cmp(&t1->tlv, &t2->tlv);
 }
 
+static bool _tlvs_published_valid(dncp o)
+{
+  return !o->tlvs_full_dirty && o->tlvs_published && o->own_node
+    && o->own_node->tlv_container == o->tlvs_published;
+}
+
+static void _tlvs_mark_removed(dncp o, dncp_tlv t)
+{
+  if (t->published_offset < 0)
+    {
+      /* Never published; just forget about it. */
+      list_del(&t->in_tlvs_added);
+      return;
+    }
+  if (o->tlvs_full_dirty)
+    return;
+  if (o->tlvs_removed_used == o->tlvs_removed_allocated)
+    {
+      int nlen = o->tlvs_removed_allocated * 2 + 4;
+      void *buf = realloc(o->tlvs_removed, nlen * sizeof(*o->tlvs_removed));
+      if (!buf)
+        {
+          o->tlvs_full_dirty = true;
+          return;
+        }
+      o->tlvs_removed = buf;
+      o->tlvs_removed_allocated = nlen;
+    }
+  o->tlvs_removed[o->tlvs_removed_used].offset = t->published_offset;
+  o->tlvs_removed[o->tlvs_removed_used].len = tlv_pad_len(&t->tlv);
+  o->tlvs_removed_used++;
+}
+
+static void _tlvs_mark_added(dncp o, dncp_tlv t)
+{
+  int i, len = tlv_pad_len(&t->tlv);
+
+  /* Re-adding something removed since the last publish is no change. */
+  if (_tlvs_published_valid(o))
+    for (i = 0 ; i < o->tlvs_removed_used ; i++)
+      {
+        dncp_tlv_range r = &o->tlvs_removed[i];
+
+        if (r->len == len
+            && !memcmp(tlv_data(o->tlvs_published) + r->offset, &t->tlv, len))
+          {
+            t->published_offset = r->offset;
+            *r = o->tlvs_removed[--o->tlvs_removed_used];
+            return;
+          }
+      }
+  t->published_offset = -1;
+  list_add_tail(&t->in_tlvs_added, &o->tlvs_added);
+}
+
 static void update_tlv(struct vlist_tree *t,
                        struct vlist_node *node_new,
                        struct vlist_node *node_old)
@@ -153,6 +428,37 @@ static void update_tlv(struct vlist_tree *t,
   dncp_tlv t_old = container_of(node_old, dncp_tlv_s, in_tlvs);
   __unused dncp_tlv t_new = container_of(node_new, dncp_tlv_s, in_tlvs);
 
+  if (t_old && t_new)
+    {
+      /* Identical content; the new one just takes the old one's place. */
+      t_new->published_offset = t_old->published_offset;
+      if (t_new->published_offset < 0)
+        {
+          list_add(&t_new->in_tlvs_added, &t_old->in_tlvs_added);
+          list_del(&t_old->in_tlvs_added);
+        }
+    }
+  else if (t_old)
+    _tlvs_mark_removed(o, t_old);
+  else
+    _tlvs_mark_added(o, t_new);
+
+  /* Local neighbor TLVs (see _heard in dncp_proto.c) carry
+   * dncp_neighbor as extra data, which may be in the deadline heap. */
+  if (t_old && dncp_tlv_neighbor(o, &t_old->tlv))
+    dncp_neighbor_unschedule(o, dncp_tlv_get_extra(t_old));
+
+  /* ..and they are counted per endpoint, for adaptive Trickle. */
+  if (!t_old != !t_new)
+    {
+      dncp_tlv t = t_old ? t_old : t_new;
+      dncp_t_neighbor ne = dncp_tlv_neighbor(o, &t->tlv);
+      dncp_ep ep = ne ? dncp_find_ep_by_id(o, ne->ep_id) : NULL;
+
+      if (ep)
+        container_of(ep, dncp_ep_i_s, conf)->num_neighbors += t_new ? 1 : -1;
+    }
+
   if (t_old)
     {
       dncp_notify_subscribers_local_tlv_changed(o, &t_old->tlv, false);
@@ -161,6 +467,8 @@ static void update_tlv(struct vlist_tree *t,
   if (t_new)
     dncp_notify_subscribers_local_tlv_changed(o, &t_new->tlv, true);
 
+  if (t_old && t_new)
+    return;
   o->tlvs_dirty = true;
   dncp_schedule(o);
 }
@@ -173,6 +481,25 @@ compare_eps(const void *a, const void *b, void *ptr __unused)
   return strcmp(t1->conf.ifname, t2->conf.ifname);
 }
 
+/* Make sure eps_by_id has a slot for ep_id. */
+static bool _ep_reserve_id(dncp o, uint32_t ep_id)
+{
+  int nlen;
+  void *buf;
+
+  if ((int)ep_id < o->eps_by_id_allocated)
+    return true;
+  nlen = ep_id * 2 + 4;
+  buf = realloc(o->eps_by_id, nlen * sizeof(*o->eps_by_id));
+  if (!buf)
+    return false;
+  o->eps_by_id = buf;
+  memset(o->eps_by_id + o->eps_by_id_allocated, 0,
+         (nlen - o->eps_by_id_allocated) * sizeof(*o->eps_by_id));
+  o->eps_by_id_allocated = nlen;
+  return true;
+}
+
 static void update_ep(struct vlist_tree *t,
                         struct vlist_node *node_new,
                         struct vlist_node *node_old)
@@ -183,11 +510,16 @@ static void update_ep(struct vlist_tree *t,
 
   if (t_old)
     {
+      if ((int)t_old->ep_id < o->eps_by_id_allocated
+          && o->eps_by_id[t_old->ep_id] == t_old)
+        o->eps_by_id[t_old->ep_id] = NULL;
       free(t_old);
     }
   else
     {
       t_new->published_keepalive_interval = DNCP_KEEPALIVE_INTERVAL(o);
+      /* Room was reserved in dncp_find_ep_by_name. */
+      o->eps_by_id[t_new->ep_id] = t_new;
     }
   dncp_schedule(o);
 }
@@ -213,6 +545,8 @@ dncp_find_node_by_node_id(dncp o, void *ni, bool create)
   memcpy(&n->node_id, ni, DNCP_NI_LEN(o));
   n->dncp = o;
   n->tlv_index_dirty = true;
+  INIT_LIST_HEAD(&n->in_network_hash_dirty);
+  INIT_LIST_HEAD(&n->in_prune_seeds);
   vlist_add(&o->nodes, &n->in_nodes, n);
   return n;
 }
@@ -229,6 +563,10 @@ bool dncp_init(dncp o, dncp_ext ext, const void *node_id, int len)
   o->ext = ext;
   for (i = 0 ; i < NUM_DNCP_CALLBACKS; i++)
     INIT_LIST_HEAD(&o->subscribers[i]);
+  INIT_LIST_HEAD(&o->network_hash_dirty_nodes);
+  INIT_LIST_HEAD(&o->prune_seeds);
+  INIT_LIST_HEAD(&o->tlvs_added);
+  o->network_hash_full_dirty = true;
   vlist_init(&o->nodes, compare_nodes, update_node);
   o->nodes.keep_old = true;
   vlist_init(&o->tlvs, compare_tlvs, update_tlv);
@@ -259,7 +597,10 @@ bool dncp_set_own_node_id(dncp o, void *nibuf)
     }
   o->own_node = n;
   o->tlvs_dirty = true; /* by default, they are, even if no neighbors yet. */
+  o->tlvs_full_dirty = true;
   n->last_reachable_prune = o->last_prune; /* we're always reachable */
+  o->network_hash_full_dirty = true;
+  o->graph_full_dirty = true;
   dncp_schedule(o);
   return true;
 }
@@ -292,6 +633,8 @@ dncp dncp_create(dncp_ext ext)
 
 void dncp_uninit(dncp o)
 {
+  int i;
+
   /* TLVs should be freed first; they're local phenomenom, but may be
    * reflected on eps/nodes. */
   vlist_flush_all(&o->tlvs);
@@ -311,6 +654,17 @@ void dncp_uninit(dncp o)
   /* Get rid of TLV index. */
   if (o->num_tlv_indexes)
     free(o->tlv_type_to_index);
+
+  free(o->network_hash_records);
+  free(o->prune_stack);
+  free(o->neighbor_heap);
+  free(o->tlvs_removed);
+  free(o->eps_by_id);
+  tlv_buf_free(&o->net_state_tb);
+  free(o->net_state_slots);
+  free(o->net_state_segment);
+  for (i = 0; i < DNCP_VERIFIED_CACHE_SIZE; i++)
+    free(o->verified[i].data);
 }
 
 void dncp_destroy(dncp o)
@@ -363,6 +717,7 @@ dncp_add_tlv(dncp o, uint16_t type, void *data, uint16_t len, int extra_bytes)
   tlv_init(&t->tlv, type, len + TLV_SIZE);
   memcpy(tlv_data(&t->tlv), data, len);
   tlv_fill_pad(&t->tlv);
+  INIT_LIST_HEAD(&t->in_tlvs_added);
   vlist_add(&o->tlvs, &t->in_tlvs, t);
   return t;
 }
@@ -407,6 +762,12 @@ dncp_ep dncp_find_ep_by_name(dncp o, const char *ifname)
     return NULL;
   l->dncp = o;
   l->ep_id = o->first_free_ep_id++;
+  if (!_ep_reserve_id(o, l->ep_id))
+    {
+      L_ERR("unable to allocate endpoint %s", ifname);
+      free(l);
+      return NULL;
+    }
   l->conf = o->ext->conf.per_ep;
   strncpy(l->conf.dnsname, ifname, sizeof(l->conf.ifname));
   strncpy(l->conf.ifname, ifname, sizeof(l->conf.ifname));
@@ -417,13 +778,30 @@ dncp_ep dncp_find_ep_by_name(dncp o, const char *ifname)
 dncp_ep dncp_find_ep_by_id(dncp o, uint32_t ep_id)
 {
   dncp_ep_i l;
-  /* XXX - this could be also made more efficient. Oh well. */
-  vlist_for_each_element(&o->eps, l, in_eps)
-    if (l->ep_id == ep_id)
-      return &l->conf;
+
+  if (ep_id < (uint32_t)o->eps_by_id_allocated
+      && (l = o->eps_by_id[ep_id]))
+    return &l->conf;
   return NULL;
 }
 
+bool dncp_ep_set_id(dncp_ep ep, uint32_t ep_id)
+{
+  dncp_ep_i l = container_of(ep, dncp_ep_i_s, conf);
+  dncp o = l->dncp;
+
+  if (ep_id == l->ep_id)
+    return true;
+  if (!ep_id || !_ep_reserve_id(o, ep_id) || o->eps_by_id[ep_id])
+    return false;
+  o->eps_by_id[l->ep_id] = NULL;
+  o->eps_by_id[ep_id] = l;
+  l->ep_id = ep_id;
+  if ((int)ep_id >= o->first_free_ep_id)
+    o->first_free_ep_id = ep_id + 1;
+  return true;
+}
+
 bool dncp_node_is_self(dncp_node n)
 {
   return n->dncp->own_node == n;
@@ -469,49 +847,193 @@ dncp_tlv dncp_get_next_tlv(dncp o, dncp_tlv n)
 }
 
 
-static struct tlv_attr *_produce_new_tlvs(dncp_node n)
+static bool _tlvs_changed(dncp o)
 {
-  struct tlv_buf tb;
-  dncp o = n->dncp;
-  dncp_tlv t;
-
   if (!o->tlvs_dirty)
-    return NULL;
+    return false;
+  if (!_tlvs_published_valid(o))
+    return true;
+  if (list_empty(&o->tlvs_added) && !o->tlvs_removed_used)
+    {
+      o->tlvs_dirty = false;
+      return false;
+    }
+  return true;
+}
+
+static void _tlvs_published_reset(dncp o)
+{
+  dncp_tlv t, t2;
+
+  list_for_each_entry_safe(t, t2, &o->tlvs_added, in_tlvs_added)
+    list_del_init(&t->in_tlvs_added);
+  o->tlvs_removed_used = 0;
+  o->tlvs_full_dirty = false;
+  o->tlvs_dirty = false;
+}
+
+/* Dump the contents of dncp->tlvs to a new container. */
+static struct tlv_attr *_produce_new_tlvs_full(dncp o)
+{
+  struct tlv_attr *a;
+  dncp_tlv t;
+  void *dst;
+  int len = 0;
 
-  /* Dump the contents of dncp->tlvs to single tlv_buf. */
-  /* Based on whether or not that would cause change in things, 'do stuff'. */
-  memset(&tb, 0, sizeof(tb));
-  tlv_buf_init(&tb, 0); /* not passed anywhere */
   vlist_for_each_element(&o->tlvs, t, in_tlvs)
+    len += tlv_pad_len(&t->tlv);
+  if (!(a = malloc(TLV_SIZE + len)))
     {
-      struct tlv_attr *a = tlv_put_raw(&tb, &t->tlv, tlv_pad_len(&t->tlv));
-      if (!a)
+      L_ERR("dncp_self_flush: unable to allocate %d bytes", len);
+      return NULL;
+    }
+  tlv_init(a, 0, TLV_SIZE + len);
+  dst = tlv_data(a);
+  vlist_for_each_element(&o->tlvs, t, in_tlvs)
+    {
+      t->published_offset = dst - tlv_data(a);
+      memcpy(dst, &t->tlv, tlv_pad_len(&t->tlv));
+      dst += tlv_pad_len(&t->tlv);
+    }
+  o->num_tlvs_full++;
+  return a;
+}
+
+static int _compare_tlv_ranges(const void *a, const void *b)
+{
+  const dncp_tlv_range r1 = (dncp_tlv_range) a, r2 = (dncp_tlv_range) b;
+
+  return r1->offset - r2->offset;
+}
+
+static int _compare_tlv_ptrs(const void *a, const void *b)
+{
+  const dncp_tlv t1 = *(dncp_tlv *) a, t2 = *(dncp_tlv *) b;
+
+  return tlv_attr_cmp(&t1->tlv, &t2->tlv);
+}
+
+/* Offset of the first published tlv after t in tlvs_published (or
+ * its end, if none). */
+static int _next_published_offset(dncp o, dncp_tlv t)
+{
+  dncp_tlv last = avl_last_element(&o->tlvs.avl, t, in_tlvs.avl);
+
+  while (t != last)
+    {
+      t = avl_next_element(t, in_tlvs.avl);
+      if (t->published_offset >= 0)
+        return t->published_offset;
+    }
+  return tlv_len(o->tlvs_published);
+}
+
+/* Splice the changes since tlvs_published into a copy of it. */
+static struct tlv_attr *_produce_new_tlvs_incremental(dncp o)
+{
+  void *src = tlv_data(o->tlvs_published), *dst;
+  int src_len = tlv_len(o->tlvs_published), len = src_len;
+  int num_added = 0, ai = 0, ri = 0, pos = 0, i;
+  struct tlv_attr *a;
+  dncp_tlv t, *added;
+
+  list_for_each_entry(t, &o->tlvs_added, in_tlvs_added)
+    {
+      len += tlv_pad_len(&t->tlv);
+      num_added++;
+    }
+  for (i = 0 ; i < o->tlvs_removed_used ; i++)
+    len -= o->tlvs_removed[i].len;
+  added = malloc(num_added * sizeof(*added) + 1);
+  if (!added || !(a = malloc(TLV_SIZE + len)))
+    {
+      L_ERR("dncp_self_flush: unable to allocate %d bytes", len);
+      free(added);
+      return NULL;
+    }
+  list_for_each_entry(t, &o->tlvs_added, in_tlvs_added)
+    added[ai++] = t;
+  qsort(added, num_added, sizeof(*added), _compare_tlv_ptrs);
+  if (o->tlvs_removed_used)
+    qsort(o->tlvs_removed, o->tlvs_removed_used, sizeof(*o->tlvs_removed),
+          _compare_tlv_ranges);
+
+  /* Both added tlvs and removed ranges are now in container order;
+   * copy what is in between them as is. */
+  tlv_init(a, 0, TLV_SIZE + len);
+  dst = tlv_data(a);
+  ai = 0;
+  while (ai < num_added || ri < o->tlvs_removed_used)
+    {
+      int aoff = ai < num_added ? _next_published_offset(o, added[ai]) : 0;
+      int roff = ri < o->tlvs_removed_used ? o->tlvs_removed[ri].offset : 0;
+      bool add = ai < num_added && (ri == o->tlvs_removed_used || aoff < roff);
+      int off = add ? aoff : roff;
+
+      memcpy(dst, src + pos, off - pos);
+      dst += off - pos;
+      pos = off;
+      if (add)
         {
-          L_ERR("dncp_self_flush: tlv_put_raw failed?!?");
-          tlv_buf_free(&tb);
-          return NULL;
+          t = added[ai++];
+          memcpy(dst, &t->tlv, tlv_pad_len(&t->tlv));
+          dst += tlv_pad_len(&t->tlv);
         }
-      tlv_fill_pad(a);
+      else
+        pos += o->tlvs_removed[ri++].len;
+    }
+  memcpy(dst, src + pos, src_len - pos);
+  free(added);
+
+  /* Offsets after the first change have moved. */
+  pos = 0;
+  vlist_for_each_element(&o->tlvs, t, in_tlvs)
+    {
+      t->published_offset = pos;
+      pos += tlv_pad_len(&t->tlv);
     }
-  tlv_fill_pad(tb.head);
+  o->num_tlvs_incremental++;
+  return a;
+}
+
+/* Produce new TLV container for our own node, if the local tlvs have
+ * changed. Returns true if the container was (re)produced, and sets a
+ * to it if it differs from the current one. */
+static bool _produce_new_tlvs(dncp_node n, struct tlv_attr **a)
+{
+  dncp o = n->dncp;
+  bool full = !_tlvs_published_valid(o);
+
+  *a = NULL;
+  if (!_tlvs_changed(o))
+    return false;
+  if (full)
+    *a = _produce_new_tlvs_full(o);
+  else
+    *a = _produce_new_tlvs_incremental(o);
+  if (!*a)
+    return false;
 
   /* Ok, all puts _did_ succeed. */
-  o->tlvs_dirty = false;
+  _tlvs_published_reset(o);
+  o->tlvs_published = *a;
 
-  if (n->tlv_container && tlv_attr_equal(tb.head, n->tlv_container))
+  if (full && n->tlv_container && tlv_attr_equal(*a, n->tlv_container))
     {
-      tlv_buf_free(&tb);
-      return NULL;
+      free(*a);
+      *a = NULL;
+      o->tlvs_published = n->tlv_container;
     }
-  return tb.head;
+  return true;
 }
 
 void dncp_self_flush(dncp_node n)
 {
   dncp o = n->dncp;
-  struct tlv_attr *a, *a2;
+  struct tlv_attr *a;
+  bool produced;
 
-  if (!(a = _produce_new_tlvs(n)) && !o->republish_tlvs)
+  if (!_tlvs_changed(o) && !o->republish_tlvs)
     {
       L_DEBUG("dncp_self_flush: state did not change -> nothing to flush");
       return;
@@ -521,15 +1043,12 @@ void dncp_self_flush(dncp_node n)
   dncp_notify_subscribers_about_to_republish_tlvs(n);
 
   o->republish_tlvs = false;
-  a2 = _produce_new_tlvs(n);
-  if (a2)
-    {
-      if (a)
-        free(a);
-      a = a2;
-    }
+  produced = _produce_new_tlvs(n, &a);
   dncp_node_set(n, n->update_number + 1, dncp_time(o),
                 a ? a : n->tlv_container);
+  /* If a was identical to what we had, the old one was kept. */
+  if (produced)
+    o->tlvs_published = n->tlv_container;
 }
 
 struct tlv_attr *dncp_node_get_tlvs(dncp_node n)
@@ -553,36 +1072,163 @@ void dncp_calculate_node_data_hash(dncp_node n)
           n == n->dncp->own_node ? " [self]" : "");
 }
 
-void dncp_calculate_network_hash(dncp o)
+/* Node data hashes are calculated in batches of (at most) this many,
+ * if the profile can hash multiple buffers at once. */
+#define NODE_DATA_HASH_BATCH 64
+
+typedef struct {
+  int n;
+  dncp_node nodes[NODE_DATA_HASH_BATCH];
+} _node_data_hash_batch_s, *_node_data_hash_batch;
+
+static void _node_data_hash_batch_flush(dncp o, _node_data_hash_batch b)
 {
-  dncp_node n;
+  const void *bufs[NODE_DATA_HASH_BATCH];
+  size_t lens[NODE_DATA_HASH_BATCH];
+  void *dsts[NODE_DATA_HASH_BATCH];
+  int i;
 
-  if (!o->network_hash_dirty)
+  if (!b->n)
     return;
+  for (i = 0; i < b->n; i++)
+    {
+      dncp_node n = b->nodes[i];
 
-  /* Store original network hash for future study. */
-  dncp_hash_s old_hash = o->network_hash;
+      bufs[i] = n->tlv_container ? tlv_data(n->tlv_container) : "";
+      lens[i] = n->tlv_container ? tlv_len(n->tlv_container) : 0;
+      dsts[i] = &n->node_data_hash;
+      n->node_data_hash_dirty = false;
+    }
+  o->ext->cb.hash_multi(b->n, bufs, lens, dsts);
+  o->num_node_data_hash_batches++;
+  o->num_node_data_hash_batched += b->n;
+  b->n = 0;
+}
 
+static void _node_data_hash_batch_add(dncp o, _node_data_hash_batch b,
+                                      dncp_node n)
+{
+  if (!n->node_data_hash_dirty || !o->ext->cb.hash_multi)
+    return;
+  b->nodes[b->n++] = n;
+  if (b->n == NODE_DATA_HASH_BATCH)
+    _node_data_hash_batch_flush(o, b);
+}
+
+static void _network_hash_record(dncp_node n, void *dst)
+{
+  dncp_calculate_node_data_hash(n);
+  *((uint32_t *)dst) = cpu_to_be32(n->update_number);
+  memcpy(dst + 4, &n->node_data_hash, DNCP_HASH_LEN(n->dncp));
+  L_DEBUG(".. %s/%d=%s",
+          DNCP_NODE_REPR(n), n->update_number,
+          DNCP_HASH_REPR(n->dncp, &n->node_data_hash));
+}
+
+static bool _network_hash_rebuild(dncp o)
+{
+  int onelen = 4 + DNCP_HASH_LEN(o);
+  _node_data_hash_batch_s b = { .n = 0 };
+  dncp_node n, n2;
   int cnt = 0;
+
+  list_for_each_entry_safe(n, n2, &o->network_hash_dirty_nodes,
+                           in_network_hash_dirty)
+    list_del_init(&n->in_network_hash_dirty);
+
   dncp_for_each_node(o, n)
-    cnt++;
-  int onelen = 4 + DNCP_HASH_LEN(o);
-  void *buf = malloc(cnt * onelen);
-  if (!buf)
-    return;
-  void *dst = buf;
+    {
+      _node_data_hash_batch_add(o, &b, n);
+      cnt++;
+    }
+  _node_data_hash_batch_flush(o, &b);
+  if (cnt > o->network_hash_records_allocated)
+    {
+      /* Leave some room for growth so that we do not realloc on
+       * every new node. */
+      int nlen = cnt + cnt / 4 + 4;
+      void *buf = realloc(o->network_hash_records, nlen * onelen);
+      if (!buf)
+        return false;
+      o->network_hash_records = buf;
+      o->network_hash_records_allocated = nlen;
+    }
+  void *dst = o->network_hash_records;
+  cnt = 0;
   dncp_for_each_node(o, n)
     {
-      dncp_calculate_node_data_hash(n);
-      *((uint32_t *)dst) = cpu_to_be32(n->update_number);
-      memcpy(dst + 4, &n->node_data_hash, DNCP_HASH_LEN(o));
-      L_DEBUG(".. %s/%d=%s",
-              DNCP_NODE_REPR(n), n->update_number,
-              DNCP_HASH_REPR(n->dncp, &n->node_data_hash));
+      n->network_hash_slot = cnt++;
+      _network_hash_record(n, dst);
       dst += onelen;
     }
-  o->ext->cb.hash(buf, cnt * onelen, &o->network_hash);
-  free(buf);
+  o->network_hash_records_used = cnt;
+  o->network_hash_full_dirty = false;
+  o->num_network_hash_full++;
+  return true;
+}
+
+/* Rewrite the records of the nodes on the dirty list in place. Returns
+ * false if they cannot be (and full rebuild is needed); otherwise,
+ * changed is set if any of the records actually changed. */
+static bool _network_hash_update(dncp o, bool *changed)
+{
+  int onelen = 4 + DNCP_HASH_LEN(o);
+  unsigned char rec[4 + DNCP_HASH_MAX_LEN];
+  _node_data_hash_batch_s b = { .n = 0 };
+  dncp_node n, n2;
+
+  list_for_each_entry(n, &o->network_hash_dirty_nodes, in_network_hash_dirty)
+    _node_data_hash_batch_add(o, &b, n);
+  _node_data_hash_batch_flush(o, &b);
+
+  *changed = false;
+  list_for_each_entry_safe(n, n2, &o->network_hash_dirty_nodes,
+                           in_network_hash_dirty)
+    {
+      list_del_init(&n->in_network_hash_dirty);
+      /* Unreachable nodes are not part of the network hash. */
+      if (n->last_reachable_prune != o->last_prune)
+        continue;
+      if (n->network_hash_slot < 0
+          || n->network_hash_slot >= o->network_hash_records_used)
+        return false;
+      void *dst = o->network_hash_records + n->network_hash_slot * onelen;
+      _network_hash_record(n, rec);
+      if (memcmp(dst, rec, onelen))
+        {
+          memcpy(dst, rec, onelen);
+          *changed = true;
+        }
+    }
+  o->num_network_hash_incremental++;
+  return true;
+}
+
+void dncp_calculate_network_hash(dncp o)
+{
+  bool changed = true;
+
+  if (!o->network_hash_dirty)
+    return;
+
+  /* Anything that dirties the network hash may also change what we
+   * would put in the network state payload. */
+  o->net_state_valid = false;
+
+  /* Store original network hash for future study. */
+  dncp_hash_s old_hash = o->network_hash;
+
+  /* If the set of reachable nodes is unchanged, only the dirty nodes'
+   * records are rewritten. The hash itself is still calculated over
+   * all of them, as the hash callback is one-shot; if none of the
+   * records changed, the network hash stays as it was. */
+  if (o->network_hash_full_dirty || !_network_hash_update(o, &changed))
+    if (!_network_hash_rebuild(o))
+      return;
+  if (changed)
+    o->ext->cb.hash(o->network_hash_records,
+                    o->network_hash_records_used * (4 + DNCP_HASH_LEN(o)),
+                    &o->network_hash);
   L_DEBUG("dncp_calculate_network_hash =%s",
           DNCP_HASH_REPR(o, &o->network_hash));
 
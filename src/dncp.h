@@ -82,6 +82,10 @@ enum {
 
 typedef struct dncp_subscriber_struct dncp_subscriber_s, *dncp_subscriber;
 
+/* TLV types below this can be filtered in tlv_change_cb; ones above
+ * are always passed through. */
+#define DNCP_SUBSCRIBER_TLV_TYPES 256
+
 struct dncp_subscriber_struct {
   /**
    * Place within list of subscribers (owned by dncp while subscription
@@ -124,6 +128,16 @@ struct dncp_subscriber_struct {
   void (*tlv_change_cb)(dncp_subscriber s,
                         dncp_node n, struct tlv_attr *tlv, bool add);
 
+  /**
+   * TLV types tlv_change_cb is interested in.
+   *
+   * If none are set (the default), it is called for every TLV. These
+   * should be populated using dncp_subscriber_add_tlv_type before
+   * calling dncp_subscribe.
+   */
+  uint32_t tlv_types[DNCP_SUBSCRIBER_TLV_TYPES / 32];
+  bool tlv_types_set;
+
   /**
    * Node change notification.
    *
@@ -170,6 +184,15 @@ struct dncp_subscriber_struct {
                           struct tlv_attr *msg);
 };
 
+/* Limit tlv_change_cb to (also) the given TLV type. */
+static inline void dncp_subscriber_add_tlv_type(dncp_subscriber s,
+                                                uint16_t type)
+{
+  s->tlv_types_set = true;
+  if (type < DNCP_SUBSCRIBER_TLV_TYPES)
+    s->tlv_types[type / 32] |= 1U << (type % 32);
+}
+
 /***************************************** API for handling single endpoints */
 
 /* (dncp_ep_i itself is implementation detail) */
@@ -185,6 +208,12 @@ struct dncp_ep_struct {
   hnetd_time_t trickle_imin, trickle_imax;
   int trickle_k;
 
+  /* Adapt the above to the endpoint: on shared segments with many
+   * neighbors, k is 1 and Imin grows with the number of neighbors (and
+   * the recent rate of network hash changes); on point-to-point
+   * endpoints, Imax is shorter. */
+  bool trickle_adaptive;
+
   /* How frequently (overriding Trickle) we MUST send something on the
    * endpoint. */
   hnetd_time_t keepalive_interval;
@@ -192,6 +221,17 @@ struct dncp_ep_struct {
   /* How large can the multicasts be? */
   ssize_t maximum_multicast_size;
 
+  /* How large can unicasts aggregating several node state (request)
+   * TLVs be? Single larger TLVs are still sent alone. Zero disables
+   * aggregation. */
+  ssize_t maximum_unicast_size;
+
+  /* If the network state does not fit in a multicast, send rotating
+   * window of node states in each (instead of just network state
+   * hash), and split unicast network state replies to segments of at
+   * most maximum_unicast_size (instead of one big datagram). */
+  bool segment_network_state;
+
   /* Do we accept node data updates via multicast? */
   bool accept_node_data_updates_via_multicast;
 
@@ -448,11 +488,28 @@ struct dncp_ext_configuration_struct {
    * be used to respond to node data requests. */
   hnetd_time_t minimum_prune_interval;
 
+  /* Timer slack: Trickle transmissions, interval ends and keep-alives
+   * may be delayed to the next multiple of this, so that the ones
+   * close to each other are handled within the same wakeup. Trickle
+   * transmissions are never delayed past the end of their interval.
+   * Zero disables. */
+  hnetd_time_t trickle_slack;
+
   /* How much memory do we allocate for external code parts per node? */
   size_t ext_node_data_size;
 
   /* How much memory do we allocate for external code parts per ep? */
   size_t ext_ep_data_size;
+
+  /* Number of cells (per hash function) in the set reconciliation
+   * summary sent with network state requests (and the largest we
+   * accept). Zero disables the extension. */
+  uint16_t sync_summary_cells;
+
+  /* Keep the previous version of node data of every node, and
+   * request (and send) node data as difference to the version the
+   * requester has, if possible. */
+  bool node_data_delta;
 };
 
 /* While the code uses sockaddr_in6 for now, it intentionally does not
@@ -500,6 +557,14 @@ struct dncp_ext_cbs_struct {
    */
   void (*hash)(const void *buf, size_t len, void *dst);
 
+  /**
+   * Optional callback to hash many buffers at once; same as calling
+   * hash(bufs[i], lens[i], dsts[i]) for each i < n. It is used to
+   * calculate the node data hashes of all dirty nodes in one go.
+   */
+  void (*hash_multi)(int n, const void * const *bufs, const size_t *lens,
+                     void * const *dsts);
+
   /**
    * Validate node data.
    */
@@ -549,6 +614,13 @@ dncp_node dncp_node_from_ext_data(void *ext_data);
  */
 void dncp_ext_ep_ready(dncp_ep ep, bool ready);
 
+/**
+ * Notification from i/o that the link of the endpoint went down (or
+ * up). On carrier loss, the neighbors on the endpoint are dropped at
+ * once, instead of when they would time out.
+ */
+void dncp_ext_ep_carrier(dncp_ep ep, bool up);
+
 /**
  * Reverse operation - convert ext data pointer to ep.
  */
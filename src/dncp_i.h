@@ -37,6 +37,7 @@
 #include <libubox/list.h>
 
 typedef struct dncp_ep_i_struct dncp_ep_i_s, *dncp_ep_i;
+typedef struct dncp_neighbor_struct dncp_neighbor_s, *dncp_neighbor;
 
 
 typedef struct __packed {
@@ -47,6 +48,53 @@ typedef struct __packed {
   unsigned char buf[DNCP_NI_MAX_LEN];
 } dncp_node_id_s, *dncp_node_id;
 
+typedef struct {
+  int offset;
+  int len;
+} dncp_tlv_range_s, *dncp_tlv_range;
+
+typedef struct {
+  int offset;
+  hnetd_time_t origination_time;
+} dncp_net_state_slot_s, *dncp_net_state_slot;
+
+/* Number of recently verified node state payloads remembered. */
+#define DNCP_VERIFIED_CACHE_SIZE 32
+
+/* Period over which the wakeup rate is calculated. */
+#define DNCP_WAKEUP_RATE_WINDOW (60 * HNETD_TIME_PER_SECOND)
+
+/* Adaptive Trickle (see dncp_ep_s.trickle_adaptive): */
+
+/* Period over which Trickle resets are counted. */
+#define DNCP_TRICKLE_RESET_WINDOW (30 * HNETD_TIME_PER_SECOND)
+
+/* Endpoints with more neighbors than this are shared segments; their
+ * Imin grows linearly with the number of neighbors. */
+#define DNCP_TRICKLE_DENSE_NEIGHBORS 4
+
+/* Once the network hash has changed this many times within the reset
+ * window, Imin of shared segments is doubled. */
+#define DNCP_TRICKLE_CHURN_RESETS 5
+
+/* Imax of point-to-point endpoints is divided by this (but not below
+ * Imin), so that silent divergence is noticed sooner. */
+#define DNCP_TRICKLE_P2P_IMAX_DIVISOR 4
+
+typedef struct {
+  dncp_node_id_s node_id;
+  uint32_t update_number;
+  dncp_hash_s hash;
+  int len;
+
+  /* Copy of the verified payload; a hit requires the received bytes
+   * to match it, so that nothing unhashed is ever accepted. */
+  void *data;
+
+  /* Value of verified_clock when last used; zero if the slot is free. */
+  uint32_t last_used;
+} dncp_verified_s, *dncp_verified;
+
 struct dncp_struct {
   /* 'external' handling structure */
   dncp_ext ext;
@@ -74,6 +122,27 @@ struct dncp_struct {
    * of what's in local tlvs currently. */
   bool republish_tlvs;
 
+  /* The own node TLV container the published_offset of local tlvs
+   * refer to. Changes to local tlvs since are spliced into (copy of)
+   * it, instead of producing the whole container from scratch. */
+  struct tlv_attr *tlvs_published;
+
+  /* Local tlvs added since tlvs_published was produced. */
+  struct list_head tlvs_added;
+
+  /* Ranges of tlvs_published removed since. */
+  dncp_tlv_range_s *tlvs_removed;
+  int tlvs_removed_allocated;
+  int tlvs_removed_used;
+
+  /* flag which indicates that tlvs_published cannot be used, and
+   * therefore the container has to be produced from scratch. */
+  bool tlvs_full_dirty;
+
+  /* Number of full and incremental own node TLV container updates. */
+  int num_tlvs_full;
+  int num_tlvs_incremental;
+
   /* Have we already collided once this boot? If so, let profile deal
    * with it. */
   bool collided;
@@ -82,10 +151,33 @@ struct dncp_struct {
    * changed connectivity. */
   bool graph_dirty;
 
+  /* flag which indicates that some reachable node may have lost a
+   * neighbor, and therefore whole graph has to be pruned. If not set,
+   * pruning starts only from prune_seeds. */
+  bool graph_full_dirty;
+
+  /* Nodes that may have gained neighbors since the last prune. */
+  struct list_head prune_seeds;
+
+  /* Work stack of nodes to visit during prune. */
+  dncp_node *prune_stack;
+  int prune_stack_size;
+
   /* Few different times.. */
   hnetd_time_t last_prune;
   hnetd_time_t next_prune;
 
+  /* Incremental prunes do not touch last_prune (it identifies the
+   * reachable nodes). When full prune is needed at latest due to
+   * expiration or grace period, and when the last incremental one
+   * was. */
+  hnetd_time_t next_full_prune;
+  hnetd_time_t last_incremental_prune;
+
+  /* Number of full and incremental prunes. */
+  int num_prune_full;
+  int num_prune_incremental;
+
   /* flag which indicates that we should re-calculate network hash
    * based on nodes' state. */
   bool network_hash_dirty;
@@ -98,10 +190,81 @@ struct dncp_struct {
   /* Whole network hash we consider current (based on content of 'nodes'). */
   dncp_hash_s network_hash;
 
+  /* The (update number, node data hash) records of reachable nodes,
+   * in node identifier order, that the network hash is calculated
+   * over. Kept around so that only the changed records need to be
+   * rewritten. */
+  void *network_hash_records;
+  int network_hash_records_allocated;
+  int network_hash_records_used;
+
+  /* Nodes whose network hash record may be out of date. */
+  struct list_head network_hash_dirty_nodes;
+
+  /* flag which indicates that the set of reachable nodes may have
+   * changed, and therefore the records have to be rebuilt from
+   * scratch. */
+  bool network_hash_full_dirty;
+
+  /* Number of full and incremental network hash recalculations. */
+  int num_network_hash_full;
+  int num_network_hash_incremental;
+
+  /* Number of node data hash batches (and nodes hashed in them). */
+  int num_node_data_hash_batches;
+  int num_node_data_hash_batched;
+
+  /* Cached network state payload: room for endpoint identifier TLV,
+   * network state TLV, and node state TLVs of reachable nodes. It is
+   * valid until the network hash is next recalculated; only the
+   * endpoint identifier and the ms_since_origination fields (at the
+   * offsets in net_state_slots) are patched for each send. */
+  struct tlv_buf net_state_tb;
+  bool net_state_valid;
+  dncp_net_state_slot_s *net_state_slots;
+  int net_state_slots_allocated;
+  int net_state_slots_used;
+
+  /* Scratch buffer for network state windows and segments. */
+  void *net_state_segment;
+  int net_state_segment_allocated;
+
+  /* Number of network state payload builds and sends (and how many
+   * of the sends were windows or segmented). */
+  int num_net_state_builds;
+  int num_net_state_sends;
+  int num_net_state_windows;
+  int num_net_state_segmented;
+
+  /* Number of set reconciliation summaries sent, and received ones
+   * that could (not) be decoded. */
+  int num_sync_sent;
+  int num_sync_decoded;
+  int num_sync_failed;
+
+  /* Number of node data deltas sent, and received ones that could
+   * (not) be applied. */
+  int num_node_deltas_sent;
+  int num_node_deltas_applied;
+  int num_node_deltas_failed;
+
+  /* Node state payloads whose hash has been verified recently;
+   * further identical copies of them need not be hashed again. Least
+   * recently used is replaced. */
+  dncp_verified_s verified[DNCP_VERIFIED_CACHE_SIZE];
+  uint32_t verified_clock;
+  int num_verified_hits;
+  int num_verified_misses;
+
   /* First free local interface identifier (we allocate them in
    * monotonically increasing fashion just to keep things simple). */
   int first_free_ep_id;
 
+  /* Endpoints indexed by their identifier (as they are allocated in
+   * sequence, this is dense). */
+  dncp_ep_i *eps_by_id;
+  int eps_by_id_allocated;
+
   /* List of subscribers to change notifications. */
   struct list_head subscribers[NUM_DNCP_CALLBACKS];
 
@@ -118,6 +281,33 @@ struct dncp_struct {
 
   /* Number of times neighbor has been dropped. */
   int num_neighbor_dropped;
+
+  /* Binary min-heap of local neighbors, keyed by when they next need
+   * attention (keep-alive, per-peer Trickle, or expiry). */
+  dncp_neighbor *neighbor_heap;
+  int neighbor_heap_len;
+  int neighbor_heap_size;
+
+  /* Every neighbor should be looked at on next timeout (e.g. Trickle
+   * was reset). */
+  bool neighbors_dirty;
+
+  /* Number of times a neighbor has been looked at in timeout. */
+  int num_neighbor_timeouts;
+
+  /* Number of timeouts (wakeups), and their rate (per 1000 seconds)
+   * over the last DNCP_WAKEUP_RATE_WINDOW. */
+  int num_wakeups;
+  int wakeups_per_1000s;
+  int wakeup_window_wakeups;
+  hnetd_time_t wakeup_window_start;
+
+  /* Number of Trickle resets, total and within the current and the
+   * previous DNCP_TRICKLE_RESET_WINDOW. */
+  int num_trickle_resets;
+  int trickle_resets;
+  int trickle_resets_prev;
+  hnetd_time_t trickle_reset_window_start;
 };
 
 typedef struct dncp_trickle_struct dncp_trickle_s, *dncp_trickle;
@@ -143,6 +333,10 @@ struct dncp_ep_i_struct {
   /* Is the endpoint actually 'ready' according to ext? By default, not. */
   bool enabled;
 
+  /* Has ext told us the link is down? Whatever is still received on
+   * it is stale. */
+  bool carrier_down;
+
   /* The public portion of the endpoint */
   dncp_ep_s conf;
 
@@ -159,9 +353,22 @@ struct dncp_ep_i_struct {
 
   /* The per-ep Trickle state. */
   dncp_trickle_s trickle;
-};
 
-typedef struct dncp_neighbor_struct dncp_neighbor_s, *dncp_neighbor;
+  /* The Trickle parameters in use; same as in conf, unless
+   * conf.trickle_adaptive is set. */
+  hnetd_time_t trickle_imin, trickle_imax;
+  int trickle_k;
+
+  /* Number of local neighbor TLVs on the endpoint. */
+  int num_neighbors;
+
+  /* Index of the first node state in the next multicast window (if
+   * the network state does not fit in one). */
+  int net_state_window;
+
+  /* When was the previous multicast window sent. */
+  hnetd_time_t last_net_state_window;
+};
 
 struct dncp_neighbor_struct {
   /* Most recent address we heard from this particular neighbor */
@@ -173,8 +380,32 @@ struct dncp_neighbor_struct {
 
   /* The per-(local)peer Trickle state. */
   dncp_trickle_s trickle;
+
+  /* The local DNCP_T_NEIGHBOR TLV this is the extra data of. */
+  dncp_tlv tlv;
+
+  /* Position in dncp->neighbor_heap (+1; 0 if not there), and when
+   * the neighbor next needs attention. */
+  int heap_index;
+  hnetd_time_t deadline;
+
+  /* Cached keepalive interval of the peer (see _neighbor_interval). */
+  hnetd_time_t keepalive_interval;
+  bool keepalive_interval_valid;
 };
 
+typedef struct dncp_edge_struct dncp_edge_s, *dncp_edge;
+
+struct dncp_edge_struct {
+  /* The DNCP_T_NEIGHBOR TLV (within tlv_container of the node). */
+  struct tlv_attr *a;
+
+  /* Its content (dncp_tlv_neighbor(a)). */
+  dncp_t_neighbor ne;
+
+  /* The node at the other end, if the edge is bidirectional. */
+  dncp_node peer;
+};
 
 struct dncp_node_struct {
   /* dncp->nodes entry */
@@ -190,9 +421,19 @@ struct dncp_node_struct {
   /* When was the last prune during which this node was reachable */
   hnetd_time_t last_reachable_prune;
 
+  /* dncp->prune_seeds entry (if any) */
+  struct list_head in_prune_seeds;
+
   /* Node state stuff */
   dncp_hash_s node_data_hash;
   bool node_data_hash_dirty; /* Something related to hash changed */
+
+  /* Index of the node's record within dncp->network_hash_records
+   * (valid only while the node is reachable). */
+  int network_hash_slot;
+
+  /* dncp->network_hash_dirty_nodes entry (if any) */
+  struct list_head in_network_hash_dirty;
   hnetd_time_t origination_time; /* in monotonic time */
   hnetd_time_t expiration_time; /* in monotonic time */
 
@@ -206,6 +447,12 @@ struct dncp_node_struct {
    * it should be used by us. Either tlv_container, or NULL. */
   struct tlv_attr *tlv_container_valid;
 
+  /* Previous version of tlv_container (if node data deltas are
+   * enabled), along with its update number and hash. */
+  struct tlv_attr *prev_tlv_container;
+  uint32_t prev_update_number;
+  dncp_hash_s prev_node_data_hash;
+
   /* An index of DNCP TLV indexes (that have been registered and
    * precomputed for this node). Typically NULL, until first access
    * during which we have to traverse all TLVs in any case and this
@@ -218,12 +465,28 @@ struct dncp_node_struct {
    * re-alloc when tlv_container changes and we don't immediately want
    * to recalculate tlv_index. */
   bool tlv_index_dirty;
+
+  /* Neighbor graph edges of the node, one per DNCP_T_NEIGHBOR TLV in
+   * tlv_container, sorted by the TLV content. They are re-parsed only
+   * when tlv_container changes. */
+  dncp_edge_s *edges;
+  int num_edges;
+
+  /* Flag which indicates that peer of (some of) the edges may be out
+   * of date, and has to be resolved again before use. */
+  bool edges_dirty;
 };
 
 struct dncp_tlv_struct {
   /* dncp->tlvs entry */
   struct vlist_node in_tlvs;
 
+  /* dncp->tlvs_added entry */
+  struct list_head in_tlvs_added;
+
+  /* Offset within data of dncp->tlvs_published, or -1 if not there. */
+  int published_offset;
+
   /* Actual TLV attribute itself. */
   struct tlv_attr tlv;
 
@@ -243,15 +506,22 @@ void dncp_node_set(dncp_node n,
                    uint32_t update_number, hnetd_time_t t,
                    struct tlv_attr *a);
 void dncp_node_recalculate_index(dncp_node n);
+dncp_edge dncp_node_get_edges(dncp_node n);
+dncp_edge dncp_node_find_edges_to(dncp_node n, void *ni);
+dncp_node dncp_node_find_neigh_bidir(dncp_node n, dncp_t_neighbor ne);
 
 bool dncp_add_tlv_index(dncp o, uint16_t type);
 
+/* Renumber an endpoint; valid only before it is enabled. */
+bool dncp_ep_set_id(dncp_ep ep, uint32_t ep_id);
+
 void dncp_schedule(dncp o);
 
 /* Flush own TLV changes to own node. */
 void dncp_self_flush(dncp_node n);
 
 /* Various hash calculation utilities. */
+void dncp_calculate_node_data_hash(dncp_node n);
 void dncp_calculate_network_hash(dncp o);
 
 /* Utility functions to send frames. */
@@ -265,6 +535,22 @@ void dncp_ep_i_send_network_state(dncp_ep_i l,
 /* Miscellaneous utilities that live in dncp_timeout */
 void dncp_trickle_reset(dncp o);
 
+/* Neighbor deadline heap; deadline 0 means 'look at it on next
+ * timeout'. */
+void dncp_neighbor_schedule(dncp o, dncp_neighbor n, hnetd_time_t deadline);
+void dncp_neighbor_unschedule(dncp o, dncp_neighbor n);
+
+/* Set reconciliation summary extension (dncp_sync). The callback is
+ * called for every (node identifier, update number, node data hash)
+ * that differs; ours is set if it is in our set, and not in the one
+ * the summary was calculated over. */
+typedef void (*dncp_sync_cb)(void *context, void *node_id,
+                             uint32_t update_number, dncp_hash h,
+                             bool ours);
+bool dncp_sync_push_summary(dncp o, struct tlv_buf *tb);
+bool dncp_sync_handle_summary(dncp o, struct tlv_attr *a,
+                              dncp_sync_cb cb, void *context);
+
 /* Compatibility / convenience macros to access stuff that used to be fixed. */
 #define DNCP_NI_LEN(o) (o)->ext->conf.node_id_length
 #define DNCP_HASH_LEN(o) (o)->ext->conf.hash_length
@@ -321,27 +607,8 @@ dncp_tlv_get_node_id(dncp o, void *tlv)
                                o->ext->conf.node_id_length);
 }
 
-static inline dncp_node
-dncp_node_find_neigh_bidir(dncp_node n, dncp_t_neighbor ne)
-{
-  if (!n)
-    return NULL;
-  dncp_node_id ni = dncp_tlv_get_node_id(n->dncp, ne);
-  dncp_node n2 = dncp_find_node_by_node_id(n->dncp, ni, false);
-  if (!n2)
-    return NULL;
-  struct tlv_attr *a;
-  dncp_t_neighbor ne2;
-
-  dncp_node_for_each_tlv_with_t_v(n2, a, DNCP_T_NEIGHBOR, false)
-    if ((ne2 = dncp_tlv_neighbor(n->dncp, a)))
-      {
-        if (ne->ep_id == ne2->neighbor_ep_id
-            && ne->neighbor_ep_id == ne2->ep_id &&
-            !memcmp(dncp_tlv_get_node_id(n->dncp, ne2),
-                    &n->node_id, DNCP_NI_LEN(n->dncp)))
-          return n2;
-      }
-
-  return NULL;
-}
+/* Iterate through the bidirectional neighbor edges of a node (also
+ * ones in its not-yet-validated data). */
+#define dncp_node_for_each_edge(n, e)                                   \
+  for (e = dncp_node_get_edges(n) ; e < (n)->edges + (n)->num_edges ; e++) \
+    if (e->peer)
@@ -27,6 +27,14 @@
     x(o, s, DNCP_CALLBACK_SOCKET_MSG, msg_received_cb);         \
   } while(0)
 
+static inline bool _subscriber_wants(dncp_subscriber s, struct tlv_attr *a)
+{
+  unsigned int type = tlv_id(a);
+
+  return !s->tlv_types_set || type >= DNCP_SUBSCRIBER_TLV_TYPES
+    || (s->tlv_types[type / 32] & (1U << (type % 32)));
+}
+
 #define HANDLE_ADD(o, s, e, cb)                         \
   if (s->cb) list_add(&s->lhs[e], &o->subscribers[e])
 
@@ -48,7 +56,8 @@ void dncp_subscribe(dncp o, dncp_subscriber s)
         s->node_change_cb(s, n, true);
       if (s->tlv_change_cb)
         dncp_node_for_each_tlv(n, a)
-          s->tlv_change_cb(s, n, a, true);
+          if (_subscriber_wants(s, a))
+            s->tlv_change_cb(s, n, a, true);
     }
 }
 
@@ -70,7 +79,8 @@ void dncp_unsubscribe(dncp o, dncp_subscriber s)
     {
       if (s->tlv_change_cb)
         dncp_node_for_each_tlv(n, a)
-          s->tlv_change_cb(s, n, a, false);
+          if (_subscriber_wants(s, a))
+            s->tlv_change_cb(s, n, a, false);
       if (s->node_change_cb)
         s->node_change_cb(s, n, false);
     }
@@ -92,105 +102,128 @@ void dncp_unsubscribe(dncp o, dncp_subscriber s)
       break;                                    \
     }
 
+typedef struct {
+  struct tlv_attr *a;
+  bool add;
+} dncp_tlv_change_s, *dncp_tlv_change;
+
+static bool _push_change(dncp_tlv_change *changes, int *num, int *size,
+                         dncp_tlv_change_s *stack_changes,
+                         struct tlv_attr *a, bool add)
+{
+  if (*num == *size)
+    {
+      int nsize = *size * 2;
+      dncp_tlv_change nc;
+
+      if (*changes == stack_changes)
+        {
+          if ((nc = malloc(nsize * sizeof(*nc))))
+            memcpy(nc, *changes, *num * sizeof(*nc));
+        }
+      else
+        nc = realloc(*changes, nsize * sizeof(*nc));
+      if (!nc)
+        {
+          L_ERR("unable to allocate %d tlv changes", nsize);
+          return false;
+        }
+      *changes = nc;
+      *size = nsize;
+    }
+  (*changes)[*num].a = a;
+  (*changes)[*num].add = add;
+  (*num)++;
+  return true;
+}
+
 void dncp_notify_subscribers_tlvs_changed(dncp_node n,
                                           struct tlv_attr *a_old,
                                           struct tlv_attr *a_new)
 {
+  struct list_head *h = &n->dncp->subscribers[DNCP_CALLBACK_TLV];
   dncp_subscriber s;
   void *old_end = (void *)a_old + (a_old ? tlv_pad_len(a_old) : 0);
   void *new_end = (void *)a_new + (a_new ? tlv_pad_len(a_new) : 0);
+  struct tlv_attr *op = a_old ? tlv_data(a_old) : NULL;
+  struct tlv_attr *np = a_new ? tlv_data(a_new) : NULL;
+  dncp_tlv_change_s stack_changes[32];
+  dncp_tlv_change changes = stack_changes;
+  int num = 0, size = ARRAY_SIZE(stack_changes), i;
   int r;
 
-  /* There are two distinct steps here: First we remove missing, and
-   * then we add new ones. Otherwise, there may be confusion if we get
-   * first new + then remove, and the underlying TLV has same
-   * key.. :-p */
-  list_for_each_entry(s, &n->dncp->subscribers[DNCP_CALLBACK_TLV],
-                      lhs[DNCP_CALLBACK_TLV])
-    {
-      struct tlv_attr *op = a_old ? tlv_data(a_old) : NULL;
-      struct tlv_attr *np = a_new ? tlv_data(a_new) : NULL;
+  if (list_empty(h))
+    return;
 
-      /* Keep two pointers, one for old, one for new. */
+  /* Calculate the difference just once, regardless of the number of
+   * subscribers. */
 
-      /* While there's data in both, and it looks valid, we drain each
-       * 0-1 at the time. */
-      while (op && np)
-        {
-          ENSURE_VALID(op, old_end);
-          ENSURE_VALID(np, new_end);
-          /* Ok, op and np both point at valid structs. */
-          r = tlv_attr_cmp(op, np);
-          /* If they're equal, we can skip both, no sense giving notification */
-          if (!r)
-            {
-              op = tlv_next(op);
-              np = tlv_next(np);
-            }
-          else if (r < 0)
-            {
-              /* op < np => op deleted */
-              s->tlv_change_cb(s, n, op, false);
-              op = tlv_next(op);
-            }
-          else
-            {
-              /* op > np => np added */
-              /* in part 2 */
-              np = tlv_next(np);
-            }
-        }
-      /* Anything left in op was deleted. */
-      while (op)
+  /* Keep two pointers, one for old, one for new. */
+
+  /* While there's data in both, and it looks valid, we drain each
+   * 0-1 at the time. */
+  while (op && np)
+    {
+      ENSURE_VALID(op, old_end);
+      ENSURE_VALID(np, new_end);
+      /* Ok, op and np both point at valid structs. */
+      r = tlv_attr_cmp(op, np);
+      /* If they're equal, we can skip both, no sense giving notification */
+      if (!r)
         {
-          ENSURE_VALID(op, old_end);
-          s->tlv_change_cb(s, n, op, false);
           op = tlv_next(op);
+          np = tlv_next(np);
         }
-    }
-  list_for_each_entry(s, &n->dncp->subscribers[DNCP_CALLBACK_TLV],
-                      lhs[DNCP_CALLBACK_TLV])
-    {
-      struct tlv_attr *op = a_old ? tlv_data(a_old) : NULL;
-      struct tlv_attr *np = a_new ? tlv_data(a_new) : NULL;
-
-      /* Keep two pointers, one for old, one for new. */
-
-      /* While there's data in both, and it looks valid, we drain each
-       * 0-1 at the time. */
-      while (op && np)
+      else if (r < 0)
         {
-          ENSURE_VALID(op, old_end);
-          ENSURE_VALID(np, new_end);
-          /* Ok, op and np both point at valid structs. */
-          r = tlv_attr_cmp(op, np);
-          /* If they're equal, we can skip both, no sense giving notification */
-          if (!r)
-            {
-              op = tlv_next(op);
-              np = tlv_next(np);
-            }
-          else if (r < 0)
-            {
-              /* op < np => op deleted */
-              /* we did this in part 1 */
-              op = tlv_next(op);
-            }
-          else
-            {
-              /* op > np => np added */
-              s->tlv_change_cb(s, n, np, true);
-              np = tlv_next(np);
-            }
+          /* op < np => op deleted */
+          if (!_push_change(&changes, &num, &size, stack_changes, op, false))
+            goto notify;
+          op = tlv_next(op);
         }
-      /* Anything left in np was added. */
-      while (np)
+      else
         {
-          ENSURE_VALID(np, new_end);
-          s->tlv_change_cb(s, n, np, true);
+          /* op > np => np added */
+          if (!_push_change(&changes, &num, &size, stack_changes, np, true))
+            goto notify;
           np = tlv_next(np);
         }
     }
+  /* Anything left in op was deleted. */
+  while (op)
+    {
+      ENSURE_VALID(op, old_end);
+      if (!_push_change(&changes, &num, &size, stack_changes, op, false))
+        goto notify;
+      op = tlv_next(op);
+    }
+  /* Anything left in np was added. */
+  while (np)
+    {
+      ENSURE_VALID(np, new_end);
+      if (!_push_change(&changes, &num, &size, stack_changes, np, true))
+        goto notify;
+      np = tlv_next(np);
+    }
+
+ notify:
+  /* There are two distinct steps here: First we remove missing, and
+   * then we add new ones. Otherwise, there may be confusion if we get
+   * first new + then remove, and the underlying TLV has same
+   * key.. :-p */
+  if (num)
+    {
+      list_for_each_entry(s, h, lhs[DNCP_CALLBACK_TLV])
+        for (i = 0 ; i < num ; i++)
+          if (!changes[i].add && _subscriber_wants(s, changes[i].a))
+            s->tlv_change_cb(s, n, changes[i].a, false);
+      list_for_each_entry(s, h, lhs[DNCP_CALLBACK_TLV])
+        for (i = 0 ; i < num ; i++)
+          if (changes[i].add && _subscriber_wants(s, changes[i].a))
+            s->tlv_change_cb(s, n, changes[i].a, true);
+    }
+  if (changes != stack_changes)
+    free(changes);
 }
 
 void dncp_notify_subscribers_local_tlv_changed(dncp o,
@@ -85,78 +85,218 @@ static bool _push_ep_id_tlv(struct tlv_buf *tb, dncp_ep_i l,
 
 /****************************************** Actual payload sending utilities */
 
+/* (Re)build the cached network state payload if the network hash
+ * has changed since it was last built. */
+static bool _net_state_build(dncp o)
+{
+  struct tlv_buf *tb = &o->net_state_tb;
+  int nilen = DNCP_NI_LEN(o);
+  dncp_node n;
+  int cnt = 0;
+
+  dncp_calculate_network_hash(o);
+  if (o->net_state_valid)
+    return true;
+  dncp_for_each_node(o, n)
+    cnt++;
+  if (cnt > o->net_state_slots_allocated)
+    {
+      int nlen = cnt + cnt / 4 + 4;
+      void *buf = realloc(o->net_state_slots,
+                          nlen * sizeof(*o->net_state_slots));
+      if (!buf)
+        return false;
+      o->net_state_slots = buf;
+      o->net_state_slots_allocated = nlen;
+    }
+  if (tlv_buf_init(tb, 0) < 0 /* not passed anywhere */
+      || !tlv_new(tb, DNCP_T_ENDPOINT_ID, nilen + sizeof(dncp_t_ep_id_s))
+      || !_push_network_state_tlv(tb, o))
+    return false;
+  cnt = 0;
+  dncp_for_each_node(o, n)
+    {
+      dncp_net_state_slot slot = &o->net_state_slots[cnt++];
+
+      slot->offset = tlv_len(tb->head) + sizeof(struct tlv_attr) + nilen
+        + offsetof(dncp_t_node_state_s, ms_since_origination);
+      slot->origination_time = n->origination_time;
+      if (!_push_node_state_tlv(tb, n, false))
+        return false;
+    }
+  o->net_state_slots_used = cnt;
+  o->net_state_valid = true;
+  o->num_net_state_builds++;
+  return true;
+}
+
+static bool _push_net_state_slot(dncp o, int slot, size_t *len,
+                                 size_t maximum_size)
+{
+  void *buf = tlv_data(o->net_state_tb.head);
+  int ms_offset = sizeof(struct tlv_attr) + DNCP_NI_LEN(o)
+    + offsetof(dncp_t_node_state_s, ms_since_origination);
+  struct tlv_attr *a = buf + o->net_state_slots[slot].offset - ms_offset;
+  size_t alen = tlv_pad_len(a);
+
+  if (*len + alen > maximum_size)
+    return false;
+  memcpy(o->net_state_segment + *len, a, alen);
+  *len += alen;
+  return true;
+}
+
+/* Send hdr followed by at most count node states from the cached
+ * network state payload, starting at index first (and wrapping
+ * around). If recent is non-zero, and there are node states
+ * originated after it, only they are sent instead. Returns how far
+ * from first we got, or -1 if no node state fit in maximum_size (and
+ * nothing was sent). */
+static int _send_net_state_segment(dncp_ep_i l,
+                                   struct sockaddr_in6 *src,
+                                   struct sockaddr_in6 *dst,
+                                   void *hdr, size_t hdr_len,
+                                   int first, int count,
+                                   hnetd_time_t recent,
+                                   size_t maximum_size)
+{
+  dncp o = l->dncp;
+  size_t len = hdr_len;
+  int i, slot, sent = 0;
+
+  if ((int)maximum_size > o->net_state_segment_allocated)
+    {
+      void *nbuf = realloc(o->net_state_segment, maximum_size);
+      if (!nbuf)
+        return -1;
+      o->net_state_segment = nbuf;
+      o->net_state_segment_allocated = maximum_size;
+    }
+  if (recent)
+    for (slot = 0; slot < o->net_state_slots_used; slot++)
+      if (o->net_state_slots[slot].origination_time > recent)
+        {
+          if (!_push_net_state_slot(o, slot, &len, maximum_size))
+            break;
+          sent++;
+        }
+  for (i = 0; i < count && !(recent && sent); i++)
+    {
+      slot = (first + i) % o->net_state_slots_used;
+      if (recent && o->net_state_slots[slot].origination_time > recent)
+        continue;
+      if (!_push_net_state_slot(o, slot, &len, maximum_size))
+        break;
+      sent++;
+    }
+  if (!sent)
+    return -1;
+  memcpy(o->net_state_segment, hdr, hdr_len);
+  L_DEBUG("_send_net_state_segment %d node states -> " SA6_F "%%" DNCP_LINK_F,
+          sent, SA6_D(dst), DNCP_LINK_D(l));
+  o->num_net_state_sends++;
+  o->ext->cb.send(o->ext, &l->conf, src, dst, o->net_state_segment, len);
+  return i;
+}
+
 void dncp_ep_i_send_network_state(dncp_ep_i l,
                                   struct sockaddr_in6 *src,
                                   struct sockaddr_in6 *dst,
                                   size_t maximum_size,
                                   bool always_ep_id)
 {
-  struct tlv_buf tb;
   dncp o = l->dncp;
-  dncp_node n;
+  void *buf, *start;
+  struct tlv_attr *a;
+  size_t len, full_len;
+  int i, c, n;
 
-  memset(&tb, 0, sizeof(tb));
-  tlv_buf_init(&tb, 0); /* not passed anywhere */
-  if (!_push_ep_id_tlv(&tb, l, dst, always_ep_id))
-    goto done;
-  if (!_push_network_state_tlv(&tb, o))
-    goto done;
+  if (!_net_state_build(o))
+    return;
+  buf = tlv_data(o->net_state_tb.head);
+  n = o->net_state_slots_used;
+
+  /* Endpoint identifier TLV is first; fill it in, or skip it. */
+  a = buf;
+  if (l->conf.unicast_is_reliable_stream && dst && !always_ep_id)
+    start = buf + tlv_pad_len(a);
+  else
+    {
+      dncp_t_ep_id lid = tlv_data(a) + DNCP_NI_LEN(o);
 
-  /* We multicast only 'stable' state. Unicast, we give everything we have. */
+      memcpy(tlv_data(a), &o->own_node->node_id, DNCP_NI_LEN(o));
+      lid->ep_id = l->ep_id;
+      start = buf;
+    }
+
+  /* Network state TLV follows, and then the node state TLVs. */
+  len = buf + tlv_pad_len(a) + tlv_pad_len(tlv_next(a)) - start;
+  full_len = buf + tlv_len(o->net_state_tb.head) - start;
+
+  /* We multicast only 'stable' state. Unicast, we give everything we
+   * have (node states last, so they can be just cut off). */
   if (!o->graph_dirty || !maximum_size)
     {
-      int nn = 0;
-      int nilen = DNCP_NI_LEN(o);
-      int hlen = DNCP_HASH_LEN(o);
-      int ns_len = sizeof(dncp_t_node_state_s) + nilen + hlen;
-
-      if (maximum_size)
-        dncp_for_each_node(o, n)
-          nn++;
-      if (!maximum_size
-          || maximum_size >= (tlv_len(tb.head)
-                              + nn * (4 + ns_len)))
+      hnetd_time_t now = dncp_time(o);
+
+      for (i = 0; i < n; i++)
+        {
+          dncp_net_state_slot slot = &o->net_state_slots[i];
+          uint32_t *ms = buf + slot->offset;
+
+          *ms = cpu_to_be32(now - slot->origination_time);
+        }
+      if (!maximum_size)
         {
-          dncp_for_each_node(o, n)
+          size_t segment_size = l->conf.maximum_unicast_size;
+
+          /* Split big unicast replies to segments; only the first
+           * one has the network state. */
+          if (l->conf.segment_network_state && dst && segment_size
+              && !l->conf.unicast_is_reliable_stream
+              && full_len > segment_size
+              && (c = _send_net_state_segment(l, src, dst, start, len,
+                                              0, n, 0, segment_size)) > 0)
             {
-              if (!_push_node_state_tlv(&tb, n, false))
-                goto done;
+              for (i = c; i < n; i += c)
+                if ((c = _send_net_state_segment(l, src, dst,
+                                                 start, tlv_pad_len(a),
+                                                 i, n - i, 0,
+                                                 segment_size)) <= 0)
+                  break;
+              o->num_net_state_segmented++;
+              return;
             }
+          len = full_len;
+        }
+      else if (maximum_size >= full_len)
+        len = full_len;
+      else if (l->conf.segment_network_state && n
+               && (c = _send_net_state_segment(l, src, dst, start, len,
+                                               l->net_state_window % n, n,
+                                               l->last_net_state_window,
+                                               maximum_size)) >= 0)
+        {
+          /* Multicast what fits, and continue from there next time.
+           * Node states that have changed since the previous window
+           * are the likely cause of inconsistency, so if there are
+           * any, they are sent instead. */
+          l->net_state_window = (l->net_state_window % n + c) % n;
+          l->last_net_state_window = now;
+          o->num_net_state_windows++;
+          return;
         }
     }
-  if (maximum_size && tlv_len(tb.head) > maximum_size)
+  if (maximum_size && len > maximum_size)
     {
       L_ERR("dncp_ep_i_send_network_state failed: %d > %d",
-            (int)tlv_len(tb.head), (int)maximum_size);
-      goto done;
+            (int)len, (int)maximum_size);
+      return;
     }
   L_DEBUG("dncp_ep_i_send_network_state -> " SA6_F "%%" DNCP_LINK_F,
           SA6_D(dst), DNCP_LINK_D(l));
-  o->ext->cb.send(o->ext, &l->conf, src, dst,
-                  tlv_data(tb.head), tlv_len(tb.head));
- done:
-  tlv_buf_free(&tb);
-}
-
-void dncp_ep_i_send_node_state(dncp_ep_i l,
-                               struct sockaddr_in6 *src,
-                               struct sockaddr_in6 *dst,
-                               dncp_node n)
-{
-  struct tlv_buf tb;
-  dncp o = l->dncp;
-
-  memset(&tb, 0, sizeof(tb));
-  tlv_buf_init(&tb, 0); /* not passed anywhere */
-  if (_push_ep_id_tlv(&tb, l, dst, false)
-      && _push_node_state_tlv(&tb, n, true))
-    {
-      L_DEBUG("dncp_ep_i_send_node_data %s -> " SA6_F " %%" DNCP_LINK_F,
-              DNCP_NODE_REPR(n), SA6_D(dst), DNCP_LINK_D(l));
-      o->ext->cb.send(o->ext, &l->conf, src, dst,
-                      tlv_data(tb.head), tlv_len(tb.head));
-    }
-  tlv_buf_free(&tb);
+  o->num_net_state_sends++;
+  o->ext->cb.send(o->ext, &l->conf, src, dst, start, len);
 }
 
 void dncp_ep_i_send_req_network_state(dncp_ep_i l,
@@ -170,6 +310,7 @@ void dncp_ep_i_send_req_network_state(dncp_ep_i l,
   tlv_buf_init(&tb, 0); /* not passed anywhere */
   if (_push_ep_id_tlv(&tb, l, dst, false)
       && _push_network_state_tlv(&tb, l->dncp) /* SHOULD include local */
+      && dncp_sync_push_summary(l->dncp, &tb)
       && tlv_new(&tb, DNCP_T_REQ_NET_STATE, 0))
     {
       L_DEBUG("dncp_ep_i_send_req_network_state -> " SA6_F "%%" DNCP_LINK_F,
@@ -180,28 +321,395 @@ void dncp_ep_i_send_req_network_state(dncp_ep_i l,
   tlv_buf_free(&tb);
 }
 
-void dncp_ep_i_send_req_node_data(dncp_ep_i l,
-                                  struct sockaddr_in6 *src,
-                                  struct sockaddr_in6 *dst,
-                                  dncp_t_node_state ns)
-{
+/* Unicast node state requests and replies triggered by a received
+ * message are aggregated into as few messages as possible, up to
+ * maximum_unicast_size of the endpoint. */
+typedef struct {
+  dncp_ep_i l;
+  struct sockaddr_in6 *src;
+  struct sockaddr_in6 *dst;
   struct tlv_buf tb;
+  int count;
+} dncp_batch_s, *dncp_batch;
+
+static void _batch_init(dncp_batch b, dncp_ep_i l,
+                        struct sockaddr_in6 *src,
+                        struct sockaddr_in6 *dst)
+{
+  memset(b, 0, sizeof(*b));
+  b->l = l;
+  b->src = src;
+  b->dst = dst;
+}
+
+static void _batch_flush(dncp_batch b)
+{
+  dncp o = b->l->dncp;
+
+  if (!b->count)
+    return;
+  L_DEBUG("_batch_flush %d tlvs -> " SA6_F "%%" DNCP_LINK_F,
+          b->count, SA6_D(b->dst), DNCP_LINK_D(b->l));
+  o->ext->cb.send(o->ext, &b->l->conf, b->src, b->dst,
+                  tlv_data(b->tb.head), tlv_len(b->tb.head));
+  b->count = 0;
+}
+
+static void _batch_free(dncp_batch b)
+{
+  _batch_flush(b);
+  tlv_buf_free(&b->tb);
+}
+
+/* Make sure there is room for TLV with given payload length in the
+ * batch. If it would not fit, the batch is sent first; a TLV that
+ * would not fit even on its own is sent alone. */
+static bool _batch_reserve(dncp_batch b, int len)
+{
+  size_t tlen = TLV_ATTR_ALIGN * ((sizeof(struct tlv_attr) + len
+                                   + TLV_ATTR_ALIGN - 1) / TLV_ATTR_ALIGN);
+
+  if (b->count
+      && tlv_len(b->tb.head) + tlen > (size_t)b->l->conf.maximum_unicast_size)
+    _batch_flush(b);
+  if (b->count)
+    return true;
+  return tlv_buf_init(&b->tb, 0) == 0 /* not passed anywhere */
+    && _push_ep_id_tlv(&b->tb, b->l, b->dst, false);
+}
+
+static void _batch_push_node_state(dncp_batch b, dncp_node n)
+{
+  dncp o = b->l->dncp;
+  int l = n->tlv_container ? tlv_len(n->tlv_container) : 0;
+
+  if (!_batch_reserve(b, DNCP_NI_LEN(o) + sizeof(dncp_t_node_state_s)
+                      + DNCP_HASH_LEN(o) + l)
+      || !_push_node_state_tlv(&b->tb, n, true))
+    return;
+  L_DEBUG("_batch_push_node_state %s", DNCP_NODE_REPR(n));
+  b->count++;
+}
+
+/* Request node data of node ni. If allow_delta is set, and we have
+ * some version of it, we also say which one, so that the peer can
+ * reply with just the difference. */
+static void _batch_push_req_node_data(dncp_batch b, void *ni,
+                                      bool allow_delta)
+{
+  dncp o = b->l->dncp;
+  int nilen = DNCP_NI_LEN(o), hlen = DNCP_HASH_LEN(o);
+  int dlen = nilen + sizeof(dncp_t_req_node_delta_s) + hlen;
+  dncp_node n = NULL;
   struct tlv_attr *a;
-  dncp o = l->dncp;
 
+  if (allow_delta && o->ext->conf.node_data_delta)
+    n = dncp_find_node_by_node_id(o, ni, false);
+  if (n && (!n->tlv_container || dncp_node_is_self(n)))
+    n = NULL;
+  /* Both have to be in the same message. */
+  if (!_batch_reserve(b, nilen + (n ? TLV_SIZE + dlen : 0)))
+    return;
+  if (n && (a = tlv_new(&b->tb, DNCP_T_REQ_NODE_DELTA, dlen)))
+    {
+      dncp_t_req_node_delta rd = tlv_data(a) + nilen;
+
+      dncp_calculate_node_data_hash(n);
+      memcpy(tlv_data(a), ni, nilen);
+      rd->update_number = cpu_to_be32(n->update_number);
+      memcpy((void *)rd + sizeof(*rd), &n->node_data_hash, hlen);
+    }
+  if (!(a = tlv_new(&b->tb, DNCP_T_REQ_NODE_STATE, nilen)))
+    return;
+  memcpy(tlv_data(a), ni, nilen);
+  L_DEBUG("_batch_push_req_node_data %s%s", DNCP_NI_REPR(o, ni),
+          n ? " (delta)" : "");
+  b->count++;
+}
+
+/* Next TLV after a (or the first one, if a is NULL) within buf, or
+ * NULL if there is no (valid) one. */
+static struct tlv_attr *_tlv_in_buf_next(void *buf, int len,
+                                         struct tlv_attr *a)
+{
+  void *end = buf + len;
+
+  a = a ? tlv_next(a) : buf;
+  if ((void *)a + sizeof(*a) > end
+      || tlv_raw_len(a) < sizeof(*a)
+      || (void *)a + tlv_raw_len(a) > end)
+    return NULL;
+  return a;
+}
+
+#define _container_next(c, a) _tlv_in_buf_next(tlv_data(c), tlv_len(c), a)
+
+/* Merge-walk the node data base and cur, which have to be strictly
+ * sorted (returns false if they are not). Indexes of TLVs only in
+ * base are stored in removed, and TLVs only in cur appended to added,
+ * if they are provided; their number and length are always returned. */
+static bool _node_delta_walk(struct tlv_attr *base, struct tlv_attr *cur,
+                             int *num_removed, uint16_t *removed,
+                             int *added_len, void *added)
+{
+  struct tlv_attr *op = _container_next(base, NULL);
+  struct tlv_attr *np = _container_next(cur, NULL);
+  struct tlv_attr *last_op = NULL, *last_np = NULL;
+  int i = 0;
+
+  *num_removed = 0;
+  *added_len = 0;
+  while (op || np)
+    {
+      int r = !op ? 1 : !np ? -1 : tlv_attr_cmp(op, np);
+
+      if (r <= 0)
+        {
+          if ((last_op && tlv_attr_cmp(last_op, op) >= 0) || i > 0xFFFF)
+            return false;
+          if (r < 0 && removed)
+            removed[*num_removed] = cpu_to_be16(i);
+          if (r < 0)
+            (*num_removed)++;
+          last_op = op;
+          op = _container_next(base, op);
+          i++;
+        }
+      if (r >= 0)
+        {
+          if (last_np && tlv_attr_cmp(last_np, np) >= 0)
+            return false;
+          if (r > 0 && added)
+            {
+              memset(added + *added_len, 0, tlv_pad_len(np));
+              memcpy(added + *added_len, np, tlv_raw_len(np));
+            }
+          if (r > 0)
+            *added_len += tlv_pad_len(np);
+          last_np = np;
+          np = _container_next(cur, np);
+        }
+    }
+  return true;
+}
+
+/* Push node state of n with node data as difference to the version
+ * the peer has (identified by its hash h). Returns false if we do
+ * not have that version, or if the difference would not be smaller
+ * than the full node state. */
+static bool _batch_push_node_delta(dncp_batch b, dncp_node n,
+                                   uint32_t base_update_number, dncp_hash h)
+{
+  dncp o = b->l->dncp;
+  int nilen = DNCP_NI_LEN(o), hlen = DNCP_HASH_LEN(o);
+  struct tlv_attr *base, *a;
+  int num_removed, removed_len, added_len, tlen;
+  dncp_t_node_delta nd;
+  void *p;
+
+  if (!n->tlv_container)
+    return false;
+  dncp_calculate_node_data_hash(n);
+  if (!memcmp(h, &n->node_data_hash, hlen))
+    base = n->tlv_container;
+  else if (n->prev_tlv_container
+           && n->prev_update_number == base_update_number
+           && !memcmp(h, &n->prev_node_data_hash, hlen))
+    base = n->prev_tlv_container;
+  else
+    return false;
+  if (!_node_delta_walk(base, n->tlv_container,
+                        &num_removed, NULL, &added_len, NULL))
+    return false;
+  removed_len = (num_removed * sizeof(uint16_t) + 3) & ~3;
+  tlen = nilen + sizeof(*nd) + hlen + removed_len + added_len;
+  if (tlen >= (int)(nilen + sizeof(dncp_t_node_state_s) + hlen
+                    + tlv_len(n->tlv_container))
+      || !_batch_reserve(b, tlen)
+      || !(a = tlv_new(&b->tb, DNCP_T_NODE_DELTA, tlen)))
+    return false;
+  p = tlv_data(a);
+  memset(p, 0, tlen);
+  memcpy(p, &n->node_id, nilen);
+  nd = p + nilen;
+  nd->update_number = cpu_to_be32(n->update_number);
+  nd->ms_since_origination = cpu_to_be32(dncp_time(o) - n->origination_time);
+  nd->base_update_number = cpu_to_be32(base_update_number);
+  nd->num_removed = cpu_to_be16(num_removed);
+  p += nilen + sizeof(*nd);
+  memcpy(p, &n->node_data_hash, hlen);
+  p += hlen;
+  (void)_node_delta_walk(base, n->tlv_container,
+                         &num_removed, p, &added_len, p + removed_len);
+  L_DEBUG("_batch_push_node_delta %s: -%d +%d bytes (vs %d)",
+          DNCP_NODE_REPR(n), num_removed, added_len,
+          tlv_len(n->tlv_container));
+  b->count++;
+  o->num_node_deltas_sent++;
+  return true;
+}
+
+/* Apply received node delta (of length len, sans node identifier) to
+ * node n. Returns false if we do not have the base version, or the
+ * result does not match the hash. */
+static bool _node_delta_apply(dncp_node n, dncp_t_node_delta nd, int len)
+{
+  dncp o = n->dncp;
+  int hlen = DNCP_HASH_LEN(o);
+  int num_removed = be16_to_cpu(nd->num_removed);
+  int removed_len = (num_removed * sizeof(uint16_t) + 3) & ~3;
+  void *h = (void *)nd + sizeof(*nd);
+  uint16_t *removed = h + hlen;
+  void *added = (void *)removed + removed_len;
+  int added_len = len - sizeof(*nd) - hlen - removed_len;
+  struct tlv_attr *base = n->tlv_container, *op, *np;
+  struct tlv_buf tb;
+  dncp_hash_s nh;
+  int i = 0, j = 0;
+
+  if (added_len < 0 || !base
+      || n->update_number != be32_to_cpu(nd->base_update_number))
+    return false;
   memset(&tb, 0, sizeof(tb));
-  tlv_buf_init(&tb, 0); /* not passed anywhere */
-  if (_push_ep_id_tlv(&tb, l, dst, false)
-      && (a = tlv_new(&tb, DNCP_T_REQ_NODE_STATE, DNCP_NI_LEN(o))))
+  if (tlv_buf_init(&tb, 0)) /* not passed anywhere */
+    return false;
+  op = _container_next(base, NULL);
+  np = _tlv_in_buf_next(added, added_len, NULL);
+  while (op || np)
     {
-      L_DEBUG("dncp_ep_i_send_req_node_data -> " SA6_F "%%" DNCP_LINK_F,
-              SA6_D(dst), DNCP_LINK_D(l));
-      dncp_node_id ni = dncp_tlv_get_node_id(l->dncp, ns);
-      memcpy(tlv_data(a), ni, DNCP_NI_LEN(o));
-      o->ext->cb.send(o->ext, &l->conf, src, dst,
-                      tlv_data(tb.head), tlv_len(tb.head));
+      struct tlv_attr *a;
+
+      if (op && j < num_removed && be16_to_cpu(removed[j]) == i)
+        {
+          j++;
+          i++;
+          op = _container_next(base, op);
+          continue;
+        }
+      if (op && (!np || tlv_attr_cmp(op, np) < 0))
+        {
+          a = op;
+          op = _container_next(base, op);
+          i++;
+        }
+      else
+        {
+          a = np;
+          np = _tlv_in_buf_next(added, added_len, np);
+        }
+      if (!tlv_put_raw(&tb, a, tlv_raw_len(a)))
+        goto fail;
     }
+  if (j != num_removed)
+    goto fail;
+  o->ext->cb.hash(tlv_data(tb.head), tlv_len(tb.head), &nh);
+  if (memcmp(&nh, h, hlen))
+    goto fail;
+  dncp_node_set(n, be32_to_cpu(nd->update_number),
+                dncp_time(o) - be32_to_cpu(nd->ms_since_origination),
+                tb.head);
+  memcpy(&n->node_data_hash, h, hlen);
+  n->node_data_hash_dirty = false;
+  return true;
+
+ fail:
+  L_DEBUG("_node_delta_apply failed for %s", DNCP_NODE_REPR(n));
   tlv_buf_free(&tb);
+  return false;
+}
+
+/* Is the node state (of node n, which may be NULL) more recent than
+ * what we have? */
+static bool _node_state_is_interesting(dncp o, dncp_node n,
+                                       uint32_t update_number, dncp_hash h)
+{
+  return !n
+    || (dncp_update_number_gt(n->update_number, update_number)
+        || (update_number == n->update_number
+            && memcmp(&n->node_data_hash, h, DNCP_HASH_LEN(o)) != 0));
+}
+
+/* Set reconciliation result: send node states the peer lacks, and
+ * request ones we lack. */
+static void _sync_cb(void *context, void *ni, uint32_t update_number,
+                     dncp_hash h, bool ours)
+{
+  dncp_batch b = context;
+  dncp o = b->l->dncp;
+  dncp_node n = dncp_find_node_by_node_id(o, ni, false);
+
+  if (ours)
+    {
+      if (n)
+        _batch_push_node_state(b, n);
+    }
+  else if (_node_state_is_interesting(o, n, update_number, h))
+    _batch_push_req_node_data(b, ni, true);
+}
+
+/* Has the hash of this exact node state payload been verified
+ * recently? */
+static bool _verified_cache_lookup(dncp o, void *ni, uint32_t update_number,
+                                   dncp_hash h, void *data, int len)
+{
+  dncp_verified v;
+  int i;
+
+  for (i = 0; i < DNCP_VERIFIED_CACHE_SIZE; i++)
+    {
+      v = &o->verified[i];
+      if (v->last_used && v->update_number == update_number
+          && v->len == len
+          && !memcmp(&v->node_id, ni, DNCP_NI_LEN(o))
+          && !memcmp(&v->hash, h, DNCP_HASH_LEN(o))
+          && !memcmp(v->data, data, len))
+        {
+          v->last_used = ++o->verified_clock;
+          o->num_verified_hits++;
+          return true;
+        }
+    }
+  o->num_verified_misses++;
+  return false;
+}
+
+static void _verified_cache_add(dncp o, void *ni, uint32_t update_number,
+                                dncp_hash h, void *data, int len)
+{
+  dncp_verified v = &o->verified[0];
+  void *copy;
+  int i;
+
+  for (i = 1; i < DNCP_VERIFIED_CACHE_SIZE && v->last_used; i++)
+    if (o->verified[i].last_used < v->last_used)
+      v = &o->verified[i];
+  if (!(copy = realloc(v->data, len)))
+    return;
+  memcpy(copy, data, len);
+  v->data = copy;
+  memcpy(&v->node_id, ni, DNCP_NI_LEN(o));
+  v->update_number = update_number;
+  memcpy(&v->hash, h, DNCP_HASH_LEN(o));
+  v->len = len;
+  v->last_used = ++o->verified_clock;
+}
+
+/* Should we answer to a request for node state of n? */
+static bool _node_state_request_ok(dncp o, dncp_node n)
+{
+  if (n == o->own_node)
+    return true;
+  if (o->graph_dirty)
+    {
+      L_DEBUG("prune pending, ignoring node data request");
+      return false;
+    }
+  if (n->last_reachable_prune != o->last_prune)
+    {
+      L_DEBUG("not reachable request, ignoring");
+      return false;
+    }
+  return true;
 }
 
 /************************************************************ Input handling */
@@ -245,6 +753,8 @@ _heard(dncp_ep_i l, dncp_t_ep_id lid, struct sockaddr_in6 *src,
         return NULL;
       n = dncp_tlv_get_extra(t);
       n->last_contact = dncp_time(l->dncp);
+      n->tlv = t;
+      dncp_neighbor_schedule(l->dncp, n, 0);
       L_DEBUG("Neighbor %s added on " DNCP_LINK_F,
               DNCP_NI_REPR(l->dncp, dncp_tlv_get_node_id(l->dncp, lid)),
               DNCP_LINK_D(l));
@@ -282,6 +792,12 @@ handle_message(dncp_ep_i l,
   dncp_node_id ni;
   char fake_lid[DNCP_NI_MAX_LEN + sizeof(*lid)];
   bool is_local = false;
+  bool reply_network_state = false;
+  struct tlv_attr *sync_summary = NULL;
+  dncp_node delta_sent = NULL;
+  dncp_batch_s batch;
+
+  _batch_init(&batch, l, dst, src);
 
   /* Validate that link id exists (if this were TCP, we would keep
    * track of the remote link id on per-stream basis). */
@@ -318,7 +834,7 @@ handle_message(dncp_ep_i l,
         if (tlv_len(a) != sizeof(*lid) + nilen)
           {
             L_INFO("got invalid sized link id - ignoring");
-            return;
+            goto done;
           }
         lid = tlv_data(a) + nilen;
         is_local = memcmp(dncp_tlv_get_node_id(l->dncp, lid),
@@ -347,7 +863,12 @@ handle_message(dncp_ep_i l,
         if (multicast)
           L_INFO("ignoring req-net-hash in multicast");
         else
-          dncp_ep_i_send_network_state(l, dst, src, 0, false);
+          reply_network_state = true;
+        break;
+
+      case DNCP_T_SYNC_SUMMARY:
+        if (!multicast)
+          sync_summary = a;
         break;
 
       case DNCP_T_REQ_NODE_STATE:
@@ -370,21 +891,51 @@ handle_message(dncp_ep_i l,
             L_DEBUG("got request for node for which we have no data");
             break;
           }
-        if (n != o->own_node)
+        /* Already answered with delta. */
+        if (n == delta_sent)
           {
-            if (o->graph_dirty)
-              {
-                L_DEBUG("prune pending, ignoring node data request");
-                break;
-              }
+            delta_sent = NULL;
+            break;
+          }
+        if (_node_state_request_ok(o, n))
+          _batch_push_node_state(&batch, n);
+        break;
 
-            if (n->last_reachable_prune != o->last_prune)
-              {
-                L_DEBUG("not reachable request, ignoring");
-                break;
-              }
+      case DNCP_T_REQ_NODE_DELTA:
+        if (multicast || !o->ext->conf.node_data_delta
+            || tlv_len(a) != nilen + sizeof(dncp_t_req_node_delta_s) + hlen)
+          break;
+        ni = tlv_data(a);
+        dncp_t_req_node_delta rd = tlv_data(a) + nilen;
+        n = dncp_find_node_by_node_id(o, ni, false);
+        if (n && _node_state_request_ok(o, n)
+            && _batch_push_node_delta(&batch, n,
+                                      be32_to_cpu(rd->update_number),
+                                      (void *)rd + sizeof(*rd)))
+          delta_sent = n;
+        break;
+
+      case DNCP_T_NODE_DELTA:
+        if (multicast || !o->ext->conf.node_data_delta
+            || tlv_len(a) < nilen + sizeof(dncp_t_node_delta_s) + hlen)
+          break;
+        ni = tlv_data(a);
+        dncp_t_node_delta nd = tlv_data(a) + nilen;
+        n = dncp_find_node_by_node_id(o, ni, false);
+        new_update_number = be32_to_cpu(nd->update_number);
+        if (!n || dncp_node_is_self(n)
+            || !_node_state_is_interesting(o, n, new_update_number,
+                                           (void *)nd + sizeof(*nd)))
+          break;
+        if (_node_delta_apply(n, nd, tlv_len(a) - nilen))
+          o->num_node_deltas_applied++;
+        else
+          {
+            /* Fall back to full node data. */
+            o->num_node_deltas_failed++;
+            _batch_push_req_node_data(&batch, ni, false);
           }
-        dncp_ep_i_send_node_state(l, dst, src, n);
+        updated_or_requested_state = true;
         break;
 
       case DNCP_T_NET_STATE:
@@ -413,7 +964,7 @@ handle_message(dncp_ep_i l,
           {
             /* MUST: rate limit check */
             if ((dncp_time(o) - l->last_req_network_state) >=
-                l->conf.trickle_imin)
+                l->trickle_imin)
               should_request_network_state = true;
           }
         break;
@@ -432,10 +983,8 @@ handle_message(dncp_ep_i l,
           }
         n = dncp_find_node_by_node_id(o, ni, false);
         new_update_number = be32_to_cpu(ns->update_number);
-        bool interesting = !n
-          || (dncp_update_number_gt(n->update_number, new_update_number)
-              || (new_update_number == n->update_number
-                  && memcmp(&n->node_data_hash, h, hlen) != 0));
+        bool interesting = _node_state_is_interesting(o, n, new_update_number,
+                                                      h);
         L_DEBUG("saw %s %s for %s/%p (update number %d)",
                 interesting ? "new" : "old",
                 nd_len ? "state" : "state+data",
@@ -451,15 +1000,21 @@ handle_message(dncp_ep_i l,
             void *nd_data = tlv_data(a) + ns_len;
             dncp_hash_s nd_hash;
 
-            o->ext->cb.hash(nd_data, nd_len, &nd_hash);
-            if (memcmp(&nd_hash, h, hlen))
+            if (!_verified_cache_lookup(o, ni, new_update_number, h,
+                                        nd_data, nd_len))
               {
-                L_INFO("broken hash compared to data in node state");
-                break;
+                o->ext->cb.hash(nd_data, nd_len, &nd_hash);
+                if (memcmp(&nd_hash, h, hlen))
+                  {
+                    L_INFO("broken hash compared to data in node state");
+                    break;
+                  }
+                _verified_cache_add(o, ni, new_update_number, h,
+                                    nd_data, nd_len);
               }
             n = n ? n: dncp_find_node_by_node_id(o, ni, true);
             if (!n)
-              return; /* OOM */
+              goto done; /* OOM */
             if (dncp_node_is_self(n))
               {
                 L_DEBUG("received %d update number from network, own %d",
@@ -472,7 +1027,7 @@ handle_message(dncp_ep_i l,
                     o->republish_tlvs = true;
                     dncp_schedule(o);
                   }
-                return;
+                goto done;
               }
             /* Ok. nd contains more recent TLV data than what we have
              * already. Woot. */
@@ -498,7 +1053,7 @@ handle_message(dncp_ep_i l,
             L_DEBUG("node data %s for %s",
                     multicast ? "not acceptable/supplied" : "missing",
                     DNCP_NI_REPR(l->dncp, ni));
-            dncp_ep_i_send_req_node_data(l, dst, src, ns);
+            _batch_push_req_node_data(&batch, ni, true);
           }
         updated_or_requested_state = true;
         break;
@@ -512,11 +1067,22 @@ handle_message(dncp_ep_i l,
 
   /* Now, we can handle whether or not to send a network state request
    * based on the flags we know. */
-  if (!should_request_network_state || updated_or_requested_state || is_local)
-    return;
+  /* If the request came with summary we can decode, reply with only
+   * the node states that differ. With prune pending, our own view
+   * is not valid yet, so just give everything. */
+  if (reply_network_state
+      && !(sync_summary && !o->graph_dirty
+           && dncp_sync_handle_summary(o, sync_summary, _sync_cb, &batch)))
+    dncp_ep_i_send_network_state(l, dst, src, 0, false);
 
-  l->last_req_network_state = dncp_time(o);
-  dncp_ep_i_send_req_network_state(l, dst, src);
+  if (should_request_network_state && !updated_or_requested_state
+      && !is_local)
+    {
+      l->last_req_network_state = dncp_time(o);
+      dncp_ep_i_send_req_network_state(l, dst, src);
+    }
+ done:
+  _batch_free(&batch);
 }
 
 
@@ -551,6 +1117,13 @@ void dncp_ext_readable(dncp o)
           continue;
         }
 
+      if (l->carrier_down)
+        {
+          L_DEBUG("ignoring packet on interface %s without carrier",
+                  l->conf.ifname);
+          continue;
+        }
+
       if (dst
           && !(flags & DNCP_RECV_FLAG_SRC_LINKLOCAL) !=
           !(flags & DNCP_RECV_FLAG_DST_LINKLOCAL))
@@ -612,6 +1185,7 @@ void dncp_ext_ep_peer_state(dncp_ep ep,
     {
       dncp_neighbor n = dncp_tlv_get_extra(t);
       n->last_contact = 0;
+      dncp_neighbor_schedule(o, n, 0);
     }
   dncp_schedule(o);
 }
@@ -33,7 +33,18 @@ enum {
   DNCP_T_FRAGMENT_COUNT = 7, /* not implemented */
   DNCP_T_NEIGHBOR = 8,
   DNCP_T_KEEPALIVE_INTERVAL = 9,
-  DNCP_T_TRUST_VERDICT = 10
+  DNCP_T_TRUST_VERDICT = 10,
+
+  /* hnetd private extension: set reconciliation summary of network
+   * state, sent along with DNCP_T_REQ_NET_STATE. */
+  DNCP_T_SYNC_SUMMARY = 768,
+
+  /* hnetd private extension: node data deltas. DNCP_T_REQ_NODE_DELTA
+   * is sent just before DNCP_T_REQ_NODE_STATE for the same node, and
+   * the reply to both may be DNCP_T_NODE_DELTA instead of
+   * DNCP_T_NODE_STATE. */
+  DNCP_T_REQ_NODE_DELTA = 769,
+  DNCP_T_NODE_DELTA = 770
 };
 
 #define TLV_SIZE sizeof(struct tlv_attr)
@@ -100,3 +111,40 @@ typedef struct __packed {
   dncp_sha256_s sha256_hash;
   char cname[];
 } dncp_t_trust_verdict_s, *dncp_t_trust_verdict;
+
+/* DNCP_T_SYNC_SUMMARY: invertible Bloom lookup table of (node
+ * identifier, update number, node data hash) of reachable nodes. */
+typedef struct __packed {
+  uint16_t num_cells; /* per hash function */
+  uint8_t num_hashes;
+  uint8_t element_len; /* node identifier + 4 + hash length */
+  /* + num_hashes * num_cells cells */
+} dncp_t_sync_summary_s, *dncp_t_sync_summary;
+
+typedef struct __packed {
+  int32_t count;
+  uint32_t check;
+  /* + element_len bytes of XOR of the elements */
+} dncp_t_sync_cell_s, *dncp_t_sync_cell;
+
+/* DNCP_T_REQ_NODE_DELTA: version of node data the requester has. */
+typedef struct __packed {
+  /* dncp_node_id_s node_id; variable length, encoded here */
+  uint32_t update_number;
+  /* + hash of the node data */
+} dncp_t_req_node_delta_s, *dncp_t_req_node_delta;
+
+/* DNCP_T_NODE_DELTA: node state, with node data given as difference
+ * to the (sorted) node data of base_update_number. */
+typedef struct __packed {
+  /* dncp_node_id_s node_id; variable length, encoded here */
+  uint32_t update_number;
+  uint32_t ms_since_origination;
+  uint32_t base_update_number;
+  uint16_t num_removed;
+  uint16_t reserved;
+  /* + hash of the new node data
+   * + num_removed 16-bit indexes of TLVs removed from the base node
+   *   data, in increasing order, padded to multiple of 4 bytes
+   * + added TLVs, in sorted order */
+} dncp_t_node_delta_s, *dncp_t_node_delta;
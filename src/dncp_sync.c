@@ -0,0 +1,289 @@
+/*
+ * $Id: dncp_sync.c $
+ *
+ * Author: agent <agent@local>
+ *
+ * Copyright (c) 2026 agent
+ *
+ */
+
+/*
+ * This module implements (hnetd private) set reconciliation
+ * extension to DNCP.
+ *
+ * A node requesting network state may include a summary of its own
+ * network state: an invertible Bloom lookup table (IBLT) of the
+ * (node identifier, update number, node data hash) tuples of its
+ * reachable nodes. A peer that understands it subtracts its own
+ * table from it, and if the difference decodes, it can reply with
+ * just the node states that differ, instead of every node state it
+ * has. The size of the exchange is therefore proportional to the
+ * difference, and not to the size of the network. Peers that do not
+ * understand it just ignore the TLV and reply with full network
+ * state; so do we if the difference is too large to decode.
+ */
+
+#include "dncp_i.h"
+
+/* Number of hash functions (each has its own num_cells cells). */
+#define DNCP_SYNC_HASHES 3
+
+/* Largest number of cells per hash function we deal with. */
+#define DNCP_SYNC_MAXIMUM_CELLS 1024
+
+#define DNCP_SYNC_ELEMENT_MAX_LEN (DNCP_NI_MAX_LEN + 4 + DNCP_HASH_MAX_LEN)
+
+typedef struct {
+  int32_t count;
+  uint32_t check;
+  unsigned char sum[DNCP_SYNC_ELEMENT_MAX_LEN];
+} dncp_sync_cell_s, *dncp_sync_cell;
+
+typedef struct {
+  dncp_sync_cell_s *cells;
+  int num_cells; /* per hash function */
+  int element_len;
+} dncp_sync_table_s, *dncp_sync_table;
+
+/* FNV-1a with MurmurHash3 finalizer; the hashes have to be same
+ * across implementations, so do not change this. */
+static uint32_t _hash32(const void *buf, int len, uint32_t seed)
+{
+  const unsigned char *p = buf;
+  uint32_t h = 2166136261U ^ (seed * 16777619U);
+  int i;
+
+  for (i = 0; i < len; i++)
+    {
+      h ^= p[i];
+      h *= 16777619U;
+    }
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35U;
+  h ^= h >> 16;
+  return h;
+}
+
+static void _table_toggle(dncp_sync_table t, const unsigned char *e,
+                          int delta)
+{
+  uint32_t check = _hash32(e, t->element_len, DNCP_SYNC_HASHES);
+  int i, j;
+
+  for (i = 0; i < DNCP_SYNC_HASHES; i++)
+    {
+      dncp_sync_cell c = &t->cells[i * t->num_cells
+                                   + _hash32(e, t->element_len, i)
+                                   % t->num_cells];
+      c->count += delta;
+      c->check ^= check;
+      for (j = 0; j < t->element_len; j++)
+        c->sum[j] ^= e[j];
+    }
+}
+
+static void _node_element(dncp_node n, unsigned char *e)
+{
+  dncp o = n->dncp;
+  uint32_t update_number = cpu_to_be32(n->update_number);
+
+  memcpy(e, &n->node_id, DNCP_NI_LEN(o));
+  memcpy(e + DNCP_NI_LEN(o), &update_number, 4);
+  memcpy(e + DNCP_NI_LEN(o) + 4, &n->node_data_hash, DNCP_HASH_LEN(o));
+}
+
+static bool _table_init(dncp o, dncp_sync_table t, int num_cells)
+{
+  unsigned char e[DNCP_SYNC_ELEMENT_MAX_LEN];
+  dncp_node n;
+
+  t->num_cells = num_cells;
+  t->element_len = DNCP_NI_LEN(o) + 4 + DNCP_HASH_LEN(o);
+  t->cells = calloc(DNCP_SYNC_HASHES * num_cells, sizeof(*t->cells));
+  if (!t->cells)
+    return false;
+  /* Node data hashes are up to date after this. */
+  dncp_calculate_network_hash(o);
+  dncp_for_each_node(o, n)
+    {
+      _node_element(n, e);
+      _table_toggle(t, e, 1);
+    }
+  return true;
+}
+
+static int _cell_len(dncp_sync_table t)
+{
+  return sizeof(dncp_t_sync_cell_s) + t->element_len;
+}
+
+bool dncp_sync_push_summary(dncp o, struct tlv_buf *tb)
+{
+  int num_cells = o->ext->conf.sync_summary_cells;
+  int ns_len = TLV_SIZE + DNCP_NI_LEN(o) + sizeof(dncp_t_node_state_s)
+    + DNCP_HASH_LEN(o);
+  dncp_sync_table_s t;
+  struct tlv_attr *a;
+  dncp_node n;
+  int i, len, cnt = 0;
+
+  if (!num_cells)
+    return true;
+  len = sizeof(dncp_t_sync_summary_s) + DNCP_SYNC_HASHES * num_cells
+    * (sizeof(dncp_t_sync_cell_s) + DNCP_NI_LEN(o) + 4 + DNCP_HASH_LEN(o));
+  dncp_for_each_node(o, n)
+    cnt++;
+
+  /* If the full network state would be smaller, no point. */
+  if (cnt * ns_len <= len)
+    return true;
+  if (!_table_init(o, &t, num_cells))
+    return false;
+  if ((a = tlv_new(tb, DNCP_T_SYNC_SUMMARY, len)))
+    {
+      dncp_t_sync_summary s = tlv_data(a);
+      void *p = tlv_data(a) + sizeof(*s);
+
+      s->num_cells = cpu_to_be16(num_cells);
+      s->num_hashes = DNCP_SYNC_HASHES;
+      s->element_len = t.element_len;
+      for (i = 0; i < DNCP_SYNC_HASHES * num_cells; i++)
+        {
+          dncp_t_sync_cell c = p;
+
+          c->count = cpu_to_be32(t.cells[i].count);
+          c->check = cpu_to_be32(t.cells[i].check);
+          memcpy(p + sizeof(*c), t.cells[i].sum, t.element_len);
+          p += _cell_len(&t);
+        }
+      o->num_sync_sent++;
+    }
+  free(t.cells);
+  return a != NULL;
+}
+
+static bool _cell_is_pure(dncp_sync_table t, dncp_sync_cell c)
+{
+  return (c->count == 1 || c->count == -1)
+    && _hash32(c->sum, t->element_len, DNCP_SYNC_HASHES) == c->check;
+}
+
+static bool _cell_is_empty(dncp_sync_table t, dncp_sync_cell c)
+{
+  int i;
+
+  if (c->count || c->check)
+    return false;
+  for (i = 0; i < t->element_len; i++)
+    if (c->sum[i])
+      return false;
+  return true;
+}
+
+/* Peel the (subtracted) table; found elements are stored in
+ * elements, and their signs in ours. Returns number of elements, or
+ * -1 if the table cannot be fully decoded. */
+static int _table_decode(dncp_sync_table t, unsigned char *elements,
+                         bool *ours, int max_elements)
+{
+  int i, total = DNCP_SYNC_HASHES * t->num_cells;
+  int found = 0;
+  bool progress = true;
+
+  while (progress)
+    {
+      progress = false;
+      for (i = 0; i < total; i++)
+        {
+          dncp_sync_cell c = &t->cells[i];
+          unsigned char *e;
+
+          if (!_cell_is_pure(t, c))
+            continue;
+          if (found == max_elements)
+            return -1;
+          e = elements + found * t->element_len;
+          memcpy(e, c->sum, t->element_len);
+          ours[found++] = c->count > 0;
+          _table_toggle(t, e, -c->count);
+          progress = true;
+        }
+    }
+  for (i = 0; i < total; i++)
+    if (!_cell_is_empty(t, &t->cells[i]))
+      return -1;
+  return found;
+}
+
+bool dncp_sync_handle_summary(dncp o, struct tlv_attr *a,
+                              dncp_sync_cb cb, void *context)
+{
+  dncp_t_sync_summary s = tlv_data(a);
+  dncp_sync_table_s t;
+  unsigned char *elements = NULL;
+  bool *ours = NULL;
+  int i, num_cells, total, found = -1;
+  void *p;
+
+  if (!o->ext->conf.sync_summary_cells
+      || tlv_len(a) < sizeof(*s))
+    return false;
+  num_cells = be16_to_cpu(s->num_cells);
+  if (!num_cells || num_cells > DNCP_SYNC_MAXIMUM_CELLS
+      || s->num_hashes != DNCP_SYNC_HASHES
+      || s->element_len != DNCP_NI_LEN(o) + 4 + DNCP_HASH_LEN(o)
+      || tlv_len(a) != sizeof(*s) + DNCP_SYNC_HASHES * num_cells
+      * (sizeof(dncp_t_sync_cell_s) + s->element_len))
+    {
+      L_DEBUG("dncp_sync_handle_summary: invalid summary");
+      return false;
+    }
+  if (!_table_init(o, &t, num_cells))
+    return false;
+  total = DNCP_SYNC_HASHES * num_cells;
+
+  /* Ours minus theirs. */
+  p = tlv_data(a) + sizeof(*s);
+  for (i = 0; i < total; i++)
+    {
+      dncp_t_sync_cell c = p;
+      unsigned char *sum = p + sizeof(*c);
+      int j;
+
+      t.cells[i].count -= (int32_t)be32_to_cpu(c->count);
+      t.cells[i].check ^= be32_to_cpu(c->check);
+      for (j = 0; j < t.element_len; j++)
+        t.cells[i].sum[j] ^= sum[j];
+      p += _cell_len(&t);
+    }
+
+  elements = malloc(total * t.element_len);
+  ours = malloc(total * sizeof(*ours));
+  if (elements && ours)
+    found = _table_decode(&t, elements, ours, total);
+  if (found < 0)
+    {
+      L_DEBUG("dncp_sync_handle_summary: unable to decode");
+      o->num_sync_failed++;
+    }
+  else
+    {
+      L_DEBUG("dncp_sync_handle_summary: %d differences", found);
+      o->num_sync_decoded++;
+      for (i = 0; i < found; i++)
+        {
+          unsigned char *e = elements + i * t.element_len;
+          uint32_t update_number;
+
+          memcpy(&update_number, e + DNCP_NI_LEN(o), 4);
+          cb(context, e, be32_to_cpu(update_number),
+             (dncp_hash)(e + DNCP_NI_LEN(o) + 4), ours[i]);
+        }
+    }
+  free(elements);
+  free(ours);
+  free(t.cells);
+  return found >= 0;
+}
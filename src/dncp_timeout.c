@@ -31,14 +31,73 @@ static void ep_i_set_keepalive_interval(dncp_ep_i l, uint32_t value)
       dncp_add_tlv(o, DNCP_T_KEEPALIVE_INTERVAL, &ka, sizeof(ka), 0);
     }
   l->published_keepalive_interval = value;
+  /* Per-peer keep-alives are sent based on this. */
+  o->neighbors_dirty = true;
 }
 
 
+/* Number of Trickle resets within (roughly) the last
+ * DNCP_TRICKLE_RESET_WINDOW. */
+static int _trickle_resets(dncp o, hnetd_time_t now)
+{
+  hnetd_time_t age = now - o->trickle_reset_window_start;
+
+  if (age >= DNCP_TRICKLE_RESET_WINDOW)
+    {
+      o->trickle_resets_prev =
+        age < 2 * DNCP_TRICKLE_RESET_WINDOW ? o->trickle_resets : 0;
+      o->trickle_resets = 0;
+      o->trickle_reset_window_start = now;
+    }
+  return o->trickle_resets > o->trickle_resets_prev ?
+    o->trickle_resets : o->trickle_resets_prev;
+}
+
+static void _ep_adapt_trickle(dncp_ep_i l)
+{
+  dncp_ep ep = &l->conf;
+  hnetd_time_t imin = ep->trickle_imin;
+  hnetd_time_t imax = ep->trickle_imax;
+  int k = ep->trickle_k;
+
+  if (ep->trickle_adaptive)
+    {
+      /* With per-peer Trickle, every peer is on a link of its own. */
+      int n = ep->unicast_only ? 1 : l->num_neighbors;
+
+      if (n > DNCP_TRICKLE_DENSE_NEIGHBORS)
+        {
+          /* Everyone hears everything; one consistent message per
+           * interval is enough, and the fewer of the neighbors that
+           * pick a send time within the first Imin, the better. */
+          k = 1;
+          imin = imin * n / DNCP_TRICKLE_DENSE_NEIGHBORS;
+          if (_trickle_resets(l->dncp, dncp_time(l->dncp))
+              >= DNCP_TRICKLE_CHURN_RESETS)
+            imin *= 2;
+          if (imin > imax / 2)
+            imin = imax / 2;
+        }
+      else if (n <= 1)
+        {
+          imax /= DNCP_TRICKLE_P2P_IMAX_DIVISOR;
+          if (imax < imin)
+            imax = imin;
+        }
+    }
+  l->trickle_imin = imin;
+  l->trickle_imax = imax;
+  l->trickle_k = k;
+}
+
 static void trickle_set_i(dncp_trickle t, dncp_ep_i l, int i)
 {
   hnetd_time_t now = dncp_time(l->dncp);
-  int imin = l->conf.trickle_imin;
-  int imax = l->conf.trickle_imax;
+  int imin, imax;
+
+  _ep_adapt_trickle(l);
+  imin = l->trickle_imin;
+  imax = l->trickle_imax;
 
   i = i < imin ? imin : i > imax ? imax : i;
   t->i = i;
@@ -58,8 +117,9 @@ static void trickle_send_nocheck(dncp_trickle t, dncp_ep_i l, dncp_neighbor ne)
   t->last_sent = dncp_time(l->dncp);
   int maximum_size = ne ? 0 : l->conf.maximum_multicast_size;
   /* If Trickle has backed off, just send the short form, i.e. at most
-   * just endpoint id + network state. */
-  if (t->i != l->conf.trickle_imin)
+   * just endpoint id + network state. (With adaptive Trickle, Imin
+   * may have grown since the interval started.) */
+  if (t->i > l->trickle_imin)
     maximum_size = 4 + sizeof(dncp_t_ep_id_s) + DNCP_NI_LEN(l->dncp)
       + 4 + DNCP_HASH_LEN(l->dncp);
   dncp_ep_i_send_network_state(l, NULL, ne ? &ne->last_sa6: NULL,
@@ -68,16 +128,16 @@ static void trickle_send_nocheck(dncp_trickle t, dncp_ep_i l, dncp_neighbor ne)
 
 static void trickle_send(dncp_trickle t, dncp_ep_i l, dncp_neighbor ne)
 {
-  if (t->c < l->conf.trickle_k
+  if (t->c < l->trickle_k
       && (!l->conf.unicast_is_reliable_stream ||
-          t->i == l->conf.trickle_imin))
+          t->i <= l->trickle_imin))
     trickle_send_nocheck(t, l, ne);
   else
     t->num_skipped++;
   t->send_time = 0;
 }
 
-static void _node_set_reachable(dncp_node n, bool value)
+static void _node_set_reachable(dncp_node n, bool value, hnetd_time_t epoch)
 {
   dncp o = n->dncp;
   bool is_reachable = o->last_prune == n->last_reachable_prune;
@@ -85,6 +145,7 @@ static void _node_set_reachable(dncp_node n, bool value)
   if (is_reachable != value)
     {
       o->network_hash_dirty = true;
+      o->network_hash_full_dirty = true;
 
       if (!value)
         dncp_notify_subscribers_tlvs_changed(n, n->tlv_container_valid, NULL);
@@ -95,60 +156,108 @@ static void _node_set_reachable(dncp_node n, bool value)
         dncp_notify_subscribers_tlvs_changed(n, NULL, n->tlv_container_valid);
     }
   if (value)
-    n->last_reachable_prune = dncp_time(o);
+    n->last_reachable_prune = epoch;
 }
 
-static void _prune_rec(dncp_node n)
+static bool _prune_push(dncp o, dncp_node n, int *depth)
 {
-  struct tlv_attr *a;
-  dncp_t_neighbor ne;
-  dncp_node n2;
+  if (*depth == o->prune_stack_size)
+    {
+      int nsize = o->prune_stack_size ? o->prune_stack_size * 2 : 16;
+      dncp_node *ns = realloc(o->prune_stack, nsize * sizeof(*ns));
+      if (!ns)
+        {
+          L_ERR("unable to grow prune stack to %d", nsize);
+          return false;
+        }
+      o->prune_stack = ns;
+      o->prune_stack_size = nsize;
+    }
+  o->prune_stack[(*depth)++] = n;
+  return true;
+}
 
-  if (!n)
-    return;
+/* Flood fill starting from the nodes pushed to the prune stack. A
+ * node is visited if it is not yet marked reachable in this
+ * generation; visiting marks it so. */
+static bool _prune_flood(dncp o, int depth, bool full)
+{
+  hnetd_time_t now = dncp_time(o);
+  dncp_edge e;
+  dncp_node n;
 
-  /* Stop the iteration if we're already added to current
-   * generation. */
-  if (n->in_nodes.version == n->dncp->nodes.version)
-    return;
+  while (depth > 0)
+    {
+      n = o->prune_stack[--depth];
 
-  /* If it was expired, we can ignore it and pretend it did not happen. */
-  if (dncp_time(n->dncp) >= n->expiration_time)
-    return;
+      /* Look at it's neighbors. */
+      /* Ignore if it's not _bidirectional_ neighbor. Unidirectional
+       * ones lead to graph not settling down. */
+      dncp_node_for_each_edge(n, e)
+        {
+          dncp_node n2 = e->peer;
 
-  L_DEBUG("_prune_rec %s / %p", DNCP_NODE_REPR(n), n);
+          /* Skip if we're already added to current generation. */
+          if (full ? n2->in_nodes.version == o->nodes.version
+              : n2->last_reachable_prune == o->last_prune)
+            continue;
 
-  /* Refresh the entry - we clearly did reach it. */
-  vlist_add(&n->dncp->nodes, &n->in_nodes, n);
-  _node_set_reachable(n, true);
+          /* If it was expired, we can ignore it and pretend it did
+           * not happen. */
+          if (now >= n2->expiration_time)
+            continue;
 
-  /* Look at it's neighbors. */
-  /* Ignore if it's not _bidirectional_ neighbor. Unidirectional
-   * ones lead to graph not settling down. */
-  dncp_node_for_each_tlv_with_t_v(n, a, DNCP_T_NEIGHBOR, false)
-    if ((ne = dncp_tlv_neighbor(n->dncp, a)))
-      if ((n2 = dncp_node_find_neigh_bidir(n, ne)))
-        _prune_rec(n2);
+          L_DEBUG("_prune_flood %s / %p", DNCP_NODE_REPR(n2), n2);
+
+          /* Refresh the entry - we clearly did reach it. */
+          if (full)
+            {
+              vlist_add(&o->nodes, &n2->in_nodes, n2);
+              _node_set_reachable(n2, true, now);
+            }
+          else
+            {
+              _node_set_reachable(n2, true, o->last_prune);
+              o->next_full_prune = TMIN(o->next_full_prune,
+                                        n2->expiration_time);
+            }
+          if (!_prune_push(o, n2, &depth))
+            return false;
+        }
+    }
+  return true;
 }
 
-static void dncp_prune(dncp o)
+static void _prune_full(dncp o)
 {
   hnetd_time_t now = dncp_time(o);
   int grace_interval = o->ext->conf.grace_interval;
   hnetd_time_t grace_after = now - grace_interval;
+  int depth = 0;
+  bool ok = true;
+  dncp_node n, n2;
 
   /* Logic fails if time isn't moving forward-ish */
   assert(now != o->last_prune);
 
-  L_DEBUG("dncp_prune %p", o);
+  L_DEBUG("dncp_prune %p [full]", o);
+
+  list_for_each_entry_safe(n, n2, &o->prune_seeds, in_prune_seeds)
+    list_del_init(&n->in_prune_seeds);
+  o->graph_full_dirty = false;
 
   /* Prune the node graph. IOW, start at own node, flood fill, and zap
    * anything that didn't seem appropriate. */
   vlist_update(&o->nodes);
 
-  _prune_rec(o->own_node);
+  n = o->own_node;
+  if (now < n->expiration_time)
+    {
+      vlist_add(&o->nodes, &n->in_nodes, n);
+      _node_set_reachable(n, true, now);
+      ok = _prune_push(o, n, &depth) && _prune_flood(o, depth, true);
+    }
 
-  dncp_node n;
   hnetd_time_t next_time = 0;
   vlist_for_each_element(&o->nodes, n, in_nodes)
     {
@@ -158,16 +267,64 @@ static void dncp_prune(dncp o)
           next_time = TMIN(next_time, n->expiration_time);
           continue;
         }
-      if (n->last_reachable_prune < grace_after)
+      hnetd_time_t last_reachable = n->last_reachable_prune;
+      /* Incremental prunes do not refresh timestamps of already
+       * reachable nodes; they were reachable during the last one. */
+      if (last_reachable == o->last_prune
+          && o->last_incremental_prune > last_reachable)
+        last_reachable = TMIN(o->last_incremental_prune, now - 1);
+      if (last_reachable < grace_after)
         continue;
-      next_time = TMIN(next_time,
-                       n->last_reachable_prune + grace_interval + 1);
+      next_time = TMIN(next_time, last_reachable + grace_interval + 1);
       vlist_add(&o->nodes, &n->in_nodes, n);
-      _node_set_reachable(n, false);
+      _node_set_reachable(n, false, 0);
+      n->last_reachable_prune = last_reachable;
     }
   o->next_prune = next_time;
+  o->next_full_prune = next_time;
   vlist_flush(&o->nodes);
   o->last_prune = now;
+  o->last_incremental_prune = 0;
+  o->num_prune_full++;
+
+  /* Removal of unreachable nodes does not require another one, but
+   * failure to flood the whole graph does. */
+  o->graph_full_dirty = !ok;
+  if (!ok)
+    o->graph_dirty = true;
+}
+
+/* Extend reachability from the nodes that may have gained
+ * neighbors. Nothing can become unreachable here. */
+static void _prune_incremental(dncp o)
+{
+  int depth = 0;
+  dncp_node n, n2;
+
+  L_DEBUG("dncp_prune %p [incremental]", o);
+
+  list_for_each_entry_safe(n, n2, &o->prune_seeds, in_prune_seeds)
+    {
+      if (n->last_reachable_prune == o->last_prune
+          && !_prune_push(o, n, &depth))
+        break;
+      list_del_init(&n->in_prune_seeds);
+    }
+  /* Try again with full prune if we ran out of memory. */
+  if (!list_empty(&o->prune_seeds) || !_prune_flood(o, depth, false))
+    o->graph_full_dirty = o->graph_dirty = true;
+  o->next_prune = o->next_full_prune;
+  o->last_incremental_prune = dncp_time(o);
+  o->num_prune_incremental++;
+}
+
+static void dncp_prune(dncp o)
+{
+  if (o->graph_full_dirty
+      || (o->next_full_prune && o->next_full_prune <= dncp_time(o)))
+    _prune_full(o);
+  else
+    _prune_incremental(o);
 }
 
 #if L_LEVEL >= 8
@@ -231,6 +388,19 @@ _neighbor_interval(dncp o, dncp_t_neighbor neigh)
   return value;
 }
 
+/* Delay t to the next multiple of the timer slack, unless that would
+ * be after latest. */
+static hnetd_time_t _slack(dncp o, hnetd_time_t t, hnetd_time_t latest)
+{
+  hnetd_time_t slack = o->ext->conf.trickle_slack;
+  hnetd_time_t t2;
+
+  if (!t || slack <= 0)
+    return t;
+  t2 = (t + slack - 1) / slack * slack;
+  return t2 <= latest ? t2 : t;
+}
+
 static hnetd_time_t handle_trickle_and_ka(dncp_trickle t,
                                           dncp_ep_i l,
                                           dncp_neighbor ne)
@@ -251,29 +421,189 @@ static hnetd_time_t handle_trickle_and_ka(dncp_trickle t,
           next_time =
             t->last_sent + l->published_keepalive_interval;
         }
-      SET_NEXT(next_time, "next keep-alive");
+      SET_NEXT(_slack(l->dncp, next_time, HNETD_TIME_MAX),
+               "next keep-alive");
     }
   if (t->interval_end_time <= now)
     trickle_upgrade(t, l);
   else if (t->send_time && t->send_time <= now)
     trickle_send(t, l, ne);
 
-  SET_NEXT(t->interval_end_time, "trickle_interval_end_time");
-  SET_NEXT(t->send_time, "trickle_send_time");
+  /* The transmission has to happen within [I/2, I) to be valid
+   * Trickle; the send time is already random, so delaying it within
+   * the interval is fine. */
+  SET_NEXT(_slack(l->dncp, t->interval_end_time, HNETD_TIME_MAX),
+           "trickle_interval_end_time");
+  SET_NEXT(_slack(l->dncp, t->send_time, t->interval_end_time - 1),
+           "trickle_send_time");
   return next;
 }
 
+static void _heap_set(dncp o, int i, dncp_neighbor n)
+{
+  o->neighbor_heap[i] = n;
+  n->heap_index = i + 1;
+}
+
+static void _heap_up(dncp o, int i)
+{
+  dncp_neighbor n = o->neighbor_heap[i];
+
+  while (i > 0)
+    {
+      int p = (i - 1) / 2;
+
+      if (o->neighbor_heap[p]->deadline <= n->deadline)
+        break;
+      _heap_set(o, i, o->neighbor_heap[p]);
+      i = p;
+    }
+  _heap_set(o, i, n);
+}
+
+static void _heap_down(dncp o, int i)
+{
+  dncp_neighbor n = o->neighbor_heap[i];
+  int len = o->neighbor_heap_len;
+
+  while (2 * i + 1 < len)
+    {
+      int c = 2 * i + 1;
+
+      if (c + 1 < len
+          && o->neighbor_heap[c + 1]->deadline < o->neighbor_heap[c]->deadline)
+        c++;
+      if (n->deadline <= o->neighbor_heap[c]->deadline)
+        break;
+      _heap_set(o, i, o->neighbor_heap[c]);
+      i = c;
+    }
+  _heap_set(o, i, n);
+}
+
+void dncp_neighbor_schedule(dncp o, dncp_neighbor n, hnetd_time_t deadline)
+{
+  hnetd_time_t old_deadline = n->deadline;
+
+  n->deadline = deadline;
+  if (n->heap_index)
+    {
+      if (deadline < old_deadline)
+        _heap_up(o, n->heap_index - 1);
+      else
+        _heap_down(o, n->heap_index - 1);
+      return;
+    }
+  if (o->neighbor_heap_len == o->neighbor_heap_size)
+    {
+      int nsize = o->neighbor_heap_size ? o->neighbor_heap_size * 2 : 16;
+      dncp_neighbor *nh = realloc(o->neighbor_heap, nsize * sizeof(*nh));
+      if (!nh)
+        {
+          L_ERR("unable to grow neighbor heap to %d", nsize);
+          return;
+        }
+      o->neighbor_heap = nh;
+      o->neighbor_heap_size = nsize;
+    }
+  _heap_set(o, o->neighbor_heap_len++, n);
+  _heap_up(o, o->neighbor_heap_len - 1);
+}
+
+void dncp_neighbor_unschedule(dncp o, dncp_neighbor n)
+{
+  int i = n->heap_index - 1;
+  dncp_neighbor last;
+
+  if (!n->heap_index)
+    return;
+  n->heap_index = 0;
+  last = o->neighbor_heap[--o->neighbor_heap_len];
+  if (last == n)
+    return;
+  _heap_set(o, i, last);
+  _heap_up(o, i);
+  _heap_down(o, last->heap_index - 1);
+}
+
+/* Handle whatever is due for the neighbor. Returns when it next needs
+ * attention (0 = only when something changes), or -1 if it was
+ * dropped. */
+static hnetd_time_t _neighbor_timeout(dncp o, dncp_neighbor n)
+{
+  dncp_t_neighbor ne = dncp_tlv_neighbor(o, &n->tlv->tlv);
+  dncp_ep ep = dncp_find_ep_by_id(o, ne->ep_id);
+  dncp_ep_i l = container_of(ep, dncp_ep_i_s, conf);
+  hnetd_time_t now = dncp_time(o);
+  hnetd_time_t next = 0;
+
+  o->num_neighbor_timeouts++;
+  if (!n->keepalive_interval_valid)
+    {
+      n->keepalive_interval = _neighbor_interval(o, ne);
+      n->keepalive_interval_valid = true;
+    }
+  hnetd_time_t interval = n->keepalive_interval;
+
+  if (ep->unicast_only)
+    {
+      hnetd_time_t next_time = handle_trickle_and_ka(&n->trickle, l, n);
+      SET_NEXT(next_time, "n-trickle-ka");
+    }
+
+  /* Zero interval is valid only on unicast stream connection
+   * (=~TCP/TLS/..). In that case, we can ignore keepalive
+   * handling here. */
+  if (!interval && ep->unicast_is_reliable_stream)
+    return next;
+
+  hnetd_time_t next_time = n->last_contact
+    + interval * o->ext->conf.keepalive_multiplier_percent / 100;
+
+  /* No cause to do anything right now. */
+  if (next_time > now)
+    {
+      SET_NEXT(next_time, "neighbor validity");
+      return next;
+    }
+
+  /* Zap the neighbor */
+#if L_LEVEL >= 7
+  L_DEBUG("Neighbor %s gone on " DNCP_LINK_F " - nothing in %d ms",
+          DNCP_NI_REPR(o, dncp_tlv_get_node_id(o, ne)),
+          DNCP_LINK_D(l), (int) (now - n->last_contact));
+#endif /* L_LEVEL >= 7 */
+  dncp_remove_tlv(o, n->tlv);
+  o->num_neighbor_dropped++;
+  return -1;
+}
+
 void dncp_ext_timeout(dncp o)
 {
   hnetd_time_t next = 0;
   hnetd_time_t now = o->ext->cb.get_time(o->ext);
   dncp_ep ep;
-  dncp_tlv t, t2;
 
   /* Assumption: We're within RTC step here -> can use same timestamp
    * all the way. */
   o->now = now;
 
+  o->num_wakeups++;
+  if (!o->wakeup_window_start)
+    {
+      o->wakeup_window_start = now;
+      o->wakeup_window_wakeups = o->num_wakeups;
+    }
+  else if (now - o->wakeup_window_start >= DNCP_WAKEUP_RATE_WINDOW)
+    {
+      int64_t wakeups = o->num_wakeups - o->wakeup_window_wakeups;
+
+      o->wakeups_per_1000s = wakeups * 1000 * HNETD_TIME_PER_SECOND
+        / (now - o->wakeup_window_start);
+      o->wakeup_window_start = now;
+      o->wakeup_window_wakeups = o->num_wakeups;
+    }
+
   /* If we weren't before, we are now processing within timeout (no
    * sense scheduling extra timeouts within dncp_self_flush or dncp_prune). */
   o->immediate_scheduled = true;
@@ -296,7 +626,9 @@ void dncp_ext_timeout(dncp o)
   if (!o->disable_prune)
     {
       if (o->graph_dirty)
-        o->next_prune = o->ext->conf.minimum_prune_interval + o->last_prune;
+        o->next_prune = o->ext->conf.minimum_prune_interval
+          + (o->last_incremental_prune > o->last_prune ?
+             o->last_incremental_prune : o->last_prune);
 
       if (o->next_prune && o->next_prune <= now)
         {
@@ -325,6 +657,9 @@ void dncp_ext_timeout(dncp o)
 
       ep_i_set_keepalive_interval(l, ep->keepalive_interval);
 
+      /* Neighbors may have come and gone since Trickle was last set. */
+      _ep_adapt_trickle(l);
+
       if (ep->unicast_only)
         continue;
 
@@ -333,47 +668,26 @@ void dncp_ext_timeout(dncp o)
     }
 
   /* Look at neighbors we should be worried about.. */
-  /* vlist_for_each_element(&l->neighbors, n, in_neighbors) */
-  dncp_t_neighbor ne;
-  dncp_for_each_tlv_safe(o, t, t2)
-    if ((ne = dncp_tlv_neighbor(o, &t->tlv)))
-      {
-        dncp_ep ep = dncp_find_ep_by_id(o, ne->ep_id);
-        dncp_ep_i l = container_of(ep, dncp_ep_i_s, conf);
-        dncp_neighbor n = dncp_tlv_get_extra(t);
-        hnetd_time_t interval = _neighbor_interval(o, ne);
-
-        if (ep->unicast_only)
-          {
-            hnetd_time_t next_time = handle_trickle_and_ka(&n->trickle, l, n);
-            SET_NEXT(next_time, "n-trickle-ka");
-          }
-
-        /* Zero interval is valid only on unicast stream connection
-         * (=~TCP/TLS/..). In that case, we can ignore keepalive
-         * handling here. */
-        if (!interval && ep->unicast_is_reliable_stream)
-          continue;
-
-        hnetd_time_t next_time = n->last_contact
-          + interval * o->ext->conf.keepalive_multiplier_percent / 100;
+  if (o->neighbors_dirty)
+    {
+      int i;
 
-        /* No cause to do anything right now. */
-        if (next_time > now)
-          {
-            SET_NEXT(next_time, "neighbor validity");
-            continue;
-          }
+      /* Everything is due; heap order is trivially preserved. */
+      for (i = 0 ; i < o->neighbor_heap_len ; i++)
+        o->neighbor_heap[i]->deadline = 0;
+      o->neighbors_dirty = false;
+    }
+  while (o->neighbor_heap_len && o->neighbor_heap[0]->deadline <= now)
+    {
+      dncp_neighbor n = o->neighbor_heap[0];
+      hnetd_time_t next_time = _neighbor_timeout(o, n);
 
-        /* Zap the neighbor */
-#if L_LEVEL >= 7
-        L_DEBUG("Neighbor %s gone on " DNCP_LINK_F " - nothing in %d ms",
-                DNCP_NI_REPR(o, dncp_tlv_get_node_id(o, ne)),
-                DNCP_LINK_D(l), (int) (now - n->last_contact));
-#endif /* L_LEVEL >= 7 */
-        dncp_remove_tlv(o, t);
-        o->num_neighbor_dropped++;
-      }
+      if (next_time >= 0)
+        dncp_neighbor_schedule(o, n, next_time ? next_time : HNETD_TIME_MAX);
+    }
+  if (o->neighbor_heap_len
+      && o->neighbor_heap[0]->deadline != HNETD_TIME_MAX)
+    SET_NEXT(o->neighbor_heap[0]->deadline, "neighbors");
 
   if (next && !o->immediate_scheduled)
     {
@@ -394,6 +708,10 @@ void dncp_trickle_reset(dncp o)
 {
   dncp_ep ep;
 
+  o->num_trickle_resets++;
+  _trickle_resets(o, dncp_time(o));
+  o->trickle_resets++;
+
   /* This function does not care if Trickle is actually in per-peer or
    * per-link mode here; resetting the variables does nothing harmful
    * anyway. */
@@ -417,6 +735,24 @@ void dncp_trickle_reset(dncp o)
 
         trickle_set_i(&n->trickle, l, ep->trickle_imin);
       }
+  o->neighbors_dirty = true;
+}
+
+static int _ep_drop_neighbors(dncp_ep_i l)
+{
+  dncp o = l->dncp;
+  dncp_tlv t, t2;
+  dncp_t_neighbor ne;
+  int dropped = 0;
+
+  dncp_for_each_tlv_safe(o, t, t2)
+    if ((ne = dncp_tlv_neighbor(o, &t->tlv)))
+      if (ne->ep_id == l->ep_id)
+        {
+          dncp_remove_tlv(o, t);
+          dropped++;
+        }
+  return dropped;
 }
 
 void dncp_ext_ep_ready(dncp_ep ep, bool enabled)
@@ -436,17 +772,30 @@ void dncp_ext_ep_ready(dncp_ep ep, bool enabled)
     }
   else
     {
-      dncp o = l->dncp;
-      dncp_tlv t, t2;
-      dncp_t_neighbor ne;
-
-      dncp_for_each_tlv_safe(o, t, t2)
-        if ((ne = dncp_tlv_neighbor(o, &t->tlv)))
-          if (ne->ep_id == l->ep_id)
-            dncp_remove_tlv(o, t);
+      _ep_drop_neighbors(l);
 
       /* kill TLV, if any */
-      ep_i_set_keepalive_interval(l, DNCP_KEEPALIVE_INTERVAL(o));
+      ep_i_set_keepalive_interval(l, DNCP_KEEPALIVE_INTERVAL(l->dncp));
     }
   dncp_notify_subscribers_ep_changed(ep, enabled ? DNCP_EVENT_ADD : DNCP_EVENT_REMOVE);
 }
+
+void dncp_ext_ep_carrier(dncp_ep ep, bool up)
+{
+  dncp_ep_i l = container_of(ep, dncp_ep_i_s, conf);
+
+  L_DEBUG("dncp_ext_ep_carrier %s %s", ep->ifname, up ? "up" : "down");
+  l->carrier_down = !up;
+  if (!l->enabled)
+    return;
+  if (up)
+    {
+      /* Whoever is there now should hear from us soon. */
+      trickle_set_i(&l->trickle, l, l->conf.trickle_imin);
+      dncp_schedule(l->dncp);
+      return;
+    }
+  /* No sense waiting for the neighbors to time out; removing their
+   * TLVs changes our node data, and prune takes care of the rest. */
+  l->dncp->num_neighbor_dropped += _ep_drop_neighbors(l);
+}
@@ -48,6 +48,16 @@
  * include this before anything hnetd-specific.*/
 #include <fcntl.h>
 
+#ifdef __linux__
+/* Handshakes may be run in a separate thread (see
+ * dtls_set_handshake_worker); it is woken up, and wakes the main loop
+ * up, using eventfds. */
+#define DTLS_HANDSHAKE_WORKER
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#endif /* __linux__ */
+
 #include "dtls.h"
 #if L_LEVEL >= LOG_DEBUG
 /* HEX_REPR */
@@ -82,18 +92,92 @@
  * ( does it matter? it seems one context is enough. ) */
 #define USE_ONE_CONTEXT
 
-/* These lurk in queue, waiting for connection to finish (outbound). */
+/* Number of buckets in the connection hash table (power of 2). */
+#define CONNECTION_HASH_SIZE 64
+
+/* Session id context; server-side session resumption does not work
+ * with peer verification without one. */
+#define SESSION_ID_CONTEXT "hnetd"
+
+/* Number of sources tracked for per-source rate limiting (power of
+ * 2), and how many slots are probed for a source. */
+#define SOURCE_TABLE_SIZE 64
+#define SOURCE_TABLE_PROBES 8
+
+/* Queued buffers are allocated in multiples of this, so that freed
+ * ones can be reused for most other packets. */
+#define QUEUED_BUFFER_GRANULARITY 256
+
+/* Freed queued buffers up to this size are kept in a pool, up to
+ * QUEUED_BUFFER_POOL_SIZE of them; larger ones are rare. */
+#define QUEUED_BUFFER_POOL_MAX_SIZE 4096
+#define QUEUED_BUFFER_POOL_SIZE 32
+
+/* Client-side sessions kept for resumption, most recently used first. */
+typedef struct {
+  struct list_head in_sessions;
+  struct sockaddr_in6 remote_addr;
+  SSL_SESSION *session;
+} dtls_cached_session_s, *dtls_cached_session;
+
+/* Token bucket of a remote address (regardless of port, as client
+ * ports float). */
+typedef struct {
+  bool used;
+  struct in6_addr addr;
+  uint32_t scope_id;
+
+  /* Tokens (in thousandths of a packet), as of when last refilled. */
+  int tokens;
+  hnetd_time_t refilled;
+
+  /* The second during which the source was last seen active. */
+  time_t active_t;
+
+  int num_packets;
+  int num_drops;
+} dtls_source_s, *dtls_source;
+
+/* These lurk in queue, waiting for connection to finish (outbound),
+ * or to be read by the connection (inbound). */
 typedef struct {
   struct list_head in_queued_buffers;
   int len;
+  int size;
   unsigned char buf[0];
-} *dtls_queued_buffer;
+} dtls_queued_buffer_s, *dtls_queued_buffer;
 
-typedef struct {
+typedef struct dtls_connection_struct {
   struct list_head in_connections;
 
+  /* In the connection_hash bucket of remote_addr */
+  struct list_head in_connection_hash;
+
   struct list_head queued_buffers;
 
+  /* Received datagrams not yet read by the SSL; the current one is
+   * read straight from the udp46 receive buffer, and copied to
+   * rx_buffers only if it is not consumed right away. */
+  struct list_head rx_buffers;
+  const void *rx_data;
+  int rx_len;
+
+  /* While the handshake is in the worker (busy), the main thread must
+   * not touch ssl, the BIOs, rx_data or rx_buffers. Datagrams received
+   * meanwhile are copied to rx_pending, and the ones the worker has
+   * read wait in rx_done (so that the pool is touched only by the main
+   * thread). busy is set and cleared by the main thread, with release
+   * semantics, and read with acquire (see _connection_busy). */
+  bool busy;
+  struct list_head rx_pending;
+  struct list_head rx_done;
+  struct dtls_connection_struct *next_job;
+
+  /* Result of the last handshake step, if not yet processed. */
+  bool handshake_done;
+  int handshake_rv;
+  int handshake_err;
+
   dtls d;
 
   struct sockaddr_in6 remote_addr;
@@ -138,6 +222,40 @@ typedef struct dtls_struct {
 
   struct list_head connections;
 
+  /* The connections, hashed by the remote address and port. */
+  struct list_head connection_hash[CONNECTION_HASH_SIZE];
+
+  /* Sessions of earlier client connections, by remote address. */
+  struct list_head sessions;
+  int num_sessions;
+  bool disable_session_resumption;
+
+  dtls_stats_s stats;
+
+  /* Pool of free queued buffers, and bytes in the used ones. */
+  struct list_head free_buffers;
+  int num_free_buffers;
+  int queued_bytes;
+
+#ifdef DTLS_HANDSHAKE_WORKER
+  /* The handshake worker thread. Connections are handed to it, and
+   * back, using lock-free stacks (worker_in and worker_out), and the
+   * other side is woken up using the eventfds. */
+  bool worker_running;
+  bool worker_stop;
+  pthread_t worker;
+  int worker_efd;
+  struct uloop_fd worker_done_ufd;
+  dtls_connection worker_in;
+  dtls_connection worker_out;
+
+  /* Certificate verification of the worker, waiting for the main
+   * thread to call the unknown cert callback, and the verdict. */
+  X509_STORE_CTX *worker_verify;
+  int worker_verdict;
+  int worker_reply_efd;
+#endif /* DTLS_HANDSHAKE_WORKER */
+
 #ifdef DTLS_OPENSSL
   unsigned char cookie_secret[COOKIE_SECRET_LENGTH];
 #endif /* DTLS_OPENSSL */
@@ -155,6 +273,13 @@ typedef struct dtls_struct {
 
   time_t t;
   int pps;
+
+  /* Per-source token buckets, and how many sources were active during
+   * this and the previous second; the input_pps is shared evenly
+   * among them (and a newcomer). */
+  dtls_source_s sources[SOURCE_TABLE_SIZE];
+  int num_active_sources;
+  int num_prev_active_sources;
 } dtls_s;
 
 static dtls_limits_s _default_limits = {
@@ -162,6 +287,9 @@ static dtls_limits_s _default_limits = {
   .connection_idle_limit_seconds = 1800,
   .num_non_data_connections = 10,
   .num_data_connections = 100,
+  .num_cached_sessions = 100,
+  .max_queued_bytes = 1024 * 1024,
+  .input_source_burst = 10,
 };
 
 #define DTLS_LIMIT(x) (d->limits.x ? d->limits.x : _default_limits.x)
@@ -275,12 +403,267 @@ static int _cookie_verify_cb(SSL *ssl,
 
 #endif /* DTLS_OPENSSL */
 
-static void _qb_free(dtls_queued_buffer qb)
+static dtls_queued_buffer _qb_alloc(dtls d, const void *buf, int len)
+{
+  dtls_queued_buffer qb;
+  int size;
+
+  if (d->queued_bytes + len > DTLS_LIMIT(max_queued_bytes))
+    {
+      L_DEBUG("queued buffers full (%d + %d bytes)", d->queued_bytes, len);
+      d->stats.num_queue_drops++;
+      return NULL;
+    }
+  list_for_each_entry(qb, &d->free_buffers, in_queued_buffers)
+    if (qb->size >= len)
+      {
+        list_del(&qb->in_queued_buffers);
+        d->num_free_buffers--;
+        d->stats.num_pool_hits++;
+        goto found;
+      }
+  size = (len + QUEUED_BUFFER_GRANULARITY - 1)
+    & ~(QUEUED_BUFFER_GRANULARITY - 1);
+  if (!(qb = malloc(sizeof(*qb) + size)))
+    {
+      L_ERR("malloc qbuf");
+      return NULL;
+    }
+  qb->size = size;
+  d->stats.num_pool_misses++;
+ found:
+  memcpy(qb->buf, buf, len);
+  qb->len = len;
+  d->queued_bytes += len;
+  return qb;
+}
+
+static void _qb_free(dtls d, dtls_queued_buffer qb)
 {
   list_del(&qb->in_queued_buffers);
+  d->queued_bytes -= qb->len;
+  if (qb->size <= QUEUED_BUFFER_POOL_MAX_SIZE
+      && d->num_free_buffers < QUEUED_BUFFER_POOL_SIZE)
+    {
+      list_add(&qb->in_queued_buffers, &d->free_buffers);
+      d->num_free_buffers++;
+      return;
+    }
   free(qb);
 }
 
+static inline bool _connection_busy(dtls_connection dc)
+{
+  return __atomic_load_n(&dc->busy, __ATOMIC_ACQUIRE);
+}
+
+static inline void _connection_set_busy(dtls_connection dc, bool busy)
+{
+  __atomic_store_n(&dc->busy, busy, __ATOMIC_RELEASE);
+}
+
+static void _connection_rx_copy(dtls_connection dc, struct list_head *h,
+                                const void *buf, int len)
+{
+  dtls_queued_buffer qb;
+
+  if ((qb = _qb_alloc(dc->d, buf, len)))
+    {
+      list_add_tail(&qb->in_queued_buffers, h);
+      dc->d->stats.num_rx_copies++;
+    }
+}
+
+/* Copy the datagram lent to the connection, if it has not been read
+ * yet, so that it can be read later. Main thread only, and never while
+ * the worker has the connection. */
+static void _connection_rx_keep(dtls_connection dc)
+{
+  if (!dc->rx_data)
+    return;
+  _connection_rx_copy(dc, &dc->rx_buffers, dc->rx_data, dc->rx_len);
+  dc->rx_data = NULL;
+}
+
+/*
+ * Read-only BIO for the connections' inbound datagrams. Unlike memory
+ * BIO, it needs no copy of the data to be written to it, and it
+ * preserves the datagram boundaries.
+ */
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define BIO_get_data(b) ((b)->ptr)
+#define BIO_set_data(b, p) ((b)->ptr = (p))
+#define BIO_set_init(b, v) ((b)->init = (v))
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+
+static int _rx_bio_read(BIO *b, char *out, int outl)
+{
+  dtls_connection dc = BIO_get_data(b);
+  dtls_queued_buffer qb = NULL;
+  const void *data;
+  int len;
+
+  BIO_clear_retry_flags(b);
+  /* Older datagrams first */
+  if (!list_empty(&dc->rx_buffers))
+    {
+      qb = list_first_entry(&dc->rx_buffers, dtls_queued_buffer_s,
+                            in_queued_buffers);
+      data = qb->buf;
+      len = qb->len;
+    }
+  else if (dc->rx_data)
+    {
+      data = dc->rx_data;
+      len = dc->rx_len;
+    }
+  else
+    {
+      BIO_set_retry_read(b);
+      return -1;
+    }
+  if (len > outl)
+    {
+      L_DEBUG("truncating %d byte datagram to %d", len, outl);
+      len = outl;
+    }
+  memcpy(out, data, len);
+  if (qb && _connection_busy(dc))
+    list_move_tail(&qb->in_queued_buffers, &dc->rx_done);
+  else if (qb)
+    _qb_free(dc->d, qb);
+  else
+    dc->rx_data = NULL;
+  return len;
+}
+
+static long _rx_bio_ctrl(BIO *b, int cmd,
+                         long num __unused, void *ptr __unused)
+{
+  dtls_connection dc = BIO_get_data(b);
+  dtls_queued_buffer qb;
+  long pending = 0;
+
+  switch (cmd)
+    {
+    case BIO_CTRL_PENDING:
+      list_for_each_entry(qb, &dc->rx_buffers, in_queued_buffers)
+        pending += qb->len;
+      if (dc->rx_data)
+        pending += dc->rx_len;
+      return pending;
+    case BIO_CTRL_FLUSH:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+static BIO_METHOD *_rx_bio_method(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  static BIO_METHOD *m;
+
+  if (!m)
+    {
+      if (!(m = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK,
+                             "dtls rx")))
+        return NULL;
+      BIO_meth_set_read(m, _rx_bio_read);
+      BIO_meth_set_ctrl(m, _rx_bio_ctrl);
+    }
+  return m;
+#else
+  static BIO_METHOD m = {
+    .type = BIO_TYPE_SOURCE_SINK,
+    .name = "dtls rx",
+    .bread = _rx_bio_read,
+    .ctrl = _rx_bio_ctrl,
+  };
+
+  return &m;
+#endif /* OPENSSL_VERSION_NUMBER >= 0x10100000L */
+}
+
+static struct list_head *
+_connection_hash_bucket(dtls d, const struct sockaddr_in6 *addr)
+{
+  const unsigned char *p = (const unsigned char *)&addr->sin6_addr;
+  uint32_t h = 2166136261U;
+  unsigned int i;
+
+  /* FNV-1a over address and port */
+  for (i = 0; i < sizeof(addr->sin6_addr); i++)
+    h = (h ^ p[i]) * 16777619U;
+  p = (const unsigned char *)&addr->sin6_port;
+  for (i = 0; i < sizeof(addr->sin6_port); i++)
+    h = (h ^ p[i]) * 16777619U;
+  return &d->connection_hash[h & (CONNECTION_HASH_SIZE - 1)];
+}
+
+static dtls_cached_session
+_session_find(dtls d, const struct sockaddr_in6 *remote_addr)
+{
+  dtls_cached_session cs;
+
+  list_for_each_entry(cs, &d->sessions, in_sessions)
+    if (memcmp(remote_addr, &cs->remote_addr, sizeof(*remote_addr)) == 0)
+      return cs;
+  return NULL;
+}
+
+static void _session_free(dtls d, dtls_cached_session cs)
+{
+  list_del(&cs->in_sessions);
+  SSL_SESSION_free(cs->session);
+  free(cs);
+  d->num_sessions--;
+}
+
+static void _session_forget(dtls d, const struct sockaddr_in6 *remote_addr)
+{
+  dtls_cached_session cs = _session_find(d, remote_addr);
+
+  if (cs)
+    _session_free(d, cs);
+}
+
+/* Remember the session of an established client connection, so that
+ * the next connection to the same peer can resume it instead of doing
+ * full handshake. */
+static void _session_store(dtls_connection dc)
+{
+  dtls d = dc->d;
+  dtls_cached_session cs = _session_find(d, &dc->remote_addr);
+  SSL_SESSION *session;
+
+  if (d->disable_session_resumption)
+    return;
+  if (!(session = SSL_get1_session(dc->ssl)))
+    return;
+  if (cs)
+    {
+      SSL_SESSION_free(cs->session);
+      list_del(&cs->in_sessions);
+    }
+  else
+    {
+      if (!(cs = calloc(1, sizeof(*cs))))
+        {
+          SSL_SESSION_free(session);
+          return;
+        }
+      cs->remote_addr = dc->remote_addr;
+      d->num_sessions++;
+    }
+  cs->session = session;
+  list_add(&cs->in_sessions, &d->sessions);
+  while (d->num_sessions > DTLS_LIMIT(num_cached_sessions))
+    _session_free(d, list_last_entry(&d->sessions, dtls_cached_session_s,
+                                     in_sessions));
+}
+
 static void _connection_free(dtls_connection dc)
 {
   dtls_queued_buffer qb, qb2;
@@ -294,8 +677,15 @@ static void _connection_free(dtls_connection dc)
         dc->d->num_non_data_connections--;
     }
   list_for_each_entry_safe(qb, qb2, &dc->queued_buffers, in_queued_buffers)
-    _qb_free(qb);
+    _qb_free(dc->d, qb);
+  list_for_each_entry_safe(qb, qb2, &dc->rx_buffers, in_queued_buffers)
+    _qb_free(dc->d, qb);
+  list_for_each_entry_safe(qb, qb2, &dc->rx_pending, in_queued_buffers)
+    _qb_free(dc->d, qb);
+  list_for_each_entry_safe(qb, qb2, &dc->rx_done, in_queued_buffers)
+    _qb_free(dc->d, qb);
   list_del(&dc->in_connections);
+  list_del(&dc->in_connection_hash);
   SSL_free(dc->ssl);
   uloop_timeout_cancel(&dc->uto);
   free(dc);
@@ -303,6 +693,9 @@ static void _connection_free(dtls_connection dc)
 
 static bool _connection_poll_write(dtls_connection dc)
 {
+  /* The worker writes it; we get to send it once it is done. */
+  if (_connection_busy(dc))
+    return true;
   while (BIO_ctrl_pending(dc->wbio) > 0)
     {
       char buf[2048];
@@ -333,6 +726,9 @@ static bool _connection_shutdown(dtls_connection dc)
   else
     dc->d->num_non_data_connections--;
   dc->state = STATE_SHUTDOWN;
+  /* If the worker has it, it is freed once it comes back. */
+  if (_connection_busy(dc))
+    return true;
   /* The SSL_shutdown needs to be called 2+ times; first time, it
    * does local bookkeeping, and second time confirms receipt of
    * ack from remote side (eventually). */
@@ -370,6 +766,25 @@ static void _connection_drop(dtls d, bool is_data)
   _connection_shutdown(lru);
 }
 
+/* One step of the handshake. This may be run in the worker thread,
+ * so it touches only the connection's own SSL state. */
+static void _connection_handshake(dtls_connection dc)
+{
+  int rv;
+
+  if (dc->is_client)
+    rv = SSL_connect(dc->ssl);
+  else
+    rv = SSL_accept(dc->ssl);
+  dc->handshake_rv = rv;
+  if (rv > 0)
+    return;
+  dc->handshake_err = SSL_get_error(dc->ssl, rv);
+  _drain_errors();
+}
+
+static bool _worker_post(dtls_connection dc);
+
 static bool _connection_poll_read(dtls_connection dc)
 {
   unsigned char buf[1];
@@ -382,10 +797,29 @@ static bool _connection_poll_read(dtls_connection dc)
   switch (dc->state)
     {
     case STATE_ACCEPT:
-      if ((rv = SSL_accept(dc->ssl)) > 0)
+    case STATE_CONNECT:
+      if (_connection_busy(dc))
+        return true;
+      if (!dc->handshake_done)
+        {
+          if (_worker_post(dc))
+            return true;
+          _connection_handshake(dc);
+        }
+      dc->handshake_done = false;
+      if ((rv = dc->handshake_rv) > 0)
         {
-          L_DEBUG("connection %p accept->data", dc);
-        to_data:
+          L_DEBUG("connection %p %s->data", dc,
+                  dc->is_client ? "connect" : "accept");
+          if (SSL_session_reused(dc->ssl))
+            {
+              L_DEBUG("connection %p resumed session", dc);
+              d->stats.num_resumed_handshakes++;
+            }
+          else
+            d->stats.num_full_handshakes++;
+          if (dc->is_client)
+            _session_store(dc);
           if (dc->d->num_data_connections == DTLS_LIMIT(num_data_connections))
             _connection_drop(d, true);
           dc->d->num_non_data_connections--;
@@ -394,13 +828,6 @@ static bool _connection_poll_read(dtls_connection dc)
           goto redo;
         }
       break;
-    case STATE_CONNECT:
-      if ((rv = SSL_connect(dc->ssl)) > 0)
-        {
-          L_DEBUG("connection %p connect->data", dc);
-          goto to_data;
-        }
-      break;
     case STATE_DATA:
       /* Initially try to flush writes. Then try to flush reads. */
       list_for_each_entry_safe(qb, qb2, &dc->queued_buffers, in_queued_buffers)
@@ -412,7 +839,7 @@ static bool _connection_poll_read(dtls_connection dc)
                 L_ERR("partial write from queue?!?");
               else
                 L_DEBUG("wrote %d from queue", (int)rv);
-              _qb_free(qb);
+              _qb_free(d, qb);
             }
           else
             {
@@ -460,13 +887,15 @@ static bool _connection_poll_read(dtls_connection dc)
       return false;
     }
   /* Non-0, but probably timeout */
-  int err = SSL_get_error(dc->ssl, rv);
-  _drain_errors();
-  if (err != SSL_ERROR_WANT_READ)
+  if (dc->handshake_err != SSL_ERROR_WANT_READ)
     {
       if (dc->state != STATE_SHUTDOWN)
         {
           L_DEBUG("shutting down connection due to error");
+          /* The cached session may be the culprit; do not offer it
+           * again. */
+          if (dc->state == STATE_CONNECT)
+            _session_forget(d, &dc->remote_addr);
           return _connection_shutdown(dc);
         }
       else
@@ -491,6 +920,10 @@ static bool _connection_poll_read(dtls_connection dc)
     }
   else
     uloop_timeout_cancel(&dc->uto);
+
+  /* More arrived while the worker had it */
+  if (!list_empty(&dc->rx_buffers))
+    goto redo;
   return true;
 }
 
@@ -510,6 +943,9 @@ static void _connection_uto_cb(struct uloop_timeout *t)
   dtls_connection dc = container_of(t, dtls_connection_s, uto);
 
   L_DEBUG("_connection_uto_cb %p", dc);
+  /* Rescheduled once the worker is done */
+  if (_connection_busy(dc))
+    return;
 #ifdef DTLS_OPENSSL
   DTLSv1_handle_timeout(dc->ssl);
 #endif /* DTLS_OPENSSL */
@@ -524,7 +960,7 @@ _connection_find(dtls d, int is_client, const struct sockaddr_in6 *dst)
   dtls_connection dc;
 
   L_DEBUG("_connection_find dst:%s", HEX_REPR(dst, sizeof(*dst)));
-  list_for_each_entry(dc, &d->connections, in_connections)
+  list_for_each_entry(dc, _connection_hash_bucket(d, dst), in_connection_hash)
     if (dc->state != STATE_SHUTDOWN
         && (is_client < 0 || (!is_client == !dc->is_client)))
       if (memcmp(dst, &dc->remote_addr, sizeof(*dst)) == 0)
@@ -544,6 +980,79 @@ static void _dtls_update_t(dtls d)
 
   d->t = t;
   d->pps = 0;
+  d->num_prev_active_sources = d->num_active_sources;
+  d->num_active_sources = 0;
+}
+
+static dtls_source _source_find(dtls d, const struct sockaddr_in6 *addr)
+{
+  const unsigned char *p = (const unsigned char *)&addr->sin6_addr;
+  dtls_source ds, lru = NULL;
+  uint32_t h = 2166136261U;
+  unsigned int i;
+
+  /* FNV-1a over address */
+  for (i = 0; i < sizeof(addr->sin6_addr); i++)
+    h = (h ^ p[i]) * 16777619U;
+  for (i = 0; i < SOURCE_TABLE_PROBES; i++)
+    {
+      ds = &d->sources[(h + i) & (SOURCE_TABLE_SIZE - 1)];
+      /* Slots are never freed, so it is not further along. */
+      if (!ds->used)
+        {
+          lru = ds;
+          break;
+        }
+      if (memcmp(&ds->addr, &addr->sin6_addr, sizeof(ds->addr)) == 0
+          && ds->scope_id == addr->sin6_scope_id)
+        return ds;
+      if (!lru || ds->refilled < lru->refilled)
+        lru = ds;
+    }
+  /* Not found; take a free slot, or the least recently used one. */
+  memset(lru, 0, sizeof(*lru));
+  lru->used = true;
+  lru->addr = addr->sin6_addr;
+  lru->scope_id = addr->sin6_scope_id;
+  lru->tokens = -1;
+  return lru;
+}
+
+/* Take a token from the bucket of the source, if there is one. */
+static bool _source_allow(dtls d, const struct sockaddr_in6 *addr)
+{
+  dtls_source ds = _source_find(d, addr);
+  hnetd_time_t now = hnetd_time();
+  int active, rate, burst;
+
+  if (ds->active_t != d->t)
+    {
+      ds->active_t = d->t;
+      d->num_active_sources++;
+    }
+  active = d->num_active_sources > d->num_prev_active_sources
+    ? d->num_active_sources : d->num_prev_active_sources;
+  /* One share is kept for sources that have not sent anything yet, so
+   * that the active ones cannot use up the budget before they do. */
+  if (!(rate = DTLS_LIMIT(input_pps) / (active + 1)))
+    rate = 1;
+  burst = rate > DTLS_LIMIT(input_source_burst)
+    ? rate : DTLS_LIMIT(input_source_burst);
+  if (ds->tokens < 0
+      || ds->tokens + (now - ds->refilled) * rate > burst * 1000)
+    ds->tokens = burst * 1000;
+  else
+    ds->tokens += (now - ds->refilled) * rate;
+  ds->refilled = now;
+  ds->num_packets++;
+  if (ds->tokens < 1000)
+    {
+      ds->num_drops++;
+      d->stats.num_source_drops++;
+      return false;
+    }
+  ds->tokens -= 1000;
+  return true;
 }
 
 static dtls_connection
@@ -557,6 +1066,9 @@ _connection_create(dtls d, bool is_client,
   if (d->num_non_data_connections == DTLS_LIMIT(num_non_data_connections))
     _connection_drop(d, false);
   INIT_LIST_HEAD(&dc->queued_buffers);
+  INIT_LIST_HEAD(&dc->rx_buffers);
+  INIT_LIST_HEAD(&dc->rx_pending);
+  INIT_LIST_HEAD(&dc->rx_done);
   dc->d = d;
   _dtls_update_t(d);
   dc->last_use = d->t;
@@ -577,14 +1089,38 @@ _connection_create(dtls d, bool is_client,
     }
   SSL_set_ex_data(ssl, 0, dc);
   SSL_set_options(ssl, SSL_OP_COOKIE_EXCHANGE);
+  if (is_client && !d->disable_session_resumption)
+    {
+      dtls_cached_session cs = _session_find(d, remote_addr);
 
-  dc->rbio = BIO_new(BIO_s_mem());
+      if (cs && SSL_set_session(ssl, cs->session) != 1)
+        {
+          _drain_errors();
+          _session_free(d, cs);
+        }
+    }
+
+  dc->rbio = BIO_new(_rx_bio_method());
   dc->wbio = BIO_new(BIO_s_mem());
-  BIO_set_mem_eof_return(dc->rbio, -1);
+  if (!dc->rbio || !dc->wbio)
+    {
+      L_ERR("BIO_new failed");
+      if (dc->rbio)
+        BIO_free(dc->rbio);
+      if (dc->wbio)
+        BIO_free(dc->wbio);
+      SSL_free(ssl);
+      d->num_non_data_connections--;
+      free(dc);
+      return NULL;
+    }
+  BIO_set_data(dc->rbio, dc);
+  BIO_set_init(dc->rbio, 1);
   BIO_set_mem_eof_return(dc->wbio, -1);
 
   SSL_set_bio(ssl, dc->rbio, dc->wbio);
   list_add(&dc->in_connections, &d->connections);
+  list_add(&dc->in_connection_hash, _connection_hash_bucket(d, remote_addr));
 
   dc->ssl = ssl;
   L_DEBUG("Created new %s connection %p to %s",
@@ -593,25 +1129,35 @@ _connection_create(dtls d, bool is_client,
   return dc;
 }
 
-static void _dtls_poll(dtls d, bool is_client)
+/* Returns true if a packet was received (even if it was dropped). */
+static bool _dtls_poll(dtls d, bool is_client)
 {
   struct sockaddr_in6 remote_addr, local_addr;
   int rv;
-  char buf[2048];
+  unsigned char *buf;
   udp46 s = is_client ? d->u46_client : d->u46_server;
 
-  if ((rv = udp46_recv(s, &remote_addr, &local_addr, buf, sizeof(buf))) <= 0)
+  if ((rv = udp46_recv_nocopy(s, &remote_addr, &local_addr,
+                              (void **)&buf)) <= 0)
     {
       L_DEBUG("recvfrom did not return anything");
-      return;
+      return false;
     }
 
   _dtls_update_t(d);
+  /* Sources get their fair share first, so that a chatty one does not
+   * eat the global budget. */
+  if (!_source_allow(d, &remote_addr))
+    {
+      L_DEBUG("dropping packet due to too big pps of the source");
+      return true;
+    }
   if (d->pps++ >= DTLS_LIMIT(input_pps))
     {
       L_DEBUG("dropping packet due to too big pps (%d > %d)",
               d->pps, DTLS_LIMIT(input_pps));
-      return;
+      d->stats.num_pps_drops++;
+      return true;
     }
 
   dtls_connection dc = _connection_find(d, is_client, &remote_addr);
@@ -621,26 +1167,42 @@ static void _dtls_poll(dtls d, bool is_client)
       if (is_client)
         {
           L_DEBUG("ignoring %d bytes from unknown source on client port", rv);
-          return;
+          return true;
         }
       /* If it's server, let's make sure it is not DTLS alert to
        * already closed connection. Those have funny replay
        * properties.. */
       if (rv > 0 && buf[0] == 21)
-        return;
+        return true;
       dc = _connection_create(d, false, &remote_addr);
       if (!dc)
-        return;
+        return true;
     }
   dc->has_local_addr = true;
   dc->local_addr = local_addr;
 
-  /* Feed in the data to the BIO */
-  L_DEBUG("adding %d bytes to rbio", rv);
-  BIO_write(dc->rbio, buf, rv);
+  /* The worker may be reading the connection's datagrams right now;
+   * it gets a copy of this one once the connection is back. */
+  if (_connection_busy(dc))
+    {
+      _connection_rx_copy(dc, &dc->rx_pending, buf, rv);
+      return true;
+    }
+
+  /* Lend the data to the BIO; it is valid only until the next
+   * udp46_recv_nocopy. */
+  L_DEBUG("lending %d bytes to rbio", rv);
+  dc->rx_data = buf;
+  dc->rx_len = rv;
 
   /* Let the connection do what it feels like. */
-  _connection_poll(dc);
+  if (!_connection_poll_read(dc))
+    return true;
+
+  /* If it did not read the datagram yet, keep a copy for later. */
+  _connection_rx_keep(dc);
+  (void)_connection_poll_write(dc);
+  return true;
 }
 
 static void
@@ -649,7 +1211,7 @@ _dtls_server_cb(udp46 s __unused, void *context)
   dtls d = context;
 
   L_DEBUG("_dtls_server_cb");
-  _dtls_poll(d, false);
+  while (_dtls_poll(d, false));
 }
 
 static void
@@ -658,7 +1220,263 @@ _dtls_client_cb(udp46 s __unused, void *context)
   dtls d = context;
 
   L_DEBUG("_dtls_ufd_client_cb");
-  _dtls_poll(d, true);
+  while (_dtls_poll(d, true));
+}
+
+/* The connection is back from the worker (or the worker is gone). */
+static void _connection_unbusy(dtls_connection dc)
+{
+  dtls_queued_buffer qb, qb2;
+
+  _connection_set_busy(dc, false);
+  list_for_each_entry_safe(qb, qb2, &dc->rx_done, in_queued_buffers)
+    _qb_free(dc->d, qb);
+  list_splice_tail_init(&dc->rx_pending, &dc->rx_buffers);
+}
+
+#ifdef DTLS_HANDSHAKE_WORKER
+
+/* Set in the worker thread. */
+static __thread bool _in_worker;
+
+static void _efd_kick(int fd, uint64_t v)
+{
+  while (write(fd, &v, sizeof(v)) < 0 && errno == EINTR);
+}
+
+static void _stack_push(dtls_connection *head, dtls_connection dc)
+{
+  dtls_connection old = __atomic_load_n(head, __ATOMIC_RELAXED);
+
+  do
+    dc->next_job = old;
+  while (!__atomic_compare_exchange_n(head, &old, dc, true,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Take everything in the stack, oldest first. */
+static dtls_connection _stack_take(dtls_connection *head)
+{
+  dtls_connection l = __atomic_exchange_n(head, NULL, __ATOMIC_ACQUIRE);
+  dtls_connection r = NULL, n;
+
+  for (; l; l = n)
+    {
+      n = l->next_job;
+      l->next_job = r;
+      r = l;
+    }
+  return r;
+}
+
+static void *_worker_run(void *arg)
+{
+  dtls d = arg;
+  dtls_connection dc, next;
+  uint64_t v;
+
+  _in_worker = true;
+  while (!__atomic_load_n(&d->worker_stop, __ATOMIC_ACQUIRE))
+    {
+      if (read(d->worker_efd, &v, sizeof(v)) < 0 && errno != EINTR)
+        break;
+      for (dc = _stack_take(&d->worker_in); dc; dc = next)
+        {
+          next = dc->next_job;
+          _connection_handshake(dc);
+          _stack_push(&d->worker_out, dc);
+          _efd_kick(d->worker_done_ufd.fd, 1);
+        }
+    }
+  return NULL;
+}
+
+/* Called in the worker when certificate verification needs the
+ * unknown cert callback; it (and the rest of hnetd) lives in the main
+ * thread, so ask it there, and wait for the verdict. */
+static int _worker_verify(dtls d, X509_STORE_CTX *ctx)
+{
+  uint64_t v;
+
+  if (__atomic_load_n(&d->worker_stop, __ATOMIC_ACQUIRE))
+    return 0;
+  __atomic_store_n(&d->worker_verdict, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->worker_verify, ctx, __ATOMIC_RELEASE);
+  _efd_kick(d->worker_done_ufd.fd, 1);
+  while (read(d->worker_reply_efd, &v, sizeof(v)) < 0 && errno == EINTR);
+  return __atomic_load_n(&d->worker_verdict, __ATOMIC_ACQUIRE);
+}
+
+static int _verify_unknown_cert(dtls d, X509_STORE_CTX *ctx);
+
+static void _connection_worker_done(dtls_connection dc)
+{
+  _connection_unbusy(dc);
+  if (dc->state == STATE_SHUTDOWN)
+    {
+      /* Dropped while the worker had it; as the handshake never
+       * finished, there is nobody to say goodbye to. */
+      _connection_free(dc);
+      return;
+    }
+  dc->handshake_done = true;
+  _connection_poll(dc);
+}
+
+static void _worker_done_cb(struct uloop_fd *u, unsigned int events __unused)
+{
+  dtls d = container_of(u, dtls_s, worker_done_ufd);
+  dtls_connection dc, next;
+  X509_STORE_CTX *ctx;
+  uint64_t v;
+
+  if (read(u->fd, &v, sizeof(v)) < 0)
+    return;
+  ctx = __atomic_exchange_n(&d->worker_verify, NULL, __ATOMIC_ACQUIRE);
+  if (ctx)
+    {
+      d->stats.num_worker_verifies++;
+      __atomic_store_n(&d->worker_verdict, _verify_unknown_cert(d, ctx),
+                       __ATOMIC_RELEASE);
+      _efd_kick(d->worker_reply_efd, 1);
+    }
+  for (dc = _stack_take(&d->worker_out); dc; dc = next)
+    {
+      next = dc->next_job;
+      _connection_worker_done(dc);
+    }
+}
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+/* OpenSSL before 1.1 needs to be told how to lock. */
+static pthread_mutex_t *_ssl_locks;
+
+static void _ssl_lock_cb(int mode, int n,
+                         const char *file __unused, int line __unused)
+{
+  if (mode & CRYPTO_LOCK)
+    pthread_mutex_lock(&_ssl_locks[n]);
+  else
+    pthread_mutex_unlock(&_ssl_locks[n]);
+}
+
+static unsigned long _ssl_thread_id_cb(void)
+{
+  return (unsigned long)pthread_self();
+}
+
+static bool _ssl_threads_init(void)
+{
+  int i;
+
+  if (_ssl_locks)
+    return true;
+  if (!(_ssl_locks = calloc(CRYPTO_num_locks(), sizeof(*_ssl_locks))))
+    return false;
+  for (i = 0; i < CRYPTO_num_locks(); i++)
+    pthread_mutex_init(&_ssl_locks[i], NULL);
+  CRYPTO_set_id_callback(_ssl_thread_id_cb);
+  CRYPTO_set_locking_callback(_ssl_lock_cb);
+  return true;
+}
+#else
+#define _ssl_threads_init() true
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+
+static bool _worker_start(dtls d)
+{
+  if (d->worker_running)
+    return true;
+  if (!_ssl_threads_init())
+    return false;
+  d->worker_stop = false;
+  d->worker_efd = eventfd(0, EFD_CLOEXEC);
+  d->worker_reply_efd = eventfd(0, EFD_CLOEXEC);
+  memset(&d->worker_done_ufd, 0, sizeof(d->worker_done_ufd));
+  d->worker_done_ufd.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  d->worker_done_ufd.cb = _worker_done_cb;
+  if (d->worker_efd < 0 || d->worker_reply_efd < 0
+      || d->worker_done_ufd.fd < 0)
+    {
+      L_ERR("unable to create eventfd: %s", strerror(errno));
+      goto fail;
+    }
+  if (pthread_create(&d->worker, NULL, _worker_run, d))
+    {
+      L_ERR("unable to create handshake worker");
+      goto fail;
+    }
+  uloop_fd_add(&d->worker_done_ufd, ULOOP_READ);
+  d->worker_running = true;
+  return true;
+ fail:
+  if (d->worker_efd >= 0)
+    close(d->worker_efd);
+  if (d->worker_reply_efd >= 0)
+    close(d->worker_reply_efd);
+  if (d->worker_done_ufd.fd >= 0)
+    close(d->worker_done_ufd.fd);
+  return false;
+}
+
+/* Stop the worker. The connections it had are handed back; if finish
+ * is set, their handshakes continue in the main thread. */
+static void _worker_stop(dtls d, bool finish)
+{
+  dtls_connection dc, next;
+
+  if (!d->worker_running)
+    return;
+  __atomic_store_n(&d->worker_stop, true, __ATOMIC_SEQ_CST);
+  /* Wake it up, also if it is waiting for a verdict (if we have not
+   * given one, the certificate is rejected). */
+  _efd_kick(d->worker_efd, 1);
+  _efd_kick(d->worker_reply_efd, 1);
+  pthread_join(d->worker, NULL);
+  d->worker_running = false;
+  uloop_fd_delete(&d->worker_done_ufd);
+  close(d->worker_efd);
+  close(d->worker_reply_efd);
+  close(d->worker_done_ufd.fd);
+  d->worker_verify = NULL;
+  for (dc = _stack_take(&d->worker_out); dc; dc = next)
+    {
+      next = dc->next_job;
+      if (finish)
+        _connection_worker_done(dc);
+      else
+        _connection_unbusy(dc);
+    }
+  for (dc = _stack_take(&d->worker_in); dc; dc = next)
+    {
+      next = dc->next_job;
+      _connection_unbusy(dc);
+      if (finish)
+        _connection_poll(dc);
+    }
+}
+
+#endif /* DTLS_HANDSHAKE_WORKER */
+
+/* Hand the next handshake step to the worker, if we have one. */
+static bool _worker_post(dtls_connection dc)
+{
+#ifdef DTLS_HANDSHAKE_WORKER
+  dtls d = dc->d;
+
+  if (!d->worker_running)
+    return false;
+  /* The datagram lent to us is gone once we return. */
+  _connection_rx_keep(dc);
+  _connection_set_busy(dc, true);
+  d->stats.num_worker_handshakes++;
+  _stack_push(&d->worker_in, dc);
+  _efd_kick(d->worker_efd, 1);
+  return true;
+#else
+  (void)dc;
+  return false;
+#endif /* DTLS_HANDSHAKE_WORKER */
 }
 
 void dtls_set_readable_cb(dtls d,
@@ -674,12 +1492,17 @@ void dtls_set_unknown_cert_cb(dtls d,
 {
   d->unknown_cb = cb;
   d->unknown_cb_context = cb_context;
+  /* Resumed sessions would skip the callback, so later verdicts
+   * would not apply to peers seen already. */
+  if (cb)
+    dtls_set_session_resumption(d, false);
 }
 
 /* Create/destroy instance. */
 dtls dtls_create(uint16_t port)
 {
   dtls d = calloc(1, sizeof(*d));
+  int i;
 
   if (!_ssl_initialized)
     {
@@ -689,9 +1512,13 @@ dtls dtls_create(uint16_t port)
     }
   if (!d)
     goto fail;
+  INIT_LIST_HEAD(&d->connections);
+  for (i = 0; i < CONNECTION_HASH_SIZE; i++)
+    INIT_LIST_HEAD(&d->connection_hash[i]);
+  INIT_LIST_HEAD(&d->sessions);
+  INIT_LIST_HEAD(&d->free_buffers);
   if (!(d->u46_server = udp46_create(port)))
     goto fail;
-  INIT_LIST_HEAD(&d->connections);
 
   if (!(d->u46_client = udp46_create(0)))
     goto fail;
@@ -713,6 +1540,8 @@ dtls dtls_create(uint16_t port)
   SSL_CTX_set_cookie_verify_cb(ctx, _cookie_verify_cb);
   RAND_bytes(d->cookie_secret, COOKIE_SECRET_LENGTH);
 #endif /* DTLS_OPENSSL */
+  SSL_CTX_set_session_id_context(ctx, (void *)SESSION_ID_CONTEXT,
+                                 strlen(SESSION_ID_CONTEXT));
   d->ssl_server_ctx = ctx;
 
 #ifndef USE_ONE_CONTEXT
@@ -743,11 +1572,67 @@ void dtls_set_limits(dtls d, dtls_limits limits)
   d->limits = *limits;
 }
 
+void dtls_set_session_resumption(dtls d, bool enabled)
+{
+  dtls_cached_session cs, cs2;
+
+  d->disable_session_resumption = !enabled;
+  if (enabled)
+    {
+      SSL_CTX_set_session_cache_mode(d->ssl_server_ctx,
+                                     SSL_SESS_CACHE_SERVER);
+      SSL_CTX_clear_options(d->ssl_server_ctx, SSL_OP_NO_TICKET);
+      return;
+    }
+  SSL_CTX_set_session_cache_mode(d->ssl_server_ctx, SSL_SESS_CACHE_OFF);
+  SSL_CTX_set_options(d->ssl_server_ctx, SSL_OP_NO_TICKET);
+  list_for_each_entry_safe(cs, cs2, &d->sessions, in_sessions)
+    _session_free(d, cs);
+}
+
+bool dtls_set_handshake_worker(dtls d, bool enabled)
+{
+#ifdef DTLS_HANDSHAKE_WORKER
+  if (enabled)
+    return _worker_start(d);
+  _worker_stop(d, true);
+  return true;
+#else
+  return !enabled;
+#endif /* DTLS_HANDSHAKE_WORKER */
+}
+
+void dtls_get_stats(dtls d, dtls_stats stats)
+{
+  *stats = d->stats;
+  stats->queued_bytes = d->queued_bytes;
+}
+
+int dtls_get_source_stats(dtls d, dtls_source_stats stats, int max)
+{
+  int i, n = 0;
+
+  for (i = 0; i < SOURCE_TABLE_SIZE && n < max; i++)
+    {
+      dtls_source ds = &d->sources[i];
+
+      if (!ds->used)
+        continue;
+      stats[n].addr = ds->addr;
+      stats[n].num_packets = ds->num_packets;
+      stats[n].num_drops = ds->num_drops;
+      n++;
+    }
+  return n;
+}
+
 
 void dtls_start(dtls d)
 {
   if (d->started) return;
   d->started = true;
+  SSL_CTX_sess_set_cache_size(d->ssl_server_ctx,
+                              DTLS_LIMIT(num_cached_sessions));
   udp46_set_readable_cb(d->u46_server, _dtls_server_cb, d);
   udp46_set_readable_cb(d->u46_client, _dtls_client_cb, d);
 }
@@ -755,7 +1640,12 @@ void dtls_start(dtls d)
 void dtls_destroy(dtls d)
 {
   dtls_connection dc, dc2;
+  dtls_cached_session cs, cs2;
+  dtls_queued_buffer qb, qb2;
 
+#ifdef DTLS_HANDSHAKE_WORKER
+  _worker_stop(d, false);
+#endif /* DTLS_HANDSHAKE_WORKER */
   if (d->psk)
     free(d->psk);
   SSL_CTX_free(d->ssl_server_ctx);
@@ -764,6 +1654,10 @@ void dtls_destroy(dtls d)
 #endif /* USE_ONE_CONTEXT */
   list_for_each_entry_safe(dc, dc2, &d->connections, in_connections)
     _connection_free(dc);
+  list_for_each_entry_safe(cs, cs2, &d->sessions, in_sessions)
+    _session_free(d, cs);
+  list_for_each_entry_safe(qb, qb2, &d->free_buffers, in_queued_buffers)
+    free(qb);
   udp46_destroy(d->u46_server);
   udp46_destroy(d->u46_client);
   free(d);
@@ -781,6 +1675,8 @@ ssize_t dtls_recv(dtls d,
   d->readable = false;
   list_for_each_entry(dc, &d->connections, in_connections)
     {
+      if (_connection_busy(dc))
+        continue;
       ssize_t rv = SSL_read(dc->ssl, buf, len);
       if (rv > 0)
         {
@@ -838,15 +1734,10 @@ ssize_t dtls_send(dtls d,
       if (!dc)
         return -1;
     }
-  dtls_queued_buffer qb = calloc(1, sizeof(*qb) + len);
+  dtls_queued_buffer qb = _qb_alloc(d, buf, len);
   if (!qb)
-    {
-      L_ERR("calloc qbuf");
-      return -1;
-    }
-  memcpy(qb->buf, buf, len);
-  qb->len = len;
-  list_add(&qb->in_queued_buffers, &dc->queued_buffers);
+    return -1;
+  list_add_tail(&qb->in_queued_buffers, &dc->queued_buffers);
   return len;
 }
 
@@ -861,23 +1752,8 @@ ssize_t dtls_send(dtls d,
         }                                               \
     } while(0)
 
-static int _verify_cert_cb(int ok, X509_STORE_CTX *ctx)
+static int _verify_unknown_cert(dtls d, X509_STORE_CTX *ctx)
 {
-  dtls d = CRYPTO_get_ex_data(&ctx->ctx->ex_data, 0);
-
-  if (!d)
-    {
-      L_ERR("unable to find dtls instance");
-      return 0;
-    }
-
-  /* If OpenSSL says it is ok, not much to add. */
-  if (ok)
-    {
-      L_DEBUG("certificate ok according to SSL library");
-      return 1;
-    }
-
   X509 *cert = X509_STORE_CTX_get_current_cert(ctx);
 
   if (d->unknown_cb && cert)
@@ -905,6 +1781,30 @@ static int _verify_cert_cb(int ok, X509_STORE_CTX *ctx)
   return 0;
 }
 
+static int _verify_cert_cb(int ok, X509_STORE_CTX *ctx)
+{
+  dtls d = CRYPTO_get_ex_data(&ctx->ctx->ex_data, 0);
+
+  if (!d)
+    {
+      L_ERR("unable to find dtls instance");
+      return 0;
+    }
+
+  /* If OpenSSL says it is ok, not much to add. */
+  if (ok)
+    {
+      L_DEBUG("certificate ok according to SSL library");
+      return 1;
+    }
+
+#ifdef DTLS_HANDSHAKE_WORKER
+  if (_in_worker)
+    return _worker_verify(d, ctx);
+#endif /* DTLS_HANDSHAKE_WORKER */
+  return _verify_unknown_cert(d, ctx);
+}
+
 bool dtls_set_local_cert(dtls d, const char *certfile, const char *pkfile)
 {
   R1("server cert",
@@ -67,6 +67,15 @@ typedef struct {
    */
   int input_pps;
 
+  /*
+   * The input_pps is shared evenly among the sources (addresses)
+   * currently sending to us, and one more share is kept for new ones.
+   * Packets beyond a source's share are dropped; this is how many
+   * packets a source may send in a burst even if its share is
+   * smaller.
+   */
+  int input_source_burst;
+
   /*
    * How many seconds a connection can be idle before it is eliminated.
    */
@@ -82,10 +91,89 @@ typedef struct {
    */
   int num_data_connections;
 
+  /*
+   * Maximum number of sessions kept around for resumption (both of
+   * our own client connections, and of peers' ones in the server
+   * session cache)
+   */
+  int num_cached_sessions;
+
+  /*
+   * Maximum number of bytes held in queued buffers; outbound data
+   * waiting for a connection to finish, and received datagrams not
+   * yet consumed by their connection. Sends fail, and received
+   * packets are dropped, while at the limit.
+   */
+  int max_queued_bytes;
+
 } dtls_limits_s, *dtls_limits;
 
 void dtls_set_limits(dtls d, dtls_limits limits);
 
+/*
+ * Session resumption is enabled by default; a client connection to a
+ * peer we have had connection with before offers the old session, and
+ * if the peer still has it, the (expensive) certificate exchange and
+ * key agreement are skipped. Note that peer certificate verification
+ * (including the unknown cert callback) is therefore not repeated for
+ * resumed sessions; setting the unknown cert callback turns resumption
+ * off (it may be turned back on afterwards, if verdicts never change).
+ */
+void dtls_set_session_resumption(dtls d, bool enabled);
+
+/*
+ * Run the handshakes (the expensive public key operations in them, in
+ * particular) in a separate worker thread, so that e.g. many peers
+ * reconnecting at once do not stall the main loop. Established
+ * connections are handed back, and all data is still processed in the
+ * main thread; so are the unknown cert callbacks. Disabled by default;
+ * returns false if it cannot be enabled (e.g. no threads).
+ */
+bool dtls_set_handshake_worker(dtls d, bool enabled);
+
+typedef struct {
+  /* Number of handshakes completed in full, and by resuming session. */
+  int num_full_handshakes;
+  int num_resumed_handshakes;
+
+  /* Received datagrams that had to be copied to a queued buffer, as
+   * their connection did not consume them straight from the receive
+   * buffer. */
+  int num_rx_copies;
+
+  /* Queued buffers taken from the pool, and allocated anew. */
+  int num_pool_hits;
+  int num_pool_misses;
+
+  /* Sends and received datagrams dropped due to max_queued_bytes. */
+  int num_queue_drops;
+
+  /* Bytes currently in queued buffers. */
+  int queued_bytes;
+
+  /* Packets dropped due to the per-source, and the global, pps
+   * limit. */
+  int num_source_drops;
+  int num_pps_drops;
+
+  /* Handshake steps run in the worker thread, and certificates it
+   * had verified by the main thread. */
+  int num_worker_handshakes;
+  int num_worker_verifies;
+} dtls_stats_s, *dtls_stats;
+
+void dtls_get_stats(dtls d, dtls_stats stats);
+
+typedef struct {
+  struct in6_addr addr;
+  int num_packets;
+  int num_drops;
+} dtls_source_stats_s, *dtls_source_stats;
+
+/* Get the stats of up to max of the sources tracked for rate
+ * limiting; returns the number of sources filled in. */
+int dtls_get_source_stats(dtls d, dtls_source_stats stats, int max);
+
 
 /* Callback to call when dtls has new data. */
 void dtls_set_readable_cb(dtls d, dtls_readable_cb cb, void *cb_context);
@@ -106,7 +194,8 @@ bool dtls_set_verify_locations(dtls d, const char *path, const char *dir);
 
 /* Authentication scheme 3 - instead of using PKI, declare verdicts on
  * certificates on our own. The return value of 'true' from the
- * callback indicates we trust a certificate. */
+ * callback indicates we trust a certificate. This disables session
+ * resumption, so that every handshake asks for the current verdict. */
 void dtls_set_unknown_cert_cb(dtls d, dtls_unknown_cb cb, void *cb_context);
 
 
@@ -13,6 +13,7 @@
 
 #include "hncp_i.h"
 #include "hncp_io.h"
+#include "md5_mb.h"
 
 #include <libubox/md5.h>
 
@@ -42,6 +43,12 @@ static void hncp_hash_md5(const void *buf, size_t len, void *dest)
   md5_end(dest, &ctx);
 }
 
+static void hncp_hash_md5_multi(int n, const void * const *bufs,
+                                const size_t *lens, void * const *dsts)
+{
+  md5_mb_hash(n, bufs, lens, dsts);
+}
+
 
 static struct tlv_attr *
 hncp_validate_node_data(dncp_node n, struct tlv_attr *a)
@@ -170,6 +177,8 @@ bool hncp_init(hncp o)
         .trickle_k = HNCP_TRICKLE_K,
         .keepalive_interval = HNCP_KEEPALIVE_INTERVAL,
         .maximum_multicast_size = HNCP_MAXIMUM_MULTICAST_SIZE,
+        .maximum_unicast_size = HNCP_MAXIMUM_UNICAST_SIZE,
+        .segment_network_state = true,
 
         /* TBD - should this be true or not? hmm. if so, we would have
          * to turn it off _for every link_ when dtls is enabled. */
@@ -177,15 +186,19 @@ bool hncp_init(hncp o)
       },
       .node_id_length = HNCP_NI_LEN,
       .hash_length = HNCP_HASH_LEN,
-      .keepalive_multiplier_percent = HNCP_KEEPALIVE_MULTIPLIER * 100,
+      .keepalive_multiplier_percent = HNCP_KEEPALIVE_MULTIPLIER_PERCENT,
       .grace_interval = HNCP_PRUNE_GRACE_PERIOD,
       .minimum_prune_interval = HNCP_MINIMUM_PRUNE_INTERVAL,
+      .trickle_slack = HNCP_TRICKLE_SLACK,
       .ext_node_data_size = sizeof(hncp_node_s),
-      .ext_ep_data_size = sizeof(hncp_ep_s)
+      .ext_ep_data_size = sizeof(hncp_ep_s),
+      .sync_summary_cells = HNCP_SYNC_SUMMARY_CELLS,
+      .node_data_delta = true
     },
     .cb = {
       /* Rest of callbacks are populated in the hncp_io_init */
       .hash = hncp_hash_md5,
+      .hash_multi = hncp_hash_md5_multi,
       .validate_node_data = hncp_validate_node_data,
       .handle_collision = hncp_handle_collision_randomly
     }
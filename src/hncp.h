@@ -43,7 +43,8 @@
 
 /* How many keep-alive periods can be missed until peer is declared M.I.A. */
 /* (Note: This CANNOT be configured) */
-#define HNCP_KEEPALIVE_MULTIPLIER 21/10
+#define HNCP_KEEPALIVE_MULTIPLIER_PERCENT 210
+#define HNCP_KEEPALIVE_MULTIPLIER (HNCP_KEEPALIVE_MULTIPLIER_PERCENT / 100.0)
 
 /* Let's assume we use 64-bit version of MD5 for the time being.. */
 #define HNCP_HASH_LEN 8
@@ -57,6 +58,10 @@
  * self. */
 #define HNCP_MINIMUM_PRUNE_INTERVAL (HNETD_TIME_PER_SECOND / 50)
 
+/* Granularity Trickle (and keep-alive) timers are rounded up to, so
+ * that ones close to each other share a wakeup. */
+#define HNCP_TRICKLE_SLACK (HNETD_TIME_PER_SECOND / 4)
+
 
 /****************************************** Other implementation definitions */
 
@@ -81,6 +86,15 @@
  * here) should work.  */
 #define HNCP_MAXIMUM_MULTICAST_SIZE (1280-40-8)
 
+/* Node state requests and replies are aggregated up to this size; no
+ * point in fragmenting them either. */
+#define HNCP_MAXIMUM_UNICAST_SIZE HNCP_MAXIMUM_MULTICAST_SIZE
+
+/* Set reconciliation summary size; with 3 hash functions, this
+ * should decode differences of up to ~20 nodes. The summary is used
+ * only if it is smaller than the full network state. */
+#define HNCP_SYNC_SUMMARY_CELLS 12
+
 /*********************************************************************** API */
 
 typedef struct hncp_struct hncp_s, *hncp;
@@ -5,6 +5,7 @@
 
 #include "dncp_i.h"
 #include "hncp_i.h"
+#include "md5_mb.h"
 #include "platform.h"
 
 #include <libubox/blobmsg_json.h>
@@ -329,6 +330,27 @@ static int hd_links(dncp o, struct blob_buf *b)
 	return 0;
 }
 
+static int hd_trickle_ep(dncp_ep_i l, struct blob_buf *b)
+{
+	hd_a(!blobmsg_add_u8(b, "adaptive", l->conf.trickle_adaptive), return -1);
+	hd_a(!blobmsg_add_u32(b, "neighbors", l->num_neighbors), return -1);
+	hd_a(!blobmsg_add_u32(b, "k", l->trickle_k), return -1);
+	hd_a(!blobmsg_add_u64(b, "imin", l->trickle_imin), return -1);
+	hd_a(!blobmsg_add_u64(b, "imax", l->trickle_imax), return -1);
+	hd_a(!blobmsg_add_u64(b, "interval", l->trickle.i), return -1);
+	hd_a(!blobmsg_add_u32(b, "sent", l->trickle.num_sent), return -1);
+	hd_a(!blobmsg_add_u32(b, "skipped", l->trickle.num_skipped), return -1);
+	return 0;
+}
+
+static int hd_trickle(dncp o, struct blob_buf *b)
+{
+	dncp_ep ep;
+	dncp_for_each_enabled_ep(o, ep)
+		hd_do_in_table(b, ep->ifname, hd_trickle_ep(container_of(ep, dncp_ep_i_s, conf), b), return -1);
+	return 0;
+}
+
 static int hd_info(dncp o, struct blob_buf *b)
 {
 	hd_a(!blobmsg_add_u64(b, "time", hd_now), return -1);
@@ -336,6 +358,82 @@ static int hd_info(dncp o, struct blob_buf *b)
 	return 0;
 }
 
+#ifdef DTLS
+static int hd_dtls_source(dtls_source_stats ss, struct blob_buf *b)
+{
+	hd_a(!blobmsg_add_string(b, "address", ADDR_REPR(&ss->addr)), return -1);
+	hd_a(!blobmsg_add_u32(b, "packets", ss->num_packets), return -1);
+	hd_a(!blobmsg_add_u32(b, "drops", ss->num_drops), return -1);
+	return 0;
+}
+
+static int hd_dtls_sources(dtls d, struct blob_buf *b)
+{
+	dtls_source_stats_s ss[64];
+	int i, n = dtls_get_source_stats(d, ss, ARRAY_SIZE(ss));
+
+	for (i = 0; i < n; i++)
+		hd_do_in_table(b, NULL, hd_dtls_source(&ss[i], b), return -1);
+	return 0;
+}
+#endif /* DTLS */
+
+static int hd_stats(dncp o, struct blob_buf *b)
+{
+	hd_a(!blobmsg_add_u32(b, "network-hash-full", o->num_network_hash_full), return -1);
+	hd_a(!blobmsg_add_u32(b, "network-hash-incremental", o->num_network_hash_incremental), return -1);
+	hd_a(!blobmsg_add_u32(b, "node-data-hash-batches", o->num_node_data_hash_batches), return -1);
+	hd_a(!blobmsg_add_u32(b, "node-data-hash-batched", o->num_node_data_hash_batched), return -1);
+	hd_a(!blobmsg_add_string(b, "hash-backend", md5_mb_get_backend_name()), return -1);
+	hd_a(!blobmsg_add_u32(b, "prune-full", o->num_prune_full), return -1);
+	hd_a(!blobmsg_add_u32(b, "prune-incremental", o->num_prune_incremental), return -1);
+	hd_a(!blobmsg_add_u32(b, "tlvs-full", o->num_tlvs_full), return -1);
+	hd_a(!blobmsg_add_u32(b, "tlvs-incremental", o->num_tlvs_incremental), return -1);
+	hd_a(!blobmsg_add_u32(b, "net-state-builds", o->num_net_state_builds), return -1);
+	hd_a(!blobmsg_add_u32(b, "net-state-sends", o->num_net_state_sends), return -1);
+	hd_a(!blobmsg_add_u32(b, "net-state-windows", o->num_net_state_windows), return -1);
+	hd_a(!blobmsg_add_u32(b, "net-state-segmented", o->num_net_state_segmented), return -1);
+	hd_a(!blobmsg_add_u32(b, "sync-sent", o->num_sync_sent), return -1);
+	hd_a(!blobmsg_add_u32(b, "sync-decoded", o->num_sync_decoded), return -1);
+	hd_a(!blobmsg_add_u32(b, "sync-failed", o->num_sync_failed), return -1);
+	hd_a(!blobmsg_add_u32(b, "node-deltas-sent", o->num_node_deltas_sent), return -1);
+	hd_a(!blobmsg_add_u32(b, "node-deltas-applied", o->num_node_deltas_applied), return -1);
+	hd_a(!blobmsg_add_u32(b, "node-deltas-failed", o->num_node_deltas_failed), return -1);
+	hd_a(!blobmsg_add_u32(b, "verified-cache-hits", o->num_verified_hits), return -1);
+	hd_a(!blobmsg_add_u32(b, "verified-cache-misses", o->num_verified_misses), return -1);
+	hd_a(!blobmsg_add_u32(b, "wakeups", o->num_wakeups), return -1);
+	hd_a(!blobmsg_add_u32(b, "wakeups-per-1000s", o->wakeups_per_1000s), return -1);
+	hd_a(!blobmsg_add_u32(b, "trickle-resets", o->num_trickle_resets), return -1);
+
+	hncp h = container_of(o->ext, hncp_s, ext);
+	udp46_send_stats_s ss;
+	udp46_get_send_stats(h->u46_server, &ss);
+	hd_a(!blobmsg_add_u32(b, "send-flushes", ss.flushes), return -1);
+	hd_a(!blobmsg_add_u32(b, "send-flushed-packets", ss.packets), return -1);
+	hd_a(!blobmsg_add_u32(b, "send-flush-syscalls", ss.syscalls), return -1);
+	hd_a(!blobmsg_add_u32(b, "send-max-batch", ss.max_batch), return -1);
+	hd_a(!blobmsg_add_u32(b, "send-failed", ss.failed), return -1);
+#ifdef DTLS
+	if (h->d) {
+		dtls_stats_s ds;
+		dtls_get_stats(h->d, &ds);
+		hd_a(!blobmsg_add_u32(b, "dtls-full-handshakes", ds.num_full_handshakes), return -1);
+		hd_a(!blobmsg_add_u32(b, "dtls-resumed-handshakes", ds.num_resumed_handshakes), return -1);
+		hd_a(!blobmsg_add_u32(b, "dtls-rx-copies", ds.num_rx_copies), return -1);
+		hd_a(!blobmsg_add_u32(b, "dtls-pool-hits", ds.num_pool_hits), return -1);
+		hd_a(!blobmsg_add_u32(b, "dtls-pool-misses", ds.num_pool_misses), return -1);
+		hd_a(!blobmsg_add_u32(b, "dtls-queue-drops", ds.num_queue_drops), return -1);
+		hd_a(!blobmsg_add_u32(b, "dtls-queued-bytes", ds.queued_bytes), return -1);
+		hd_a(!blobmsg_add_u32(b, "dtls-worker-handshakes", ds.num_worker_handshakes), return -1);
+		hd_a(!blobmsg_add_u32(b, "dtls-source-drops", ds.num_source_drops), return -1);
+		hd_a(!blobmsg_add_u32(b, "dtls-pps-drops", ds.num_pps_drops), return -1);
+		hd_a(!blobmsg_add_u32(b, "dtls-worker-verifies", ds.num_worker_verifies), return -1);
+		hd_do_in_array(b, "dtls-sources", hd_dtls_sources(h->d, b), return -1);
+	}
+#endif /* DTLS */
+	return 0;
+}
+
 platform_rpc_cb hd_cb;
 platform_rpc_main hd_main;
 
@@ -358,7 +456,9 @@ int hd_cb(struct platform_rpc_method *method, __unused const struct blob_attr *i
 	hd_now = hnetd_time();
 	hd_a(!hd_info(m->dncp, b), return -1);
 	hd_do_in_table(b, "links", hd_links(m->dncp, b), return -1);
+	hd_do_in_table(b, "trickle", hd_trickle(m->dncp, b), return -1);
 	hd_do_in_table(b, "nodes", hd_nodes(m->dncp, b), return -1);
+	hd_do_in_table(b, "stats", hd_stats(m->dncp, b), return -1);
 	return 1;
 }
 
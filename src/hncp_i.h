@@ -17,6 +17,7 @@
 #include "hncp_proto.h"
 #include "dncp_util.h"
 #include "udp46.h"
+#include "stream46.h"
 
 /* TLV handling */
 #include "prefix_utils.h"
@@ -81,9 +82,22 @@ struct hncp_struct {
   /* Server's UDP46 */
   udp46 u46_server;
 
+  /* Stream (TCP) transport for unicast, if enabled; it listens on
+   * udp_port too. */
+  stream46 stream;
+
   /* Timeout for doing 'something' in dncp_io. */
   struct uloop_timeout timeout;
 
+  /* Endpoints indexed by interface index (if known). */
+  dncp_ep *eps_by_ifindex;
+  int eps_by_ifindex_allocated;
+
+  /* Interfaces we are enabled on; the socket filter only lets
+   * through traffic received on them. */
+  int *enabled_ifindexes;
+  int num_enabled_ifindexes;
+
 #ifdef DTLS
   /* DTLS 'socket' abstraction, which actually hides two UDP sockets
    * (client and server) and N OpenSSL contexts tied to each of
@@ -116,6 +130,9 @@ struct hncp_ep_struct {
 
   /* Timeout used when joining.. */
   struct uloop_timeout join_timeout;
+
+  /* Interface index (if known; kept in sync with hncp->eps_by_ifindex) */
+  int ifindex;
 };
 
 typedef struct hncp_node_struct hncp_node_s, *hncp_node;
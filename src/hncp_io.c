@@ -35,8 +35,13 @@
 #ifdef __linux__
 #define AF_LINK AF_PACKET
 #include <linux/if_packet.h>
+#include <linux/filter.h>
 #endif /* __linux__ */
 
+/* Beyond this many interfaces, the socket filter does not look at the
+ * interface (jump offsets in classic BPF are only 8 bits). */
+#define FILTER_MAX_IFINDEXES 200
+
 static int
 _get_hwaddrs(dncp_ext ext __unused, unsigned char *buf, int buf_left)
 {
@@ -82,7 +87,211 @@ _get_hwaddrs(dncp_ext ext __unused, unsigned char *buf, int buf_left)
 static void _timeout(struct uloop_timeout *t)
 {
   hncp h = container_of(t, hncp_s, timeout);
+
+  /* Whatever is sent during one pass is sent out in one go. */
+  udp46_send_queue_start(h->u46_server);
   dncp_ext_timeout(h->dncp);
+  udp46_send_queue_flush(h->u46_server);
+}
+
+static dncp_ep _find_ep_by_ifindex(hncp h, int ifindex)
+{
+  if (ifindex <= 0 || ifindex >= h->eps_by_ifindex_allocated)
+    return NULL;
+  return h->eps_by_ifindex[ifindex];
+}
+
+static void _set_ep_ifindex(hncp h, dncp_ep ep, int ifindex)
+{
+  hncp_ep hep = dncp_ep_get_ext_data(ep);
+  dncp_ep old_ep;
+
+  if (_find_ep_by_ifindex(h, hep->ifindex) == ep)
+    h->eps_by_ifindex[hep->ifindex] = NULL;
+  hep->ifindex = 0;
+  if (ifindex <= 0)
+    return;
+  if (ifindex >= h->eps_by_ifindex_allocated)
+    {
+      int nlen = ifindex * 2 + 4;
+      void *buf = realloc(h->eps_by_ifindex, nlen * sizeof(*h->eps_by_ifindex));
+      if (!buf)
+        return;
+      h->eps_by_ifindex = buf;
+      memset(h->eps_by_ifindex + h->eps_by_ifindex_allocated, 0,
+             (nlen - h->eps_by_ifindex_allocated)
+             * sizeof(*h->eps_by_ifindex));
+      h->eps_by_ifindex_allocated = nlen;
+    }
+  if ((old_ep = h->eps_by_ifindex[ifindex]))
+    ((hncp_ep)dncp_ep_get_ext_data(old_ep))->ifindex = 0;
+  h->eps_by_ifindex[ifindex] = ep;
+  hep->ifindex = ifindex;
+}
+
+static dncp_ep _find_ep_by_scope_id(hncp h, int ifindex)
+{
+  char ifname[IFNAMSIZ];
+  dncp_ep ep;
+
+  if ((ep = _find_ep_by_ifindex(h, ifindex)))
+    return ep;
+  if (!if_indextoname(ifindex, ifname))
+    {
+      L_ERR("unable to receive - if_indextoname:%s", strerror(errno));
+      return NULL;
+    }
+  if ((ep = dncp_find_ep_by_name(h->dncp, ifname)))
+    _set_ep_ifindex(h, ep, ifindex);
+  return ep;
+}
+
+static void _update_filter(hncp h);
+
+/* The interface enabled as old_ifindex is now ifindex (or gone if 0). */
+static void _replace_enabled_ifindex(hncp h, int old_ifindex, int ifindex)
+{
+  int i;
+
+  for (i = 0 ; i < h->num_enabled_ifindexes ; i++)
+    if (h->enabled_ifindexes[i] == old_ifindex)
+      break;
+  if (i == h->num_enabled_ifindexes)
+    return;
+  if (ifindex)
+    h->enabled_ifindexes[i] = ifindex;
+  else
+    h->enabled_ifindexes[i] =
+      h->enabled_ifindexes[--h->num_enabled_ifindexes];
+  _update_filter(h);
+}
+
+void hncp_io_set_ifindex(hncp h, const char *ifname, int ifindex)
+{
+  dncp_ep ep = _find_ep_by_ifindex(h, ifindex);
+  int i;
+
+  if (ep && (!ifname || strcmp(ep->ifname, ifname)))
+    _set_ep_ifindex(h, ep, 0);
+  if (!ifname)
+    {
+      _replace_enabled_ifindex(h, ifindex, 0);
+      return;
+    }
+  /* If we knew the interface by some other index, update it. Unknown
+   * ones are looked up when they are first needed. */
+  for (i = 0 ; i < h->eps_by_ifindex_allocated ; i++)
+    if ((ep = h->eps_by_ifindex[i]) && !strcmp(ep->ifname, ifname))
+      {
+        if (i != ifindex)
+          {
+            _set_ep_ifindex(h, ep, ifindex);
+            _replace_enabled_ifindex(h, i, ifindex);
+          }
+        break;
+      }
+}
+
+void hncp_io_set_carrier(hncp h, const char *ifname, bool up)
+{
+  dncp_ep ep = dncp_find_ep_by_name(h->dncp, ifname);
+
+  if (ep)
+    dncp_ext_ep_carrier(ep, up);
+}
+
+#ifdef SO_ATTACH_FILTER
+
+#define _FILTER_STMT(c, k) (struct sock_filter)BPF_STMT(c, k)
+#define _FILTER_JUMP(c, k, jt, jf) (struct sock_filter)BPF_JUMP(c, k, jt, jf)
+
+static void _attach_filter(int fd, struct sock_filter *f, int len)
+{
+  struct sock_fprog prog = { .len = len, .filter = f };
+
+  if (fd >= 0
+      && setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+    L_ERR("unable to attach socket filter - setsockopt:%s", strerror(errno));
+}
+
+/* Have the kernel drop traffic that _recv would drop anyway, before it
+ * is copied out: anything received on interfaces we are not enabled
+ * on, and IPv6 multicast to other groups than ours. The checks in
+ * _recv stay, as the filter is best effort (and not there at all on
+ * other platforms). */
+static void _update_filter(hncp h)
+{
+  int n = h->num_enabled_ifindexes;
+  struct sock_filter f[FILTER_MAX_IFINDEXES + 16];
+  uint32_t *mc = (uint32_t *)&h->multicast_address;
+  int fd4, fd6, i, c = 0, c4;
+
+  if (n <= FILTER_MAX_IFINDEXES)
+    {
+      f[c++] = _FILTER_STMT(BPF_LD | BPF_W | BPF_ABS,
+                            SKF_AD_OFF + SKF_AD_IFINDEX);
+      for (i = 0 ; i < n ; i++)
+        {
+          f[c] = _FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                              h->enabled_ifindexes[i], n - i, 0);
+          c++;
+        }
+      f[c++] = _FILTER_STMT(BPF_RET | BPF_K, 0);
+    }
+  c4 = c;
+  /* The socket filter sees the UDP datagram; the IPv6 header is
+   * at SKF_NET_OFF, destination address at offset 24. */
+  f[c++] = _FILTER_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 24);
+  f[c++] = _FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xff, 0, 8);
+  for (i = 0 ; i < 4 ; i++)
+    {
+      f[c++] = _FILTER_STMT(BPF_LD | BPF_W | BPF_ABS,
+                            SKF_NET_OFF + 24 + i * 4);
+      f[c++] = _FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                            ntohl(mc[i]), 0, 7 - i * 2);
+    }
+  f[c++] = _FILTER_STMT(BPF_RET | BPF_K, 0xffffffff);
+  f[c++] = _FILTER_STMT(BPF_RET | BPF_K, 0);
+
+  udp46_get_fds(h->u46_server, &fd4, &fd6);
+  _attach_filter(fd6, f, c);
+  /* IPv4 is just limited to the interfaces. */
+  f[c4] = f[c - 2];
+  _attach_filter(fd4, f, c4 + 1);
+}
+
+#else
+
+static void _update_filter(hncp h __unused)
+{
+}
+
+#endif /* SO_ATTACH_FILTER */
+
+static void _set_ifindex_enabled(hncp h, int ifindex, bool enabled)
+{
+  int i;
+
+  for (i = 0 ; i < h->num_enabled_ifindexes ; i++)
+    if (h->enabled_ifindexes[i] == ifindex)
+      break;
+  if (enabled == (i < h->num_enabled_ifindexes))
+    return;
+  if (!enabled)
+    {
+      h->enabled_ifindexes[i] =
+        h->enabled_ifindexes[--h->num_enabled_ifindexes];
+    }
+  else
+    {
+      int *buf = realloc(h->enabled_ifindexes,
+                         (h->num_enabled_ifindexes + 1) * sizeof(*buf));
+      if (!buf)
+        return;
+      h->enabled_ifindexes = buf;
+      h->enabled_ifindexes[h->num_enabled_ifindexes++] = ifindex;
+    }
+  _update_filter(h);
 }
 
 bool
@@ -111,7 +320,10 @@ hncp_io_set_ifname_enabled(hncp h, const char *ifname, bool enabled)
       return false;
     }
   /* Yay. It succeeded(?). */
-  dncp_ext_ep_ready(dncp_find_ep_by_name(h->dncp, ifname), enabled);
+  _set_ifindex_enabled(h, ifindex, enabled);
+  dncp_ep ep = dncp_find_ep_by_name(h->dncp, ifname);
+  _set_ep_ifindex(h, ep, ifindex);
+  dncp_ext_ep_ready(ep, enabled);
   return true;
 }
 
@@ -137,7 +349,6 @@ _recv(dncp_ext ext,
 {
   hncp h = container_of(ext, hncp_s, ext);
   ssize_t r = -1;
-  char ifname[IFNAMSIZ];
   struct sockaddr_in6 *src, *dst;
   int f;
 
@@ -153,6 +364,13 @@ _recv(dncp_ext ext,
             f |= DNCP_RECV_FLAG_SECURE;
         }
 #endif /* DTLS */
+      if (r < 0 && h->stream)
+        {
+          static struct sockaddr_in6 src_store, dst_store;
+          r = stream46_recv(h->stream, &src_store, &dst_store, buf, len);
+          src = &src_store;
+          dst = &dst_store;
+        }
       if (r < 0)
         {
           static struct sockaddr_in6 src_store, dst_store;
@@ -172,15 +390,7 @@ _recv(dncp_ext ext,
           L_DEBUG("no scope id..?");
           continue;
         }
-      if (!if_indextoname(dst->sin6_scope_id, ifname))
-        {
-          L_ERR("unable to receive - if_indextoname:%s", strerror(errno));
-          continue;
-        }
-
-      *ep = dncp_find_ep_by_name(h->dncp, ifname);
-
-      if (!*ep)
+      if (!(*ep = _find_ep_by_scope_id(h, dst->sin6_scope_id)))
         continue;
 
       if (IN6_IS_ADDR_LINKLOCAL(&src->sin6_addr))
@@ -215,6 +425,7 @@ _send(dncp_ext ext, dncp_ep ep,
       void *buf, size_t len)
 {
   hncp h = container_of(ext, hncp_s, ext);
+  hncp_ep hep = dncp_ep_get_ext_data(ep);
   struct sockaddr_in6 rdst;
   ssize_t r;
 
@@ -222,7 +433,9 @@ _send(dncp_ext ext, dncp_ep ep,
     sockaddr_in6_set(&rdst, &h->multicast_address, HNCP_PORT);
   else
     rdst = *dst;
-  rdst.sin6_scope_id = if_nametoindex(ep->ifname);
+  if (!hep->ifindex)
+    _set_ep_ifindex(h, ep, if_nametoindex(ep->ifname));
+  rdst.sin6_scope_id = hep->ifindex;
 #ifdef DTLS
   if (h->d && !IN6_IS_ADDR_MULTICAST(&rdst.sin6_addr))
     {
@@ -240,6 +453,18 @@ _send(dncp_ext ext, dncp_ep ep,
     }
   else
 #endif /* DTLS */
+  /* Unicast goes over a stream connection if there is one to dst
+   * (or always, if the whole endpoint is stream only). */
+  if (h->stream && dst
+      && (ep->unicast_is_reliable_stream
+          || stream46_is_connected(h->stream, &rdst)))
+    {
+      r = stream46_send(h->stream, src, &rdst, buf, len);
+      if (r < 0)
+        L_DEBUG("stream46_send failed for %d bytes " SA6_F,
+                (int)len, SA6_D(&rdst));
+    }
+  else
     {
       r = udp46_send(h->u46_server, src, &rdst, buf, len);
       if (r >= 0 && (size_t) r != len)
@@ -261,7 +486,9 @@ static void _dtls_readable_cb(dtls d __unused, void *context)
 {
   hncp h = context;
 
+  udp46_send_queue_start(h->u46_server);
   dncp_ext_readable(h->dncp);
+  udp46_send_queue_flush(h->u46_server);
 }
 
 
@@ -277,7 +504,98 @@ void _udp46_readable_cb(udp46 s __unused, void *context)
 {
   hncp h = context;
 
+  udp46_send_queue_start(h->u46_server);
+  dncp_ext_readable(h->dncp);
+  udp46_send_queue_flush(h->u46_server);
+}
+
+static void _stream46_readable_cb(stream46 s __unused, void *context)
+{
+  hncp h = context;
+
+  udp46_send_queue_start(h->u46_server);
   dncp_ext_readable(h->dncp);
+  udp46_send_queue_flush(h->u46_server);
+}
+
+static void _stream46_peer_state_cb(stream46 s __unused,
+                                    const struct sockaddr_in6 *local,
+                                    const struct sockaddr_in6 *remote,
+                                    bool connected,
+                                    void *context)
+{
+  hncp h = context;
+  struct sockaddr_in6 l = *local, r = *remote;
+  dncp_ep ep = _find_ep_by_scope_id(h, local->sin6_scope_id);
+
+  if (!ep)
+    return;
+  L_DEBUG("stream peer " SA6_F " on %s %s", SA6_D(remote), ep->ifname,
+          connected ? "connected" : "disconnected");
+  udp46_send_queue_start(h->u46_server);
+  dncp_ext_ep_peer_state(ep, &l, &r, connected);
+  udp46_send_queue_flush(h->u46_server);
+}
+
+bool hncp_io_set_stream_enabled(hncp h, bool enabled)
+{
+  if (!enabled != !h->stream)
+    {
+      if (enabled)
+        {
+          if (!(h->stream = stream46_create(h->udp_port)))
+            return false;
+          stream46_set_readable_cb(h->stream, _stream46_readable_cb, h);
+          stream46_set_peer_state_cb(h->stream, _stream46_peer_state_cb, h);
+        }
+      else
+        {
+          stream46_destroy(h->stream);
+          h->stream = NULL;
+        }
+    }
+  return true;
+}
+
+bool hncp_io_stream_connect(hncp h, const char *ifname,
+                            const struct sockaddr_in6 *dst)
+{
+  dncp_ep ep = dncp_find_ep_by_name(h->dncp, ifname);
+  struct sockaddr_in6 rdst = *dst;
+  hncp_ep hep;
+
+  if (!h->stream || !ep)
+    return false;
+  hep = dncp_ep_get_ext_data(ep);
+  if (!hep->ifindex)
+    _set_ep_ifindex(h, ep, if_nametoindex(ep->ifname));
+  if (IN6_IS_ADDR_LINKLOCAL(&rdst.sin6_addr))
+    rdst.sin6_scope_id = hep->ifindex;
+  return stream46_connect(h->stream, &rdst);
+}
+
+bool hncp_io_stream_connect_address(hncp h, const char *ifname,
+                                    const char *address)
+{
+  struct sockaddr_in6 dst;
+  struct in6_addr a;
+  struct in_addr a4;
+
+  if (inet_pton(AF_INET6, address, &a) != 1)
+    {
+      if (inet_pton(AF_INET, address, &a4) != 1)
+        {
+          L_ERR("invalid stream peer address %s", address);
+          return false;
+        }
+      memset(&a, 0, sizeof(a));
+      a.s6_addr[10] = 0xff;
+      a.s6_addr[11] = 0xff;
+      memcpy(&a.s6_addr[12], &a4, sizeof(a4));
+    }
+  sockaddr_in6_set(&dst, &a, HNCP_PORT);
+  return hncp_io_set_stream_enabled(h, true)
+    && hncp_io_stream_connect(h, ifname, &dst);
 }
 
 pid_t hncp_run(char *argv[])
@@ -313,6 +631,11 @@ void hncp_io_uninit(hncp h)
 {
   if (h->u46_server)
     udp46_destroy(h->u46_server);
+  hncp_io_set_stream_enabled(h, false);
   /* clear the timer from uloop. */
   uloop_timeout_cancel(&h->timeout);
+  free(h->eps_by_ifindex);
+  free(h->enabled_ifindexes);
+  h->eps_by_ifindex = NULL;
+  h->eps_by_ifindex_allocated = 0;
 }
@@ -20,3 +20,25 @@ bool hncp_io_init(hncp h);
 void hncp_io_uninit(hncp h);
 
 bool hncp_io_set_ifname_enabled(hncp h, const char *ifname, bool enabled);
+
+/* Interface ifname has now index ifindex; ifname is NULL if the
+ * interface with ifindex is gone. */
+void hncp_io_set_ifindex(hncp h, const char *ifname, int ifindex);
+
+/* Interface ifname has gained or lost carrier. */
+void hncp_io_set_carrier(hncp h, const char *ifname, bool up);
+
+/* Enable (or disable) stream transport. When enabled, unicast
+ * traffic to peers with a TCP connection is sent over it; on
+ * endpoints with unicast_is_reliable_stream set, all unicast traffic
+ * is, and the connections are opened on demand. */
+bool hncp_io_set_stream_enabled(hncp h, bool enabled);
+
+/* Open stream connection to dst on the endpoint ifname. */
+bool hncp_io_stream_connect(hncp h, const char *ifname,
+                            const struct sockaddr_in6 *dst);
+
+/* Enable stream transport, and open stream connection to the HNCP
+ * port of address (IPv6 or IPv4 string) on the endpoint ifname. */
+bool hncp_io_stream_connect_address(hncp h, const char *ifname,
+                                    const char *address);
@@ -88,47 +88,50 @@ static void calculate_link(struct hncp_link *l, dncp_ep ep, bool enable)
 		L_DEBUG("hncp_link_calculate: local node advertises %d "
 			"neighbors on iface %d", (int)peercnt, (int)dncp_ep_get_id(ep));
 
-		dncp_node_for_each_tlv(dncp_get_own_node(l->dncp), c) {
-			dncp_t_neighbor cn = dncp_tlv_neighbor(l->dncp, c);
+		dncp_node own = dncp_get_own_node(l->dncp);
+		dncp_edge e;
+		for (e = dncp_node_get_edges(own); e < own->edges + own->num_edges; ++e) {
+			dncp_t_neighbor cn = e->ne;
 
-			if (!cn || cn->ep_id != dncp_ep_get_id(ep))
+			if (cn->ep_id != dncp_ep_get_id(ep))
 				continue;
 
-			dncp_node peer = dncp_find_node_by_node_id(l->dncp, dncp_tlv_get_node_id(l->dncp, cn), false);
+			dncp_node peer = e->peer ? e->peer : dncp_find_node_by_node_id(l->dncp, dncp_tlv_get_node_id(l->dncp, cn), false);
 
-			if (!peer || !peers)
+			if (!peer || !peers || !dncp_node_get_tlvs(peer))
 				continue;
 
-			bool mutual = false;
+			// Only edges with matching reverse neighbor entry have peer set
+			bool mutual = !!e->peer;
 			hncp_t_version peervertlv = NULL;
 
 			struct tlv_attr *pc;
-			dncp_node_for_each_tlv(peer, pc) {
-				if (tlv_id(pc) == HNCP_T_VERSION &&
-						tlv_len(pc) > sizeof(*peervertlv))
+			dncp_node_for_each_tlv_with_type(peer, pc, HNCP_T_VERSION)
+				if (tlv_len(pc) > sizeof(*peervertlv))
 					peervertlv = tlv_data(pc);
 
-				dncp_t_neighbor pn = dncp_tlv_neighbor(l->dncp, pc);
-				if (!pn || pn->ep_id != cn->neighbor_ep_id ||
-				    memcmp(dncp_tlv_get_node_id(l->dncp, pn), &dncp_get_own_node(l->dncp)->node_id, DNCP_NI_LEN(l->dncp)))
+			if (mutual) {
+				L_DEBUG("hncp_link_calculate: if %"PRIu32" -> neigh %s:%"PRIu32,
+						dncp_ep_get_id(ep), DNCP_STRUCT_REPR(peer->node_id), cn->neighbor_ep_id);
+				memcpy(&peers[peerpos].node_id, &peer->node_id, HNCP_NI_LEN);
+				peers[peerpos].ep_id = cn->neighbor_ep_id;
+				++peerpos;
+			}
+
+			// Peer's neighbor entries for us are adjacent
+			dncp_edge pe = dncp_node_find_edges_to(peer, &own->node_id);
+			for (; pe && pe < peer->edges + peer->num_edges &&
+					!memcmp(dncp_tlv_get_node_id(l->dncp, pe->ne), &own->node_id, DNCP_NI_LEN(l->dncp)); ++pe) {
+				if (pe->ne->ep_id != cn->neighbor_ep_id ||
+						pe->ne->neighbor_ep_id >= dncp_ep_get_id(ep))
 					continue;
 
-				if (pn->neighbor_ep_id == dncp_ep_get_id(ep)) {
-					// Matching reverse neighbor entry
-					L_DEBUG("hncp_link_calculate: if %"PRIu32" -> neigh %s:%"PRIu32,
-							dncp_ep_get_id(ep), DNCP_STRUCT_REPR(peer->node_id), pn->ep_id);
-					mutual = true;
-					memcpy(&peers[peerpos].node_id, &peer->node_id, HNCP_NI_LEN);
-					peers[peerpos].ep_id = pn->ep_id;
-					++peerpos;
-				} else if (pn->neighbor_ep_id < dncp_ep_get_id(ep)) {
-					L_WARN("hncp_link_calculate: %s links %d and %d appear to be connected",
-							ep->ifname, dncp_ep_get_id(ep), pn->neighbor_ep_id);
-
-					// Two of our links seem to be connected
-					enable = false;
-					break;
-				}
+				L_WARN("hncp_link_calculate: %s links %d and %d appear to be connected",
+						ep->ifname, dncp_ep_get_id(ep), pe->ne->neighbor_ep_id);
+
+				// Two of our links seem to be connected
+				enable = false;
+				break;
 			}
 
 			if (!enable)
@@ -232,6 +235,7 @@ struct hncp_link* hncp_link_create(dncp dncp, const struct hncp_link_config *con
 		INIT_LIST_HEAD(&l->users);
 
 		l->subscr.tlv_change_cb = cb_tlv;
+		dncp_subscriber_add_tlv_type(&l->subscr, DNCP_T_NEIGHBOR);
 		dncp_subscribe(dncp, &l->subscr);
 
 		l->iface.cb_intiface = cb_intiface;
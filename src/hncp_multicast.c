@@ -453,6 +453,8 @@ hncp_multicast hncp_multicast_create(hncp h, hncp_multicast_params p)
 	INIT_LIST_HEAD(&m->tasks);
 
 	m->subscriber.tlv_change_cb = _tlv_cb;
+	dncp_subscriber_add_tlv_type(&m->subscriber, HNCP_T_PIM_BORDER_PROXY);
+	dncp_subscriber_add_tlv_type(&m->subscriber, HNCP_T_PIM_RPA_CANDIDATE);
 	dncp_subscribe(m->dncp, &m->subscriber);
 
 	m->iface.cb_intiface = _cb_intiface;
@@ -2078,6 +2078,9 @@ hncp_pa hncp_pa_create(hncp hncp, struct hncp_link *hncp_link)
 	hp->dncp_user.node_change_cb = hpa_dncp_node_change_cb;
 	hp->dncp_user.republish_cb = hpa_dncp_republish_cb;
 	hp->dncp_user.tlv_change_cb = hpa_dncp_tlv_change_cb;
+	dncp_subscriber_add_tlv_type(&hp->dncp_user, HNCP_T_EXTERNAL_CONNECTION);
+	dncp_subscriber_add_tlv_type(&hp->dncp_user, HNCP_T_ASSIGNED_PREFIX);
+	dncp_subscriber_add_tlv_type(&hp->dncp_user, HNCP_T_ROUTER_ADDRESS);
 	dncp_subscribe(hp->dncp, &hp->dncp_user);
 
 	//Subscribe to HNCP Link
@@ -141,13 +141,11 @@ static void hncp_routing_exec(struct uloop_process *p, __unused int ret)
 		argv[4] = (char*)hc->bfs.ifname;
 		L_WARN("Router %s", DNCP_NODE_REPR(c));
 
-		struct tlv_attr *a, *a2;
-		dncp_node_for_each_tlv(c, a) {
-			hncp_t_assigned_prefix_header ap;
-			dncp_t_neighbor ne;
-			if ((ne = dncp_tlv_neighbor(dncp, a))) {
-				if (!(n = dncp_node_find_neigh_bidir(c, ne)))
-					continue; // Connection not mutual
+		dncp_edge e;
+		if (dncp_node_get_tlvs(c))
+			dncp_node_for_each_edge(c, e) { // Only mutual connections
+				dncp_t_neighbor ne = e->ne;
+				n = e->peer;
 
 				hncp_node hn = dncp_node_get_ext_data(n);
 				if (hn->bfs.next_hop || n == dncp->own_node)
@@ -158,7 +156,7 @@ static void hncp_routing_exec(struct uloop_process *p, __unused int ret)
 					dncp_ep ep = dncp_find_ep_by_id(dncp, ne->ep_id);
 					if (!ep)
 						continue;
-					dncp_tlv tlv = dncp_find_tlv(dncp, DNCP_T_NEIGHBOR, tlv_data(a), tlv_len(a));
+					dncp_tlv tlv = dncp_find_tlv(dncp, DNCP_T_NEIGHBOR, tlv_data(e->a), tlv_len(e->a));
 					dncp_neighbor neigh = tlv ? dncp_tlv_get_extra(tlv) : NULL;
 					if (neigh) {
 						hn->bfs.next_hop = &neigh->last_sa6.sin6_addr;
@@ -187,7 +185,12 @@ static void hncp_routing_exec(struct uloop_process *p, __unused int ret)
 
 				hn->bfs.hopcount = hc->bfs.hopcount + 1;
 				list_add_tail(&hn->bfs.head, &queue);
-			} else if (tlv_id(a) == HNCP_T_EXTERNAL_CONNECTION) {
+			}
+
+		struct tlv_attr *a, *a2;
+		dncp_node_for_each_tlv(c, a) {
+			hncp_t_assigned_prefix_header ap;
+			if (tlv_id(a) == HNCP_T_EXTERNAL_CONNECTION) {
 				hncp_t_delegated_prefix_header dp;
 				tlv_for_each_attr(a2, a)
 					if ((dp = hncp_tlv_dp(a2))) {
@@ -311,6 +314,11 @@ hncp_bfs hncp_routing_create(hncp hncp, const char *script, bool incremental)
 		bfs->t.cb = hncp_routing_schedule;
 		bfs->iface.cb_intaddr = hncp_routing_intaddr;
 		bfs->subscr.tlv_change_cb = hncp_routing_cb;
+		dncp_subscriber_add_tlv_type(&bfs->subscr, HNCP_T_ASSIGNED_PREFIX);
+		dncp_subscriber_add_tlv_type(&bfs->subscr, HNCP_T_DELEGATED_PREFIX);
+		dncp_subscriber_add_tlv_type(&bfs->subscr, DNCP_T_NEIGHBOR);
+		dncp_subscriber_add_tlv_type(&bfs->subscr, HNCP_T_EXTERNAL_CONNECTION);
+		dncp_subscriber_add_tlv_type(&bfs->subscr, HNCP_T_ROUTER_ADDRESS);
 		dncp_subscribe(bfs->dncp, &bfs->subscr);
 	}
 
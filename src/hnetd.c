@@ -27,6 +27,7 @@
 #include "hncp_proto.h"
 #include "hncp_link.h"
 #include "hncp_dump.h"
+#include "hncp_io.h"
 #include "platform.h"
 #include "pd.h"
 #include "dncp_trust.h"
@@ -92,6 +93,8 @@ int usage() {
 	 "\t--trust <(DTLS) path to trust consensus store file>\n"
 	 "\t--verify-path <(DTLS) path to trusted cert file>\n"
 	 "\t--verify-dir <(DTLS) path to trusted cert directory>\n"
+	 "\t--dtls-worker (DTLS handshakes in a separate thread)\n"
+	 "\t--stream (accept HNCP over TCP from stream peers)\n"
 	 "\t-M multicast_script (enables draft-pfister-homenet-multicast support)\n"
 	 );
     return(3);
@@ -153,8 +156,12 @@ int main(__unused int argc, char *argv[])
 #endif
 	const char *dtls_path = NULL;
 	const char *dtls_dir = NULL;
+#ifdef DTLS
+	bool dtls_worker = false;
+#endif
 	const char *pidfile = NULL;
 	bool strict = false;
+	bool stream = false;
 
 	enum {
 		GOL_IPPREFIX = 1000,
@@ -167,6 +174,8 @@ int main(__unused int argc, char *argv[])
 		GOL_TRUST, /* DTLS trust cache filename */
 		GOL_DIR, /* DTLS trusted cert dir */
 		GOL_PATH, /* DTLS trusted cert file path */
+		GOL_WORKER, /* DTLS handshake worker thread */
+		GOL_STREAM, /* HNCP over TCP */
 	};
 
 	struct option longopts[] = {
@@ -181,6 +190,8 @@ int main(__unused int argc, char *argv[])
 			{ "privatekey",    required_argument,      NULL,           GOL_KEY },
 			{ "verifydir",    required_argument,      NULL,           GOL_DIR },
 			{ "verifypath",    required_argument,      NULL,           GOL_PATH },
+			{ "dtls-worker",    no_argument,      NULL,           GOL_WORKER },
+			{ "stream",    no_argument,      NULL,           GOL_STREAM },
 			{ "help",	 no_argument,		 NULL,           '?' },
 			{ NULL,          0,                      NULL,           0 }
 	};
@@ -247,11 +258,19 @@ int main(__unused int argc, char *argv[])
 		case GOL_PATH:
 			dtls_path = optarg;
 			break;
+		case GOL_WORKER:
+#ifdef DTLS
+			dtls_worker = true;
+#endif
+			break;
 		case GOL_KEY:
 #ifdef DTLS
 			dtls_key = optarg;
 #endif
 			break;
+		case GOL_STREAM:
+			stream = true;
+			break;
 #ifdef DTLS
 		case GOL_CERT:
 			dtls_cert = optarg;
@@ -314,10 +333,19 @@ int main(__unused int argc, char *argv[])
 				}
 				dtls_set_unknown_cert_cb(d, dncp_trust_dtls_unknown_cb, dt);
 		}
+		if (dtls_worker && !dtls_set_handshake_worker(d, true)) {
+				L_ERR("Unable to start dtls handshake worker");
+				return 13;
+		}
 		dtls_start(d);
 #endif /* DTLS */
 	}
 
+	if (stream && !hncp_io_set_stream_enabled(h, true)) {
+		L_ERR("Unable to enable stream transport");
+		return 14;
+	}
+
 	struct hncp_link *link = hncp_link_create(hncp_get_dncp(h), &link_config);
 
 	hncp_sd sd = hncp_sd_create(h, &sd_params, link);
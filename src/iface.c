@@ -34,6 +34,7 @@
 #include "iface.h"
 #include "platform.h"
 #include "hncp_pa.h"
+#include "hncp_io.h"
 #include "dhcpv6.h"
 
 static void iface_update_dp_cb(__unused struct hncp_pa_iface_user *u,
@@ -50,6 +51,7 @@ static bool iface_discover_border(struct iface *c);
 
 static struct list_head interfaces = LIST_HEAD_INIT(interfaces);
 static struct list_head users = LIST_HEAD_INIT(users);
+static hncp hncp_p = NULL;
 static dncp dncp_p = NULL;
 static hncp_sd hncp_sd_p = NULL;
 static hncp_pa hncp_pa_p = NULL;
@@ -218,10 +220,17 @@ static void iface_link_event(struct uloop_fd *fd, __unused unsigned events)
 						resp.hdr.nlmsg_type != RTM_DELLINK))
 			continue;
 
+		// Keep the ifindex => endpoint mapping of hncp_io up to date
+		if (hncp_p && resp.hdr.nlmsg_type == RTM_DELLINK)
+			hncp_io_set_ifindex(hncp_p, NULL, resp.msg.ifi_index);
+
 		char namebuf[IF_NAMESIZE];
 		if (!if_indextoname(resp.msg.ifi_index, namebuf))
 			continue;
 
+		if (hncp_p && resp.hdr.nlmsg_type == RTM_NEWLINK)
+			hncp_io_set_ifindex(hncp_p, namebuf, resp.msg.ifi_index);
+
 		struct iface *c = iface_get(namebuf);
 		if (!c)
 			continue;
@@ -231,6 +240,10 @@ static void iface_link_event(struct uloop_fd *fd, __unused unsigned events)
 			c->carrier = up;
 			syslog(LOG_NOTICE, "carrier => %i event on %s", (int)up, namebuf);
 			iface_discover_border(c);
+
+			// Neighbors on a dead link need not time out
+			if (hncp_p)
+				hncp_io_set_carrier(hncp_p, namebuf, up);
 		}
 	} while (read > 0);
 }
@@ -288,6 +301,7 @@ int iface_init(hncp hncp, hncp_sd sd, hncp_pa hncp_pa, struct hncp_link *link, c
 	hncp_link_register(link, &link_cb);
 	hncp_pa_p = hncp_pa;
 	hncp_pa_iface_user_register(hncp_pa, &hncp_pa_cbs);
+	hncp_p = hncp;
 	dncp_p = hncp_get_dncp(hncp);
 	hncp_sd_p = sd;
 	return platform_init(hncp, hncp_pa, pd_socket);
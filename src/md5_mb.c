@@ -0,0 +1,301 @@
+/*
+ * $Id: md5_mb.c $
+ *
+ * Author: agent <agent@local>
+ *
+ * Copyright (c) 2026 agent
+ *
+ */
+
+#include "md5_mb.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <libubox/md5.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MD5_MB_HAVE_AVX2
+#endif /* __x86_64__ || __i386__ */
+
+/* Below this many buffers, the lanes would be mostly idle, and plain
+ * scalar code is faster. */
+#define MD5_MB_MIN_BUFFERS 3
+
+typedef uint32_t md5_v __attribute__((vector_size(MD5_MB_LANES * 4)));
+
+typedef void (*md5_mb_fn)(int n, const void * const *bufs,
+                          const size_t *lens, void * const *dsts);
+
+static const uint32_t _md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+  0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+  0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+  0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+  0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+  0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t _md5_r[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static const uint32_t _md5_init[4] = {
+  0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+};
+
+typedef struct {
+  const unsigned char *buf;
+  size_t len;
+
+  /* Number of blocks (including padding), and the next one to hash. */
+  size_t blocks;
+  size_t next;
+
+  /* Index of the buffer in the caller's arrays; -1 if the lane is idle. */
+  int idx;
+} _md5_lane_s, *_md5_lane;
+
+static void _md5_scalar(int n, const void * const *bufs, const size_t *lens,
+                        void * const *dsts)
+{
+  md5_ctx_t ctx;
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      md5_begin(&ctx);
+      md5_hash(bufs[i], lens[i], &ctx);
+      md5_end(dsts[i], &ctx);
+    }
+}
+
+static inline uint32_t _md5_get_le32(const unsigned char *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void _md5_put_le32(unsigned char *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void _md5_lane_start(_md5_lane l, int idx,
+                            const void * const *bufs, const size_t *lens)
+{
+  l->idx = idx;
+  if (idx < 0)
+    return;
+  l->buf = bufs[idx];
+  l->len = lens[idx];
+  /* Data, 0x80, and 64-bit length, rounded up to full blocks. */
+  l->blocks = (l->len + 8) / 64 + 1;
+  l->next = 0;
+}
+
+/* Get the next (padded) block of the lane's buffer. */
+static void _md5_lane_block(_md5_lane l, unsigned char *block)
+{
+  size_t ofs = l->next * 64;
+
+  if (ofs + 64 <= l->len)
+    {
+      memcpy(block, l->buf + ofs, 64);
+      return;
+    }
+  memset(block, 0, 64);
+  if (ofs < l->len)
+    memcpy(block, l->buf + ofs, l->len - ofs);
+  if (ofs <= l->len)
+    block[l->len - ofs] = 0x80;
+  if (l->next == l->blocks - 1)
+    {
+      uint64_t bits = (uint64_t)l->len * 8;
+      _md5_put_le32(block + 56, bits);
+      _md5_put_le32(block + 60, bits >> 32);
+    }
+}
+
+#define _MD5_ROTL(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+
+static inline __attribute__((always_inline)) void
+_md5_vector_compress(md5_v *state, const md5_v *m)
+{
+  md5_v a = state[0], b = state[1], c = state[2], d = state[3];
+  md5_v f, t;
+  int i, g;
+
+  for (i = 0; i < 64; i++)
+    {
+      switch (i / 16)
+        {
+        case 0:
+          f = d ^ (b & (c ^ d));
+          g = i;
+          break;
+        case 1:
+          f = c ^ (d & (b ^ c));
+          g = (5 * i + 1) % 16;
+          break;
+        case 2:
+          f = b ^ c ^ d;
+          g = (3 * i + 5) % 16;
+          break;
+        default:
+          f = c ^ (b | ~d);
+          g = (7 * i) % 16;
+          break;
+        }
+      t = a + f + _md5_k[i] + m[g];
+      a = d;
+      d = c;
+      c = b;
+      b = b + _MD5_ROTL(t, _md5_r[i]);
+    }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+static inline __attribute__((always_inline)) void
+_md5_vector_run(int n, const void * const *bufs, const size_t *lens,
+                void * const *dsts)
+{
+  _md5_lane_s lanes[MD5_MB_LANES];
+  unsigned char block[64];
+  md5_v state[4], m[16];
+  int i, j, next = 0, active = 0;
+
+  for (i = 0; i < MD5_MB_LANES; i++)
+    {
+      _md5_lane_start(&lanes[i], next < n ? next++ : -1, bufs, lens);
+      if (lanes[i].idx >= 0)
+        active++;
+      for (j = 0; j < 4; j++)
+        state[j][i] = _md5_init[j];
+    }
+  while (active)
+    {
+      for (i = 0; i < MD5_MB_LANES; i++)
+        {
+          if (lanes[i].idx < 0)
+            {
+              for (j = 0; j < 16; j++)
+                m[j][i] = 0;
+              continue;
+            }
+          _md5_lane_block(&lanes[i], block);
+          for (j = 0; j < 16; j++)
+            m[j][i] = _md5_get_le32(block + j * 4);
+        }
+      _md5_vector_compress(state, m);
+      for (i = 0; i < MD5_MB_LANES; i++)
+        {
+          _md5_lane l = &lanes[i];
+
+          if (l->idx < 0 || ++l->next < l->blocks)
+            continue;
+          for (j = 0; j < 4; j++)
+            {
+              _md5_put_le32((unsigned char *)dsts[l->idx] + j * 4,
+                            state[j][i]);
+              state[j][i] = _md5_init[j];
+            }
+          _md5_lane_start(l, next < n ? next++ : -1, bufs, lens);
+          if (l->idx < 0)
+            active--;
+        }
+    }
+}
+
+static void _md5_vector(int n, const void * const *bufs, const size_t *lens,
+                        void * const *dsts)
+{
+  _md5_vector_run(n, bufs, lens, dsts);
+}
+
+#ifdef MD5_MB_HAVE_AVX2
+__attribute__((target("avx2")))
+static void _md5_avx2(int n, const void * const *bufs, const size_t *lens,
+                      void * const *dsts)
+{
+  _md5_vector_run(n, bufs, lens, dsts);
+}
+#endif /* MD5_MB_HAVE_AVX2 */
+
+static struct {
+  const char *name;
+  md5_mb_fn fn;
+} _md5_mb_backends[NUM_MD5_MB_BACKEND] = {
+  [MD5_MB_BACKEND_SCALAR] = { "scalar", _md5_scalar },
+  [MD5_MB_BACKEND_VECTOR] = { "vector", _md5_vector },
+#ifdef MD5_MB_HAVE_AVX2
+  [MD5_MB_BACKEND_AVX2] = { "avx2", _md5_avx2 },
+#endif /* MD5_MB_HAVE_AVX2 */
+};
+
+static md5_mb_backend _md5_mb_backend;
+
+static bool _md5_mb_backend_available(md5_mb_backend backend)
+{
+  if (!_md5_mb_backends[backend].fn)
+    return false;
+#ifdef MD5_MB_HAVE_AVX2
+  if (backend == MD5_MB_BACKEND_AVX2)
+    {
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+    }
+#endif /* MD5_MB_HAVE_AVX2 */
+  return true;
+}
+
+bool md5_mb_set_backend(md5_mb_backend backend)
+{
+  if (backend < 0 || backend >= NUM_MD5_MB_BACKEND)
+    return false;
+  if (backend == MD5_MB_BACKEND_AUTO)
+    {
+      /* Later ones are better; vector is always available. */
+      for (backend = NUM_MD5_MB_BACKEND - 1;
+           !_md5_mb_backend_available(backend); backend--);
+    }
+  else if (!_md5_mb_backend_available(backend))
+    return false;
+  _md5_mb_backend = backend;
+  return true;
+}
+
+const char *md5_mb_get_backend_name(void)
+{
+  if (!_md5_mb_backend)
+    md5_mb_set_backend(MD5_MB_BACKEND_AUTO);
+  return _md5_mb_backends[_md5_mb_backend].name;
+}
+
+void md5_mb_hash(int n, const void * const *bufs, const size_t *lens,
+                 void * const *dsts)
+{
+  if (!_md5_mb_backend)
+    md5_mb_set_backend(MD5_MB_BACKEND_AUTO);
+  if (n < MD5_MB_MIN_BUFFERS)
+    _md5_scalar(n, bufs, lens, dsts);
+  else
+    _md5_mb_backends[_md5_mb_backend].fn(n, bufs, lens, dsts);
+}
@@ -0,0 +1,61 @@
+/*
+ * $Id: md5_mb.h $
+ *
+ * Author: agent <agent@local>
+ *
+ * Copyright (c) 2026 agent
+ *
+ */
+
+#ifndef MD5_MB_H
+#define MD5_MB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Multi-buffer MD5.
+ *
+ * Hashes a number of independent buffers in one call. The vector
+ * backends run one buffer per 32-bit lane (MD5 itself is strictly
+ * serial within a buffer), and refill a lane with the next buffer as
+ * soon as the previous one is done, so buffers of different lengths
+ * can be mixed freely.
+ *
+ * The backend is chosen at runtime based on CPU features; the scalar
+ * one is libubox md5, and is also used when there are too few buffers
+ * for the lanes to pay off.
+ */
+
+#define MD5_MB_HASH_LEN 16
+
+/* Number of lanes in the vector backends. */
+#define MD5_MB_LANES 8
+
+typedef enum {
+  MD5_MB_BACKEND_AUTO = 0,
+  MD5_MB_BACKEND_SCALAR,
+  MD5_MB_BACKEND_VECTOR, /* Whatever GCC makes of the vector extensions */
+  MD5_MB_BACKEND_AVX2,
+  NUM_MD5_MB_BACKEND
+} md5_mb_backend;
+
+/**
+ * Hash bufs[i][:lens[i]] to dsts[i] (MD5_MB_HASH_LEN bytes each) for
+ * each i < n.
+ */
+void md5_mb_hash(int n, const void * const *bufs, const size_t *lens,
+                 void * const *dsts);
+
+/**
+ * Select the backend to use. Returns false (and changes nothing) if
+ * it is not available on this CPU. AUTO picks the best one available.
+ */
+bool md5_mb_set_backend(md5_mb_backend backend);
+
+/**
+ * Get the name of the current backend.
+ */
+const char *md5_mb_get_backend_name(void);
+
+#endif /* MD5_MB_H */
@@ -30,6 +30,7 @@
 #include "hncp_dump.h"
 #include "dncp_trust.h"
 #include "hncp_pa.h"
+#include "hncp_io.h"
 
 static char backend[] = CMAKE_INSTALL_PREFIX "/sbin/hnetd-backend";
 static const char *hnetd_pd_socket = NULL;
@@ -39,6 +40,7 @@ static pid_t platform_run(char *argv[]);
 static struct uloop_fd ipcsock = { .cb = ipc_handle };
 static const char *ipcpath = "/var/run/hnetd.sock";
 static const char *ipcpath_client = "/var/run/hnetd-client%d.sock";
+static hncp hncp_p = NULL;
 static dncp dncp_p = NULL;
 static hncp_pa hncp_pa_p = NULL;
 static struct platform_rpc_method *hnet_rpc_methods[PLATFORM_RPC_MAX];
@@ -51,6 +53,7 @@ struct platform_iface {
 
 int platform_init(hncp hncp_in, hncp_pa pa, const char *pd_socket)
 {
+	hncp_p = hncp_in;
 	dncp_p = hncp_get_dncp(hncp_in);
 	hncp_pa_p = pa;
 	hnetd_pd_socket = pd_socket;
@@ -486,6 +489,8 @@ enum ipc_option {
 	OPT_ULA_DEFAULT_ROUTER,
 	OPT_KEEPALIVE_INTERVAL,
 	OPT_TRICKLE_K,
+	OPT_TRICKLE_ADAPTIVE,
+	OPT_STREAM_PEER,
 	OPT_DNSNAME,
 	OPT_MAX
 };
@@ -509,6 +514,8 @@ struct blobmsg_policy ipc_policy[] = {
 	[OPT_ULA_DEFAULT_ROUTER] = {"ula_default_router", BLOBMSG_TYPE_BOOL},
 	[OPT_KEEPALIVE_INTERVAL] = { .name = "keepalive_interval", .type = BLOBMSG_TYPE_INT32 },
 	[OPT_TRICKLE_K] = { .name = "trickle_k", .type = BLOBMSG_TYPE_INT32 },
+	[OPT_TRICKLE_ADAPTIVE] = { .name = "trickle_adaptive", .type = BLOBMSG_TYPE_BOOL },
+	[OPT_STREAM_PEER] = { .name = "stream_peer", .type = BLOBMSG_TYPE_STRING },
 	[OPT_DNSNAME] = { .name = "dnsname", .type = BLOBMSG_TYPE_STRING},
 };
 
@@ -546,7 +553,7 @@ int ipc_ifupdown(const char *method, int argc, char *const argv[])
 	char *entry;
 
 	int c, i;
-	while ((c = getopt(argc, argv, "c:dp:l:i:m:n:uk:P:4:6:D:L")) > 0) {
+	while ((c = getopt(argc, argv, "c:dp:l:i:m:n:uk:TS:P:4:6:D:L")) > 0) {
 		switch(c) {
 		case 'c':
 			blobmsg_add_string(&b, "mode", optarg);
@@ -593,6 +600,12 @@ int ipc_ifupdown(const char *method, int argc, char *const argv[])
 			if(sscanf(optarg, "%d", &i) == 1)
 				blobmsg_add_u32(&b, "trickle_k", i);
 			break;
+		case 'T':
+			blobmsg_add_u8(&b, "trickle_adaptive", 1);
+			break;
+		case 'S':
+			blobmsg_add_string(&b, "stream_peer", optarg);
+			break;
 		case 'P':
 			if(sscanf(optarg, "%d", &i) == 1)
 				blobmsg_add_u32(&b, "keepalive_interval", i);
@@ -887,8 +900,12 @@ static void ipc_handle(struct uloop_fd *fd, __unused unsigned int events)
 
 			if(iface && tb[OPT_TRICKLE_K] && (conf = dncp_find_ep_by_name(dncp_p, iface->ifname)))
 				conf->trickle_k = (int) blobmsg_get_u32(tb[OPT_TRICKLE_K]);
+			if(iface && tb[OPT_TRICKLE_ADAPTIVE] && (conf = dncp_find_ep_by_name(dncp_p, iface->ifname)))
+				conf->trickle_adaptive = blobmsg_get_bool(tb[OPT_TRICKLE_ADAPTIVE]);
 			if(iface && tb[OPT_DNSNAME] && (conf = dncp_find_ep_by_name(dncp_p, iface->ifname)))
 				strncpy(conf->dnsname, blobmsg_get_string(tb[OPT_DNSNAME]), sizeof(conf->dnsname));
+			if(iface && tb[OPT_STREAM_PEER] && !hncp_io_stream_connect_address(hncp_p, iface->ifname, blobmsg_get_string(tb[OPT_STREAM_PEER])))
+				L_WARN("unable to connect to stream peer %s on %s", blobmsg_get_string(tb[OPT_STREAM_PEER]), iface->ifname);
 
 			if (tb[OPT_IPV4SOURCE])
 				ipc_handle_v4uplink(c, tb);
@@ -27,12 +27,14 @@
 #include "iface.h"
 #include "hncp_dump.h"
 #include "hncp.h"
+#include "hncp_io.h"
 
 static struct ubus_context *ubus = NULL;
 static struct ubus_subscriber netifd;
 static uint32_t ubus_network_interface = 0;
 static uint32_t ubus_network = 0;
 static hncp_pa hncp_pa_p;
+static hncp p_hncp = NULL;
 static dncp p_dncp = NULL;
 static uint32_t timebase = 1;
 
@@ -147,6 +149,7 @@ int platform_init(hncp hncp, hncp_pa hncp_pa, const char *pd_socket)
 
 	hnetd_pd_socket = pd_socket;
 	hncp_pa_p = hncp_pa;
+	p_hncp = hncp;
 	p_dncp = hncp_get_dncp(hncp);
 	timebase = hnetd_time() / HNETD_TIME_PER_SECOND;
 	return 0;
@@ -395,6 +398,8 @@ enum {
 	DATA_ATTR_ULA_DEFAULT_ROUTER,
 	DATA_ATTR_KEEPALIVE_INTERVAL,
 	DATA_ATTR_TRICKLE_K,
+	DATA_ATTR_TRICKLE_ADAPTIVE,
+	DATA_ATTR_STREAM_PEER,
 	DATA_ATTR_DNSNAME,
 	DATA_ATTR_IP4UPLINKLIMIT,
 	DATA_ATTR_REQADDRESS,
@@ -436,6 +441,8 @@ static const struct blobmsg_policy data_attrs[DATA_ATTR_MAX] = {
 	[DATA_ATTR_ULA_DEFAULT_ROUTER] = { .name = "ula_default_router", .type = BLOBMSG_TYPE_BOOL },
 	[DATA_ATTR_KEEPALIVE_INTERVAL] = { .name = "keepalive_interval", .type = BLOBMSG_TYPE_INT32 },
 	[DATA_ATTR_TRICKLE_K] = { .name = "trickle_k", .type = BLOBMSG_TYPE_INT32 },
+	[DATA_ATTR_TRICKLE_ADAPTIVE] = { .name = "trickle_adaptive", .type = BLOBMSG_TYPE_BOOL },
+	[DATA_ATTR_STREAM_PEER] = { .name = "stream_peer", .type = BLOBMSG_TYPE_STRING },
 	[DATA_ATTR_DNSNAME] = { .name = "dnsname", .type = BLOBMSG_TYPE_STRING },
 	[DATA_ATTR_CREATED] = { .name = "created", .type = BLOBMSG_TYPE_INT32 },
 	[DATA_ATTR_IP4UPLINKLIMIT] = { .name = "ip4uplinklimit", .type = BLOBMSG_TYPE_BOOL },
@@ -1160,6 +1167,12 @@ static void platform_update(void *data, size_t len)
 		if(dtb[DATA_ATTR_TRICKLE_K] && (conf = dncp_find_ep_by_name(p_dncp, c->ifname)))
 			conf->trickle_k = (int) blobmsg_get_u32(dtb[DATA_ATTR_TRICKLE_K]);
 
+		if(dtb[DATA_ATTR_TRICKLE_ADAPTIVE] && (conf = dncp_find_ep_by_name(p_dncp, c->ifname)))
+			conf->trickle_adaptive = blobmsg_get_bool(dtb[DATA_ATTR_TRICKLE_ADAPTIVE]);
+
+		if(dtb[DATA_ATTR_STREAM_PEER] && !hncp_io_stream_connect_address(p_hncp, c->ifname, blobmsg_get_string(dtb[DATA_ATTR_STREAM_PEER])))
+			L_WARN("unable to connect to stream peer %s on %s", blobmsg_get_string(dtb[DATA_ATTR_STREAM_PEER]), c->ifname);
+
 		if(dtb[DATA_ATTR_DNSNAME] && (conf = dncp_find_ep_by_name(p_dncp, c->ifname)))
 			strncpy(conf->dnsname, blobmsg_get_string(dtb[DATA_ATTR_DNSNAME]), sizeof(conf->dnsname));
 
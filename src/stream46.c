@@ -0,0 +1,652 @@
+/*
+ * $Id: stream46.c $
+ *
+ * Author: agent <agent@local>
+ *
+ * Copyright (c) 2026 agent
+ *
+ */
+
+#include "hnetd.h"
+#include "dncp_util.h"
+#include "stream46.h"
+
+#undef __unused
+/* In linux some system includes have fields with __unused. Argh. */
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#define __unused __attribute__((unused))
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <net/if.h>
+#include <netinet/tcp.h>
+#include <ifaddrs.h>
+#include <libubox/list.h>
+#include <libubox/uloop.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif /* !MSG_NOSIGNAL */
+
+/* Each frame starts with a header: type (1 byte) and payload length
+ * (3 bytes, network byte order). */
+#define STREAM46_HEADER_LEN 4
+
+#define STREAM46_FRAME_DATA 0
+
+/* Sent first on outbound connections. Payload is the listening port
+ * of the sender (2 bytes, network byte order), or nothing if it does
+ * not have one. */
+#define STREAM46_FRAME_HELLO 1
+
+/* Largest frame payload we are willing to receive. */
+#define STREAM46_MAXIMUM_FRAME_SIZE (1 << 20)
+
+/* How much we buffer for sending on a connection before giving up
+ * on it. */
+#define STREAM46_MAXIMUM_BUFFERED (4 << 20)
+
+#define STREAM46_MAXIMUM_CONNECTIONS 64
+
+#define STREAM46_READ_SIZE 16384
+
+/* Reading from a connection stops when this much is buffered (enough
+ * for the largest frame), until the application has received some of
+ * it. */
+#define STREAM46_MAXIMUM_RX_BUFFERED \
+  (STREAM46_HEADER_LEN + STREAM46_MAXIMUM_FRAME_SIZE)
+
+typedef struct {
+  void *data;
+  size_t used;
+  size_t allocated;
+} stream46_buf_s, *stream46_buf;
+
+typedef struct {
+  struct list_head lh;
+  stream46 s;
+  struct uloop_fd ufd;
+  struct sockaddr_in6 local;
+  struct sockaddr_in6 remote;
+
+  /* Outbound connect() still in progress. */
+  bool connecting;
+
+  /* Peer state callback has been called with connected = true. */
+  bool connected;
+
+  /* Closed by peer; buffered complete frames are still received
+   * before the connection is closed. */
+  bool eof;
+
+  /* Closed; it is freed (and the peer state callback called) from
+   * the reap timeout. */
+  bool dead;
+
+  stream46_buf_s rx;
+  stream46_buf_s tx;
+} stream46_conn_s, *stream46_conn;
+
+struct stream46_struct {
+  int fd;
+  uint16_t port;
+  struct uloop_fd ufd;
+  struct list_head conns;
+  int num_conns;
+  struct uloop_timeout reap;
+  stream46_readable_cb cb;
+  void *cb_context;
+  stream46_peer_state_cb peer_state_cb;
+  void *peer_state_cb_context;
+};
+
+static bool _buf_reserve(stream46_buf b, size_t len)
+{
+  if (b->used + len > b->allocated)
+    {
+      size_t nlen = (b->used + len) * 2;
+      void *p = realloc(b->data, nlen);
+
+      if (!p)
+        return false;
+      b->data = p;
+      b->allocated = nlen;
+    }
+  return true;
+}
+
+static void _buf_consume(stream46_buf b, size_t len)
+{
+  b->used -= len;
+  memmove(b->data, b->data + len, b->used);
+}
+
+static bool _sa6_match(const struct sockaddr_in6 *a,
+                       const struct sockaddr_in6 *b)
+{
+  return a->sin6_port == b->sin6_port
+    && !memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr))
+    && (!a->sin6_scope_id || !b->sin6_scope_id
+        || a->sin6_scope_id == b->sin6_scope_id);
+}
+
+static stream46_conn _find_conn(stream46 s, const struct sockaddr_in6 *dst)
+{
+  stream46_conn c;
+
+  list_for_each_entry(c, &s->conns, lh)
+    if (!c->dead && !c->eof && _sa6_match(&c->remote, dst))
+      return c;
+  return NULL;
+}
+
+static uint32_t _scope_id_by_address(const struct in6_addr *a)
+{
+  struct ifaddrs *ia, *p;
+  uint32_t scope_id = 0;
+
+  if (getifaddrs(&ia))
+    return 0;
+  for (p = ia ; p && !scope_id ; p = p->ifa_next)
+    {
+      if (!p->ifa_addr)
+        continue;
+      if (p->ifa_addr->sa_family == AF_INET6)
+        {
+          struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)p->ifa_addr;
+          if (memcmp(&sin6->sin6_addr, a, sizeof(*a)))
+            continue;
+        }
+      else if (p->ifa_addr->sa_family == AF_INET)
+        {
+          struct sockaddr_in *sin = (struct sockaddr_in *)p->ifa_addr;
+          if (!IN6_IS_ADDR_V4MAPPED(a)
+              || memcmp(&sin->sin_addr, &a->s6_addr[12], 4))
+            continue;
+        }
+      else
+        continue;
+      scope_id = if_nametoindex(p->ifa_name);
+    }
+  freeifaddrs(ia);
+  return scope_id;
+}
+
+static void _conn_init_local(stream46_conn c)
+{
+  socklen_t len = sizeof(c->local);
+
+  if (getsockname(c->ufd.fd, (struct sockaddr *)&c->local, &len) < 0)
+    memset(&c->local, 0, sizeof(c->local));
+  if (!c->local.sin6_scope_id)
+    c->local.sin6_scope_id = c->remote.sin6_scope_id;
+  if (!c->local.sin6_scope_id)
+    c->local.sin6_scope_id = _scope_id_by_address(&c->local.sin6_addr);
+}
+
+static void _conn_update_events(stream46_conn c)
+{
+  unsigned int events = 0;
+
+  if (!c->eof && c->rx.used < STREAM46_MAXIMUM_RX_BUFFERED)
+    events |= ULOOP_READ;
+  if (c->connecting || c->tx.used)
+    events |= ULOOP_WRITE;
+  if (events)
+    uloop_fd_add(&c->ufd, events);
+  else
+    uloop_fd_delete(&c->ufd);
+}
+
+static void _conn_fail(stream46_conn c, const char *why __unused)
+{
+  if (c->dead)
+    return;
+  L_DEBUG("stream46: closing connection to " SA6_F " - %s",
+          SA6_D(&c->remote), why);
+  c->dead = true;
+  uloop_fd_delete(&c->ufd);
+  close(c->ufd.fd);
+  uloop_timeout_set(&c->s->reap, 0);
+}
+
+static void _conn_free(stream46_conn c)
+{
+  list_del(&c->lh);
+  c->s->num_conns--;
+  free(c->rx.data);
+  free(c->tx.data);
+  free(c);
+}
+
+static void _conn_set_connected(stream46_conn c)
+{
+  stream46 s = c->s;
+
+  c->connected = true;
+  L_DEBUG("stream46: connected to " SA6_F, SA6_D(&c->remote));
+  if (s->peer_state_cb)
+    s->peer_state_cb(s, &c->local, &c->remote, true,
+                     s->peer_state_cb_context);
+}
+
+static bool _conn_queue_frame(stream46_conn c, int type,
+                              const void *buf, size_t len)
+{
+  unsigned char *p;
+
+  if (len >= (1 << 24)
+      || c->tx.used + STREAM46_HEADER_LEN + len > STREAM46_MAXIMUM_BUFFERED
+      || !_buf_reserve(&c->tx, STREAM46_HEADER_LEN + len))
+    return false;
+  p = c->tx.data + c->tx.used;
+  p[0] = type;
+  p[1] = len >> 16;
+  p[2] = len >> 8;
+  p[3] = len;
+  memcpy(p + STREAM46_HEADER_LEN, buf, len);
+  c->tx.used += STREAM46_HEADER_LEN + len;
+  return true;
+}
+
+/* Is there a complete frame at the start of the receive buffer? */
+static bool _conn_get_frame(stream46_conn c, int *type, size_t *len)
+{
+  unsigned char *p = c->rx.data;
+
+  if (c->dead || c->rx.used < STREAM46_HEADER_LEN)
+    return false;
+  *type = p[0];
+  *len = p[1] << 16 | p[2] << 8 | p[3];
+  if (*len > STREAM46_MAXIMUM_FRAME_SIZE)
+    {
+      _conn_fail(c, "too large frame");
+      return false;
+    }
+  return c->rx.used >= STREAM46_HEADER_LEN + *len;
+}
+
+static bool _conn_write(stream46_conn c)
+{
+  while (c->tx.used)
+    {
+      ssize_t r = send(c->ufd.fd, c->tx.data, c->tx.used, MSG_NOSIGNAL);
+
+      if (r < 0)
+        {
+          if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            break;
+          _conn_fail(c, strerror(errno));
+          return false;
+        }
+      _buf_consume(&c->tx, r);
+    }
+  _conn_update_events(c);
+  return true;
+}
+
+static bool _conn_read(stream46_conn c)
+{
+  while (!c->eof && c->rx.used < STREAM46_MAXIMUM_RX_BUFFERED)
+    {
+      ssize_t r;
+
+      if (!_buf_reserve(&c->rx, STREAM46_READ_SIZE))
+        {
+          _conn_fail(c, "out of memory");
+          return false;
+        }
+      r = recv(c->ufd.fd, c->rx.data + c->rx.used, STREAM46_READ_SIZE, 0);
+      if (r < 0)
+        {
+          if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return true;
+          _conn_fail(c, strerror(errno));
+          return false;
+        }
+      if (!r)
+        c->eof = true;
+      c->rx.used += r;
+    }
+  return true;
+}
+
+/* Drop the frame at the start of the receive buffer. Once a
+ * connection closed by peer has no complete frames left, it can go;
+ * otherwise, reading may resume as there is room again. */
+static void _conn_consume_frame(stream46_conn c, size_t len)
+{
+  int type;
+
+  _buf_consume(&c->rx, STREAM46_HEADER_LEN + len);
+  if (c->eof)
+    {
+      if (!_conn_get_frame(c, &type, &len))
+        _conn_fail(c, "closed by peer");
+    }
+  else if (!c->dead)
+    _conn_update_events(c);
+}
+
+/* Returns true if the (outbound) connection is established. */
+static bool _conn_check_connect(stream46_conn c)
+{
+  struct sockaddr_in6 sa;
+  socklen_t len = sizeof(sa);
+  int err = 0;
+  socklen_t err_len = sizeof(err);
+
+  if (getsockopt(c->ufd.fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0)
+    err = errno;
+  if (err)
+    {
+      _conn_fail(c, strerror(err));
+      return false;
+    }
+  if (getpeername(c->ufd.fd, (struct sockaddr *)&sa, &len) < 0)
+    return false;
+  c->connecting = false;
+  _conn_init_local(c);
+  _conn_set_connected(c);
+  return true;
+}
+
+/* Handle the control frames at the start of the receive buffer. */
+static void _conn_handle_control(stream46_conn c)
+{
+  int type;
+  size_t len;
+
+  while (_conn_get_frame(c, &type, &len) && type != STREAM46_FRAME_DATA)
+    {
+      if (type == STREAM46_FRAME_HELLO && len == 2 && !c->connected)
+        {
+          unsigned char *p = c->rx.data + STREAM46_HEADER_LEN;
+          c->remote.sin6_port = htons(p[0] << 8 | p[1]);
+        }
+      _buf_consume(&c->rx, STREAM46_HEADER_LEN + len);
+      if (!c->connected)
+        _conn_set_connected(c);
+    }
+  /* Peer that does not say hello is reported as it is. */
+  if (!c->connected && _conn_get_frame(c, &type, &len))
+    _conn_set_connected(c);
+}
+
+static void _conn_cb(struct uloop_fd *u, unsigned int events __unused)
+{
+  stream46_conn c = container_of(u, stream46_conn_s, ufd);
+  stream46 s = c->s;
+  int type;
+  size_t len;
+
+  if (c->connecting && !_conn_check_connect(c))
+    return;
+  if (c->tx.used && !_conn_write(c))
+    return;
+  if (!_conn_read(c))
+    return;
+  _conn_handle_control(c);
+  if (c->dead)
+    return;
+  /* Stop reading while the receive buffer is full, or peer is gone. */
+  _conn_update_events(c);
+  if (s->cb && _conn_get_frame(c, &type, &len))
+    s->cb(s, s->cb_context);
+  else if (c->eof)
+    _conn_fail(c, "closed by peer");
+}
+
+static stream46_conn _conn_create(stream46 s, int fd,
+                                  const struct sockaddr_in6 *remote,
+                                  bool connecting)
+{
+  stream46_conn c;
+  int on = 1;
+
+  if (s->num_conns >= STREAM46_MAXIMUM_CONNECTIONS
+      || !(c = calloc(1, sizeof(*c))))
+    {
+      L_INFO("stream46: unable to add connection to " SA6_F,
+             SA6_D(remote));
+      close(fd);
+      return NULL;
+    }
+  /* Messages are small and latency matters more than efficiency. */
+  (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  c->s = s;
+  c->ufd.fd = fd;
+  c->ufd.cb = _conn_cb;
+  c->remote = *remote;
+  c->connecting = connecting;
+  list_add_tail(&c->lh, &s->conns);
+  s->num_conns++;
+  _conn_update_events(c);
+  return c;
+}
+
+static void _accept_cb(struct uloop_fd *u, unsigned int events __unused)
+{
+  stream46 s = container_of(u, stream46_s, ufd);
+
+  while (1)
+    {
+      struct sockaddr_in6 sa;
+      socklen_t len = sizeof(sa);
+      stream46_conn c;
+      int fd = accept(s->fd, (struct sockaddr *)&sa, &len);
+
+      if (fd < 0)
+        break;
+      if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+        {
+          close(fd);
+          continue;
+        }
+      if ((c = _conn_create(s, fd, &sa, false)))
+        _conn_init_local(c);
+    }
+}
+
+static void _reap_cb(struct uloop_timeout *t)
+{
+  stream46 s = container_of(t, stream46_s, reap);
+  stream46_conn c, c2;
+
+  list_for_each_entry_safe(c, c2, &s->conns, lh)
+    if (c->dead)
+      {
+        struct sockaddr_in6 local = c->local, remote = c->remote;
+        bool connected = c->connected;
+
+        _conn_free(c);
+        if (connected && s->peer_state_cb)
+          s->peer_state_cb(s, &local, &remote, false,
+                           s->peer_state_cb_context);
+      }
+}
+
+stream46 stream46_create(uint16_t port)
+{
+  stream46 s = calloc(1, sizeof(*s));
+  struct sockaddr_in6 sin6;
+  int on = 1, off = 0;
+  int fd;
+
+  if (!s)
+    return NULL;
+  INIT_LIST_HEAD(&s->conns);
+  s->fd = -1;
+  s->port = port;
+  s->reap.cb = _reap_cb;
+  if (!port)
+    return s;
+  sockaddr_in6_set(&sin6, NULL, port);
+  if ((fd = socket(PF_INET6, SOCK_STREAM, 0)) < 0)
+    perror("socket");
+  else if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+    perror("fnctl O_NONBLOCK");
+  else if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0)
+    perror("setsockopt SO_REUSEADDR");
+  else if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) < 0)
+    perror("setsockopt IPV6_V6ONLY");
+  else if (bind(fd, (struct sockaddr *)&sin6, sizeof(sin6)) < 0)
+    perror("bind");
+  else if (listen(fd, 16) < 0)
+    perror("listen");
+  else
+    {
+      s->fd = fd;
+      s->ufd.fd = fd;
+      s->ufd.cb = _accept_cb;
+      uloop_fd_add(&s->ufd, ULOOP_READ);
+      return s;
+    }
+  if (fd >= 0)
+    close(fd);
+  free(s);
+  return NULL;
+}
+
+void stream46_set_readable_cb(stream46 s, stream46_readable_cb cb,
+                              void *cb_context)
+{
+  s->cb = cb;
+  s->cb_context = cb_context;
+}
+
+void stream46_set_peer_state_cb(stream46 s, stream46_peer_state_cb cb,
+                                void *cb_context)
+{
+  s->peer_state_cb = cb;
+  s->peer_state_cb_context = cb_context;
+}
+
+bool stream46_connect(stream46 s, const struct sockaddr_in6 *dst)
+{
+  unsigned char hello[2] = { s->port >> 8, s->port & 0xFF };
+  stream46_conn c;
+  int off = 0;
+  int fd;
+
+  if (_find_conn(s, dst))
+    return true;
+  if ((fd = socket(PF_INET6, SOCK_STREAM, 0)) < 0)
+    return false;
+  if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0
+      || setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) < 0
+      || (connect(fd, (struct sockaddr *)dst, sizeof(*dst)) < 0
+          && errno != EINPROGRESS))
+    {
+      L_DEBUG("stream46: unable to connect to " SA6_F " - %s",
+              SA6_D(dst), strerror(errno));
+      close(fd);
+      return false;
+    }
+  /* Even if connect() finished already, the rest (including the peer
+   * state callback) happens from uloop. */
+  if (!(c = _conn_create(s, fd, dst, true)))
+    return false;
+  if (!_conn_queue_frame(c, STREAM46_FRAME_HELLO, hello,
+                         s->port ? sizeof(hello) : 0))
+    {
+      _conn_fail(c, "out of memory");
+      return false;
+    }
+  return true;
+}
+
+ssize_t stream46_recv(stream46 s,
+                      struct sockaddr_in6 *src,
+                      struct sockaddr_in6 *dst,
+                      void *buf, size_t buf_size)
+{
+  stream46_conn c;
+  int type;
+  size_t len;
+
+  list_for_each_entry(c, &s->conns, lh)
+    while (_conn_get_frame(c, &type, &len))
+      {
+        void *p = c->rx.data + STREAM46_HEADER_LEN;
+
+        if (type != STREAM46_FRAME_DATA || len > buf_size)
+          {
+            if (type == STREAM46_FRAME_DATA)
+              L_INFO("stream46: dropping too large (%d) message from " SA6_F,
+                     (int)len, SA6_D(&c->remote));
+            _conn_consume_frame(c, len);
+            continue;
+          }
+        memcpy(buf, p, len);
+        _conn_consume_frame(c, len);
+        if (src)
+          *src = c->remote;
+        if (dst)
+          *dst = c->local;
+        return len;
+      }
+  return -1;
+}
+
+int stream46_send(stream46 s,
+                  const struct sockaddr_in6 *src __unused,
+                  const struct sockaddr_in6 *dst,
+                  void *buf, size_t buf_size)
+{
+  stream46_conn c;
+
+  if (!stream46_connect(s, dst) || !(c = _find_conn(s, dst)))
+    return -1;
+  if (!_conn_queue_frame(c, STREAM46_FRAME_DATA, buf, buf_size))
+    {
+      _conn_fail(c, "too much buffered");
+      return -1;
+    }
+  if (!c->connecting && !_conn_write(c))
+    return -1;
+  return buf_size;
+}
+
+bool stream46_is_connected(stream46 s, const struct sockaddr_in6 *dst)
+{
+  stream46_conn c = _find_conn(s, dst);
+
+  return c && c->connected;
+}
+
+int stream46_get_num_connected(stream46 s)
+{
+  stream46_conn c;
+  int cnt = 0;
+
+  list_for_each_entry(c, &s->conns, lh)
+    if (c->connected && !c->dead)
+      cnt++;
+  return cnt;
+}
+
+void stream46_destroy(stream46 s)
+{
+  stream46_conn c, c2;
+
+  list_for_each_entry_safe(c, c2, &s->conns, lh)
+    {
+      if (!c->dead)
+        {
+          uloop_fd_delete(&c->ufd);
+          close(c->ufd.fd);
+        }
+      _conn_free(c);
+    }
+  if (s->fd >= 0)
+    {
+      uloop_fd_delete(&s->ufd);
+      close(s->fd);
+    }
+  uloop_timeout_cancel(&s->reap);
+  free(s);
+}
@@ -0,0 +1,112 @@
+/*
+ * $Id: stream46.h $
+ *
+ * Author: agent <agent@local>
+ *
+ * Copyright (c) 2026 agent
+ *
+ */
+
+#ifndef STREAM46_H
+#define STREAM46_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/**
+ * This module provides message-oriented API on top of TCP
+ * connections, with roughly the same API as udp46: messages are sent
+ * to, and received from, sockaddr_in6's (IPv4 peers are represented
+ * as IPv4-mapped IPv6 addresses).
+ *
+ * Underneath, there is a listening socket, and a set of connections
+ * to peers; each message is sent as a length-prefixed frame on the
+ * connection to the destination, which is created on demand if it
+ * does not exist yet.
+ *
+ * The connecting side announces its listening port when it connects,
+ * so messages from a peer appear to come from the peer's listening
+ * port regardless of which side initiated the connection. Therefore
+ * replying to the source of a message (or sending to the source of
+ * an udp46 packet from the same peer) reuses the connection.
+ */
+
+typedef struct stream46_struct *stream46, stream46_s;
+
+/**
+ * Create a new instance, listening on the given port (or on none if
+ * port is zero, in which case only outbound connections work).
+ */
+stream46 stream46_create(uint16_t port);
+
+typedef void (*stream46_readable_cb)(stream46 s, void *context);
+
+/**
+ * Set up callback to call when there is a message available. (It
+ * leverages uloop+ufd internally.) The callback should keep
+ * receiving until -1 is returned.
+ */
+void stream46_set_readable_cb(stream46 s, stream46_readable_cb cb,
+                              void *cb_context);
+
+typedef void (*stream46_peer_state_cb)(stream46 s,
+                                       const struct sockaddr_in6 *local,
+                                       const struct sockaddr_in6 *remote,
+                                       bool connected,
+                                       void *context);
+
+/**
+ * Set up callback to call when a connection to a peer becomes usable,
+ * or is lost. The scope id of local is set to the index of the
+ * interface the connection is on, if known.
+ */
+void stream46_set_peer_state_cb(stream46 s, stream46_peer_state_cb cb,
+                                void *cb_context);
+
+/**
+ * Open connection to dst, unless one exists already.
+ */
+bool stream46_connect(stream46 s, const struct sockaddr_in6 *dst);
+
+/**
+ * Receive a message.
+ *
+ * -1 is returned if no message is available. src and dst are
+ * optional. Messages larger than buf_size are dropped.
+ */
+ssize_t stream46_recv(stream46 s,
+                      struct sockaddr_in6 *src,
+                      struct sockaddr_in6 *dst,
+                      void *buf, size_t buf_size);
+
+/**
+ * Send a message to dst (src is ignored; the connection determines
+ * it). The message is buffered if the connection is not writable
+ * right now; -1 is returned if the connection cannot be opened, or
+ * too much is already buffered on it (in which case it is closed).
+ **/
+int stream46_send(stream46 s,
+                  const struct sockaddr_in6 *src,
+                  const struct sockaddr_in6 *dst,
+                  void *buf, size_t buf_size);
+
+/**
+ * Is there a usable connection to dst?
+ */
+bool stream46_is_connected(stream46 s, const struct sockaddr_in6 *dst);
+
+/**
+ * Get the number of connections that are currently usable.
+ */
+int stream46_get_num_connected(stream46 s);
+
+/**
+ * Destroy the instance, and close all connections (without calling
+ * the peer state callback).
+ */
+void stream46_destroy(stream46 s);
+
+#endif /* STREAM46_H */
@@ -28,6 +28,77 @@
 
 #define DEBUG(...) L_DEBUG(__VA_ARGS__)
 
+/* Largest possible (non-jumbo) datagram. */
+#define UDP46_MAX_DATAGRAM 65536
+
+#ifdef MSG_WAITFORONE
+/* recvmmsg is available (it was added together with MSG_WAITFORONE) */
+#define UDP46_RECV_BATCH 16
+/* Enough for anything that fits in an Ethernet MTU. */
+#define UDP46_RECV_SLOT_SIZE 2048
+#define UDP46_RECV_CONTROL_SIZE 256
+
+typedef struct {
+  struct sockaddr_storage src;
+  /* The slot, and its overflow region. */
+  struct iovec iov[2];
+  uint8_t control[UDP46_RECV_CONTROL_SIZE];
+  /* Where the payload is; NULL if it could not be stored. */
+  void *data;
+  /* Copy of the last datagram that did not fit in the slot. */
+  void *large;
+  size_t large_allocated;
+} udp46_rx_slot_s, *udp46_rx_slot;
+
+/* Rest of datagrams larger than the slots is received here, in the
+ * overflow region of the slot. It is shared by all instances, as it
+ * is copied out right after receiving; its pages take memory only
+ * once large datagrams have been received to them. */
+static uint8_t _rx_overflow[UDP46_RECV_BATCH]
+[UDP46_MAX_DATAGRAM - UDP46_RECV_SLOT_SIZE];
+#endif /* MSG_WAITFORONE */
+
+#define UDP46_SEND_CONTROL_SIZE 64
+
+/* Queue is flushed early rather than grown beyond this many packets
+ * (or bytes). */
+#define UDP46_SEND_QUEUE_MAXIMUM 64
+#define UDP46_SEND_QUEUE_MAXIMUM_BYTES (256 * 1024)
+
+/* Queued data buffer larger than this is freed after flush. */
+#define UDP46_SEND_QUEUE_KEEP_BYTES (64 * 1024)
+
+#if defined(MSG_WAITFORONE) && (!defined(__GLIBC__) || __GLIBC__ > 2 \
+                                 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 14))
+/* sendmmsg is available (glibc got it later than recvmmsg) */
+#define UDP46_SEND_BATCH
+#endif /* MSG_WAITFORONE && .. */
+
+/* Queued packet */
+typedef struct {
+  struct sockaddr_in6 src;
+  struct sockaddr_in6 dst;
+  bool has_src;
+  size_t offset;
+  size_t len;
+} udp46_tx_s, *udp46_tx;
+
+/* Per-packet state needed while flushing the queue */
+typedef struct {
+  struct iovec iov;
+  struct sockaddr_in sin;
+  uint8_t control[UDP46_SEND_CONTROL_SIZE];
+  int sock;
+} udp46_tx_slot_s, *udp46_tx_slot;
+
+#ifdef UDP46_SEND_BATCH
+typedef struct mmsghdr udp46_mmsghdr_s;
+#else
+typedef struct {
+  struct msghdr msg_hdr;
+} udp46_mmsghdr_s;
+#endif /* UDP46_SEND_BATCH */
+
 struct udp46_struct {
   int s4;
   int s6;
@@ -35,6 +106,38 @@ struct udp46_struct {
   struct uloop_fd ufds[2];
   udp46_readable_cb cb;
   void *cb_context;
+
+  /* Sends are queued while tx_depth > 0. */
+  int tx_depth;
+  udp46_tx tx;
+  int tx_count;
+  int tx_allocated;
+  void *tx_data;
+  size_t tx_data_used;
+  size_t tx_data_allocated;
+
+  /* Flush state; tx_msgs_allocated of each. */
+  udp46_mmsghdr_s *tx_msgs;
+  udp46_tx_slot tx_slots;
+  int tx_msgs_allocated;
+
+  udp46_send_stats_s send_stats;
+
+  /* Receive buffer for udp46_recv_nocopy without a batch ring. */
+  void *rx_one;
+
+#ifdef UDP46_RECV_BATCH
+  /* Which of the sockets (s6, s4) may have something to read. Only
+   * used if readable callback is set; otherwise, both are tried. */
+  bool maybe_readable[2];
+
+  /* Ring of received, but not yet consumed packets. */
+  struct mmsghdr *rx_msgs;
+  udp46_rx_slot rx_slots;
+  void *rx_buf;
+  int rx_count;
+  int rx_pos;
+#endif /* UDP46_RECV_BATCH */
 };
 
 static int init_listening_socket(int pf, uint16_t port, uint16_t oport)
@@ -148,32 +251,12 @@ void udp46_get_fds(udp46 s, int *fd1, int *fd2)
     *fd2 = s->s6;
 }
 
-ssize_t udp46_recv(udp46 s,
-                   struct sockaddr_in6 *src,
-                   struct sockaddr_in6 *dst,
-                   void *buf, size_t buf_size)
+/* Convert the source address and figure the destination address of
+ * a received message. */
+static ssize_t _recv_msg(udp46 s, struct msghdr *msg, ssize_t l,
+                         struct sockaddr_in6 *src,
+                         struct sockaddr_in6 *dst)
 {
-  struct iovec iov[1] = {
-    {.iov_base = buf,
-     .iov_len = buf_size },
-  };
-  uint8_t c[1000];
-  struct msghdr msg = {
-    .msg_iov = iov,
-    .msg_iovlen = sizeof(iov) / sizeof(*iov),
-    .msg_name = src,
-    .msg_namelen = src ? sizeof(*src) : 0,
-    .msg_flags = 0,
-    .msg_control = c,
-    .msg_controllen = sizeof(c)
-  };
-  ssize_t l;
-
-  /* If we can't find a packet on IPv4 or IPv6 socket, return -1. */
-  if ((l = recvmsg(s->s6, &msg, 0)) < 0)
-    if ((l = recvmsg(s->s4, &msg, 0)) < 0)
-      return -1;
-
   /* Convert source address to IPv6 if it already isn't */
   if (src && src->sin6_family != AF_INET6)
     {
@@ -195,8 +278,8 @@ ssize_t udp46_recv(udp46 s,
   /* Iterate through the message headers looking for destination
    * address, and if finding it, return it (in dst, as V4 mapped if
    * need be). */
-  for (h = CMSG_FIRSTHDR(&msg); h;
-       h = CMSG_NXTHDR(&msg, h))
+  for (h = CMSG_FIRSTHDR(msg); h;
+       h = CMSG_NXTHDR(msg, h))
     if (h->cmsg_level == IPPROTO_IPV6
         && h->cmsg_type == IPV6_PKTINFO)
       {
@@ -229,55 +312,290 @@ ssize_t udp46_recv(udp46 s,
   return -1;
 }
 
-int udp46_send_iovec(udp46 s,
-                     const struct sockaddr_in6 *src,
-                     const struct sockaddr_in6 *dst,
-                     struct iovec *iov, int iov_len)
+static ssize_t _recv_one(udp46 s,
+                        struct sockaddr_in6 *src,
+                        struct sockaddr_in6 *dst,
+                        void *buf, size_t buf_size)
+{
+  struct iovec iov[1] = {
+    {.iov_base = buf,
+     .iov_len = buf_size },
+  };
+  uint8_t c[1000];
+  struct msghdr msg = {
+    .msg_iov = iov,
+    .msg_iovlen = sizeof(iov) / sizeof(*iov),
+    .msg_name = src,
+    .msg_namelen = src ? sizeof(*src) : 0,
+    .msg_flags = 0,
+    .msg_control = c,
+    .msg_controllen = sizeof(c)
+  };
+  ssize_t l;
+
+  /* If we can't find a packet on IPv4 or IPv6 socket, return -1. */
+  if ((l = recvmsg(s->s6, &msg, 0)) < 0)
+    if ((l = recvmsg(s->s4, &msg, 0)) < 0)
+      return -1;
+
+  return _recv_msg(s, &msg, l, src, dst);
+}
+
+static void _flush(udp46 s);
+
+#ifdef UDP46_RECV_BATCH
+
+static bool _rx_init(udp46 s)
+{
+  int i;
+
+  /* The slots are MTU sized; larger datagrams continue in the
+   * overflow region of the slot, and are copied out from there. */
+  s->rx_msgs = calloc(UDP46_RECV_BATCH, sizeof(*s->rx_msgs));
+  s->rx_slots = calloc(UDP46_RECV_BATCH, sizeof(*s->rx_slots));
+  s->rx_buf = malloc(UDP46_RECV_BATCH * UDP46_RECV_SLOT_SIZE);
+  if (!s->rx_msgs || !s->rx_slots || !s->rx_buf)
+    {
+      free(s->rx_msgs);
+      free(s->rx_slots);
+      free(s->rx_buf);
+      s->rx_msgs = NULL;
+      s->rx_slots = NULL;
+      s->rx_buf = NULL;
+      return false;
+    }
+  for (i = 0 ; i < UDP46_RECV_BATCH ; i++)
+    {
+      udp46_rx_slot rs = &s->rx_slots[i];
+      struct msghdr *msg = &s->rx_msgs[i].msg_hdr;
+
+      rs->iov[0].iov_base = s->rx_buf + i * UDP46_RECV_SLOT_SIZE;
+      rs->iov[0].iov_len = UDP46_RECV_SLOT_SIZE;
+      rs->iov[1].iov_base = _rx_overflow[i];
+      rs->iov[1].iov_len = sizeof(_rx_overflow[i]);
+      msg->msg_iov = rs->iov;
+      msg->msg_iovlen = 2;
+      msg->msg_name = &rs->src;
+      msg->msg_control = rs->control;
+    }
+  return true;
+}
+
+/* Point the slots at their payloads; datagrams that did not fit in
+ * their slot are copied out of the (shared) overflow regions. */
+static void _rx_fill_overflow(udp46 s)
+{
+  int i;
+
+  for (i = 0 ; i < s->rx_count ; i++)
+    {
+      udp46_rx_slot rs = &s->rx_slots[i];
+      size_t len = s->rx_msgs[i].msg_len;
+
+      rs->data = rs->iov[0].iov_base;
+      if (len <= UDP46_RECV_SLOT_SIZE)
+        {
+          /* Large copies are kept only while they are in the ring. */
+          free(rs->large);
+          rs->large = NULL;
+          rs->large_allocated = 0;
+          continue;
+        }
+      if (len > rs->large_allocated)
+        {
+          void *p = realloc(rs->large, len);
+
+          if (!p)
+            {
+              rs->data = NULL;
+              continue;
+            }
+          rs->large = p;
+          rs->large_allocated = len;
+        }
+      memcpy(rs->large, rs->iov[0].iov_base, UDP46_RECV_SLOT_SIZE);
+      memcpy(rs->large + UDP46_RECV_SLOT_SIZE, rs->iov[1].iov_base,
+             len - UDP46_RECV_SLOT_SIZE);
+      rs->data = rs->large;
+    }
+}
+
+/* Fill the ring with what is available on the (readable) sockets. */
+static bool _rx_fill(udp46 s)
+{
+  int fds[2] = { s->s6, s->s4 };
+  int i, j, r;
+
+  /* Whatever was queued in response to the previous batch goes out
+   * before reading more. */
+  _flush(s);
+  s->rx_pos = s->rx_count = 0;
+  for (i = 0 ; i < 2 ; i++)
+    {
+      if (s->cb && !s->maybe_readable[i])
+        continue;
+      for (j = 0 ; j < UDP46_RECV_BATCH ; j++)
+        {
+          struct msghdr *msg = &s->rx_msgs[j].msg_hdr;
+
+          msg->msg_namelen = sizeof(s->rx_slots[j].src);
+          msg->msg_controllen = UDP46_RECV_CONTROL_SIZE;
+          msg->msg_flags = 0;
+        }
+      r = recvmmsg(fds[i], s->rx_msgs, UDP46_RECV_BATCH, MSG_DONTWAIT, NULL);
+      /* Partial batch means the socket was drained. */
+      if (r < UDP46_RECV_BATCH)
+        s->maybe_readable[i] = false;
+      if (r > 0)
+        {
+          s->rx_count = r;
+          _rx_fill_overflow(s);
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Hand out the next packet in the ring (filling it as needed); the
+ * payload stays in its slot until the ring is refilled. */
+static ssize_t _rx_next(udp46 s,
+                        struct sockaddr_in6 *src,
+                        struct sockaddr_in6 *dst,
+                        void **buf)
+{
+  struct sockaddr_in6 src_store;
+
+  if (!src)
+    src = &src_store;
+  while (s->rx_pos < s->rx_count || _rx_fill(s))
+    {
+      udp46_rx_slot rs = &s->rx_slots[s->rx_pos];
+      struct mmsghdr *mm = &s->rx_msgs[s->rx_pos++];
+      struct msghdr *msg = &mm->msg_hdr;
+      ssize_t r;
+
+      if (msg->msg_flags & MSG_TRUNC)
+        {
+          DEBUG("truncated packet");
+          continue;
+        }
+      if (!rs->data)
+        {
+          DEBUG("out of memory for large packet");
+          continue;
+        }
+      memcpy(src, msg->msg_name, msg->msg_namelen < sizeof(*src)
+             ? msg->msg_namelen : sizeof(*src));
+      if ((r = _recv_msg(s, msg, mm->msg_len, src, dst)) >= 0)
+        {
+          *buf = rs->data;
+          return r;
+        }
+    }
+  return -1;
+}
+
+ssize_t udp46_recv(udp46 s,
+                   struct sockaddr_in6 *src,
+                   struct sockaddr_in6 *dst,
+                   void *buf, size_t buf_size)
+{
+  void *p;
+  ssize_t r;
+
+  if (!s->rx_msgs && !_rx_init(s))
+    return _recv_one(s, src, dst, buf, buf_size);
+  if ((r = _rx_next(s, src, dst, &p)) < 0)
+    return -1;
+  if ((size_t)r > buf_size)
+    r = buf_size;
+  memcpy(buf, p, r);
+  return r;
+}
+
+#endif /* UDP46_RECV_BATCH */
+
+#ifndef UDP46_RECV_BATCH
+
+ssize_t udp46_recv(udp46 s,
+                   struct sockaddr_in6 *src,
+                   struct sockaddr_in6 *dst,
+                   void *buf, size_t buf_size)
+{
+  return _recv_one(s, src, dst, buf, buf_size);
+}
+
+#endif /* !UDP46_RECV_BATCH */
+
+ssize_t udp46_recv_nocopy(udp46 s,
+                          struct sockaddr_in6 *src,
+                          struct sockaddr_in6 *dst,
+                          void **buf)
+{
+#ifdef UDP46_RECV_BATCH
+  if (s->rx_msgs || _rx_init(s))
+    return _rx_next(s, src, dst, buf);
+#endif /* UDP46_RECV_BATCH */
+  if (!s->rx_one && !(s->rx_one = malloc(UDP46_MAX_DATAGRAM)))
+    return -1;
+  *buf = s->rx_one;
+  return _recv_one(s, src, dst, s->rx_one, UDP46_MAX_DATAGRAM);
+}
+
+/* Can a packet be sent from src (if any) to dst? */
+static bool _check_addresses(const struct sockaddr_in6 *src,
+                             const struct sockaddr_in6 *dst)
 {
   if (src && src->sin6_family != AF_INET6)
     {
       DEBUG("src wrong: %s", SOCKADDR_IN6_REPR(src));
-      return -1;
+      return false;
     }
   if (!dst || dst->sin6_family != AF_INET6)
     {
       DEBUG("dst wrong: %s", SOCKADDR_IN6_REPR(dst));
-      return -1;
+      return false;
     }
   if (src && !IN6_IS_ADDR_V4MAPPED(&src->sin6_addr)
       != !IN6_IS_ADDR_V4MAPPED(&dst->sin6_addr))
     {
       DEBUG("IPv4 <> IPv6 traffic not allowed");
-      return -1;
+      return false;
     }
-  uint8_t c[1000];
-  struct msghdr msg = {
-    .msg_iov = iov,
-    .msg_iovlen = iov_len,
-    .msg_flags = 0,
-    .msg_control = c,
-    .msg_controllen = sizeof(c)
-  };
-  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
-  struct sockaddr_in sin;
+  return true;
+}
+
+/* Fill in destination and source address of msg (already checked
+ * with _check_addresses). Returns the socket to send it on. */
+static int _prepare_msg(udp46 s,
+                        const struct sockaddr_in6 *src,
+                        const struct sockaddr_in6 *dst,
+                        struct msghdr *msg,
+                        struct sockaddr_in *sin,
+                        uint8_t *c)
+{
+  msg->msg_flags = 0;
+  msg->msg_control = c;
+  msg->msg_controllen = UDP46_SEND_CONTROL_SIZE;
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg);
   int sock = -1;
 
   if (IN6_IS_ADDR_V4MAPPED(&dst->sin6_addr))
     {
       /* Convert the destination address */
-      memset(&sin, 0, sizeof(sin));
-      MAPPED_IN6_ADDR_TO_IN_ADDR(&dst->sin6_addr, &sin.sin_addr);
-      sin.sin_family = AF_INET;
-      sin.sin_port = dst->sin6_port;
-      msg.msg_name = (void *)&sin;
-      msg.msg_namelen = sizeof(sin);
+      memset(sin, 0, sizeof(*sin));
+      MAPPED_IN6_ADDR_TO_IN_ADDR(&dst->sin6_addr, &sin->sin_addr);
+      sin->sin_family = AF_INET;
+      sin->sin_port = dst->sin6_port;
+      msg->msg_name = (void *)sin;
+      msg->msg_namelen = sizeof(*sin);
       sock = s->s4;
     }
   else
     {
       /* Use destination address as-is */
-      msg.msg_name = (void *)dst;
-      msg.msg_namelen = sizeof(*dst);
+      msg->msg_name = (void *)dst;
+      msg->msg_namelen = sizeof(*dst);
       sock = s->s6;
     }
   /* Deal with source address */
@@ -317,8 +635,183 @@ int udp46_send_iovec(udp46 s,
           cmsg->cmsg_len = CMSG_LEN(sizeof(*ipi6));
         }
     }
-  msg.msg_controllen = cmsg->cmsg_len;
-  return sendmsg(sock, &msg, 0);
+  msg->msg_controllen = cmsg->cmsg_len;
+  if (!msg->msg_controllen)
+    msg->msg_control = NULL;
+  return sock;
+}
+
+static int _queue_iovec(udp46 s,
+                        const struct sockaddr_in6 *src,
+                        const struct sockaddr_in6 *dst,
+                        struct iovec *iov, int iov_len)
+{
+  size_t len = 0;
+  int i;
+
+  for (i = 0 ; i < iov_len ; i++)
+    len += iov[i].iov_len;
+  if (s->tx_count >= UDP46_SEND_QUEUE_MAXIMUM
+      || s->tx_data_used + len > UDP46_SEND_QUEUE_MAXIMUM_BYTES)
+    _flush(s);
+  if (s->tx_count == s->tx_allocated)
+    {
+      int nlen = s->tx_allocated * 2 + 8;
+      void *buf = realloc(s->tx, nlen * sizeof(*s->tx));
+      if (!buf)
+        return -1;
+      s->tx = buf;
+      s->tx_allocated = nlen;
+    }
+  if (s->tx_data_used + len > s->tx_data_allocated)
+    {
+      size_t nlen = (s->tx_data_used + len) * 2;
+      void *buf = realloc(s->tx_data, nlen);
+      if (!buf)
+        return -1;
+      s->tx_data = buf;
+      s->tx_data_allocated = nlen;
+    }
+  udp46_tx t = &s->tx[s->tx_count++];
+  t->has_src = !!src;
+  if (src)
+    t->src = *src;
+  t->dst = *dst;
+  t->offset = s->tx_data_used;
+  t->len = len;
+  for (i = 0 ; i < iov_len ; i++)
+    {
+      memcpy(s->tx_data + s->tx_data_used, iov[i].iov_base, iov[i].iov_len);
+      s->tx_data_used += iov[i].iov_len;
+    }
+  return len;
+}
+
+static bool _flush_init(udp46 s)
+{
+  if (s->tx_count <= s->tx_msgs_allocated)
+    return true;
+  free(s->tx_msgs);
+  free(s->tx_slots);
+  s->tx_msgs = calloc(s->tx_count, sizeof(*s->tx_msgs));
+  s->tx_slots = calloc(s->tx_count, sizeof(*s->tx_slots));
+  if (!s->tx_msgs || !s->tx_slots)
+    {
+      free(s->tx_msgs);
+      free(s->tx_slots);
+      s->tx_msgs = NULL;
+      s->tx_slots = NULL;
+      s->tx_msgs_allocated = 0;
+      return false;
+    }
+  s->tx_msgs_allocated = s->tx_count;
+  return true;
+}
+
+static void _flush(udp46 s)
+{
+  int i, j, k, r;
+
+  if (!s->tx_count)
+    return;
+  if (!_flush_init(s))
+    {
+      L_ERR("udp46: unable to allocate send batch, dropping %d packets",
+            s->tx_count);
+      s->send_stats.failed += s->tx_count;
+      goto done;
+    }
+  for (i = 0 ; i < s->tx_count ; i++)
+    {
+      udp46_tx t = &s->tx[i];
+      udp46_tx_slot ts = &s->tx_slots[i];
+      struct msghdr *msg = &s->tx_msgs[i].msg_hdr;
+
+      ts->iov.iov_base = s->tx_data + t->offset;
+      ts->iov.iov_len = t->len;
+      msg->msg_iov = &ts->iov;
+      msg->msg_iovlen = 1;
+      ts->sock = _prepare_msg(s, t->has_src ? &t->src : NULL, &t->dst,
+                              msg, &ts->sin, ts->control);
+    }
+  /* Send consecutive packets for the same socket at once. */
+  for (i = 0 ; i < s->tx_count ; i = j)
+    {
+      int sock = s->tx_slots[i].sock;
+
+      for (j = i + 1 ; j < s->tx_count && s->tx_slots[j].sock == sock ; j++);
+      if (sock < 0)
+        {
+          s->send_stats.failed += j - i;
+          continue;
+        }
+      for (k = i ; k < j ; k += r > 0 ? r : 1)
+        {
+#ifdef UDP46_SEND_BATCH
+          r = sendmmsg(sock, &s->tx_msgs[k], j - k, 0);
+#else
+          r = sendmsg(sock, &s->tx_msgs[k].msg_hdr, 0) < 0 ? -1 : 1;
+#endif /* UDP46_SEND_BATCH */
+          if (r <= 0)
+            {
+              /* Skip the packet that failed. */
+              DEBUG("udp46 send failed: %s", strerror(errno));
+              s->send_stats.failed++;
+            }
+          else
+            s->send_stats.syscalls++;
+        }
+    }
+  s->send_stats.flushes++;
+  s->send_stats.packets += s->tx_count;
+  if (s->tx_count > s->send_stats.max_batch)
+    s->send_stats.max_batch = s->tx_count;
+ done:
+  s->tx_count = 0;
+  s->tx_data_used = 0;
+  if (s->tx_data_allocated > UDP46_SEND_QUEUE_KEEP_BYTES)
+    {
+      free(s->tx_data);
+      s->tx_data = NULL;
+      s->tx_data_allocated = 0;
+    }
+}
+
+void udp46_send_queue_start(udp46 s)
+{
+  s->tx_depth++;
+}
+
+void udp46_send_queue_flush(udp46 s)
+{
+  if (s->tx_depth && --s->tx_depth)
+    return;
+  _flush(s);
+}
+
+void udp46_get_send_stats(udp46 s, udp46_send_stats stats)
+{
+  *stats = s->send_stats;
+}
+
+int udp46_send_iovec(udp46 s,
+                     const struct sockaddr_in6 *src,
+                     const struct sockaddr_in6 *dst,
+                     struct iovec *iov, int iov_len)
+{
+  uint8_t c[UDP46_SEND_CONTROL_SIZE];
+  struct msghdr msg = {
+    .msg_iov = iov,
+    .msg_iovlen = iov_len,
+  };
+  struct sockaddr_in sin;
+
+  if (!_check_addresses(src, dst))
+    return -1;
+  /* Queued packets are prepared only when flushed. */
+  if (s->tx_depth)
+    return _queue_iovec(s, src, dst, iov, iov_len);
+  return sendmsg(_prepare_msg(s, src, dst, &msg, &sin, c), &msg, 0);
 }
 
 
@@ -327,6 +820,23 @@ void udp46_destroy(udp46 s)
   udp46_set_readable_cb(s, NULL, NULL);
   close(s->s4);
   close(s->s6);
+  free(s->tx);
+  free(s->tx_data);
+  free(s->tx_msgs);
+  free(s->tx_slots);
+  free(s->rx_one);
+#ifdef UDP46_RECV_BATCH
+  if (s->rx_slots)
+    {
+      int i;
+
+      for (i = 0 ; i < UDP46_RECV_BATCH ; i++)
+        free(s->rx_slots[i].large);
+    }
+  free(s->rx_msgs);
+  free(s->rx_slots);
+  free(s->rx_buf);
+#endif /* UDP46_RECV_BATCH */
   free(s);
 }
 
@@ -343,6 +853,9 @@ int udp46_send(udp46 s,
 static void ufd_cb_4(struct uloop_fd *u, unsigned int events __unused)
 {
   udp46 s = container_of(u, udp46_s, ufds[0]);
+#ifdef UDP46_RECV_BATCH
+  s->maybe_readable[1] = true;
+#endif /* UDP46_RECV_BATCH */
   if (s->cb)
     s->cb(s, s->cb_context);
 }
@@ -350,6 +863,9 @@ static void ufd_cb_4(struct uloop_fd *u, unsigned int events __unused)
 static void ufd_cb_6(struct uloop_fd *u, unsigned int events __unused)
 {
   udp46 s = container_of(u, udp46_s, ufds[1]);
+#ifdef UDP46_RECV_BATCH
+  s->maybe_readable[0] = true;
+#endif /* UDP46_RECV_BATCH */
   if (s->cb)
     s->cb(s, s->cb_context);
 }
@@ -379,4 +895,7 @@ void udp46_set_readable_cb(udp46 s, udp46_readable_cb cb,
     }
   s->cb = cb;
   s->cb_context = cb_context;
+#ifdef UDP46_RECV_BATCH
+  s->maybe_readable[0] = s->maybe_readable[1] = true;
+#endif /* UDP46_RECV_BATCH */
 }
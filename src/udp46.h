@@ -61,12 +61,29 @@ void udp46_set_readable_cb(udp46 s, udp46_readable_cb cb, void *cb_context);
  * Equivalent of socket type specific recvmsg() + magic to handle
  * source and destination addresses. -1 is returned if no packet
  * available. src and dst are optional.
+ *
+ * Where available, packets are received from the sockets in batches,
+ * and handed out one by one from there. Therefore the readable
+ * callback should keep receiving until -1 is returned; packets
+ * already in a batch do not make the socket readable again.
  */
 ssize_t udp46_recv(udp46 s,
                    struct sockaddr_in6 *src,
                    struct sockaddr_in6 *dst,
                    void *buf, size_t buf_size);
 
+/**
+ * Receive a packet without copying it.
+ *
+ * Like udp46_recv, but *buf is pointed at the packet within udp46's
+ * own receive buffer instead. It stays valid only until the next
+ * receive call on (or destruction of) the socket.
+ */
+ssize_t udp46_recv_nocopy(udp46 s,
+                          struct sockaddr_in6 *src,
+                          struct sockaddr_in6 *dst,
+                          void **buf);
+
 /**
  * Send a packet.
  *
@@ -83,6 +100,41 @@ int udp46_send(udp46 s,
                const struct sockaddr_in6 *dst,
                void *buf, size_t buf_size);
 
+/**
+ * Queue sends.
+ *
+ * After udp46_send_queue_start, packets are queued (and the send
+ * functions return their length) until the matching
+ * udp46_send_queue_flush, which sends them all out at once (using
+ * sendmmsg where available). The calls may be nested; only the
+ * outermost flush sends. The queue is also flushed when it is full,
+ * and before receiving the next batch of packets. Queued packets that
+ * could not be sent are counted in the statistics.
+ */
+void udp46_send_queue_start(udp46 s);
+void udp46_send_queue_flush(udp46 s);
+
+typedef struct {
+  /* Number of (non-empty) flushes of the send queue */
+  int flushes;
+
+  /* Number of packets sent by them */
+  int packets;
+
+  /* Number of send syscalls the flushes took */
+  int syscalls;
+
+  /* Largest number of packets sent in one flush */
+  int max_batch;
+  /* Number of flushed packets that could not be sent */
+  int failed;
+} udp46_send_stats_s, *udp46_send_stats;
+
+/**
+ * Get statistics about queued sends.
+ */
+void udp46_get_send_stats(udp46 s, udp46_send_stats stats);
+
 /**
  * Destroy/close a socket.
  */
@@ -120,6 +120,9 @@ typedef struct {
   /* When is it scheduled to run? */
   struct uloop_timeout run_to;
 
+  /* How many times has it run? */
+  int num_runs;
+
   /* Debug subscriber we use just to make sure there are no changes
    * when the topology should be stable. */
   dncp_subscriber_s debug_subscriber;
@@ -137,6 +140,9 @@ typedef struct net_sim_t {
   bool disable_sd;
   bool disable_pa;
   bool disable_multicast;
+  bool disable_sync;
+  bool disable_segment;
+  bool disable_delta;
 
   int node_count;
   bool add_neighbor_is_error;
@@ -146,6 +152,8 @@ typedef struct net_sim_t {
   int sent_unicast;
   hnetd_time_t last_unicast_sent;
   int sent_multicast;
+  long long sent_unicast_bytes;
+  long long sent_multicast_bytes;
 
   int converged_count;
   int not_converged_count;
@@ -339,6 +347,12 @@ hncp net_sim_find_hncp(net_sim s, const char *name)
     n->h.ext.conf.per_ep.unicast_only = true;
   if (s->fake_unicast_is_reliable_stream)
     n->h.ext.conf.per_ep.unicast_is_reliable_stream = true;
+  if (s->disable_sync)
+    n->h.ext.conf.sync_summary_cells = 0;
+  if (s->disable_segment)
+    n->h.ext.conf.per_ep.segment_network_state = false;
+  if (s->disable_delta)
+    n->h.ext.conf.node_data_delta = false;
   n->d = hncp_get_dncp(&n->h);
   sput_fail_unless(r, "hncp_init");
 
@@ -439,10 +453,8 @@ dncp_ep net_sim_dncp_find_ep_by_name(dncp o, const char *name)
    * officially set(!). Beautiful.. */
   /* Override the ep_id to be unique. */
   if (n->s->use_global_ep_ids)
-    {
-      dncp_ep_i l = container_of(ep, dncp_ep_i_s, conf);
-      l->ep_id = n->s->next_free_ep_id++;
-    }
+    sput_fail_unless(dncp_ep_set_id(ep, n->s->next_free_ep_id++),
+                     "dncp_ep_set_id");
 
   /* Note that the interface is ready. */
   dncp_ext_ep_ready(ep, true);
@@ -581,10 +593,11 @@ void net_sim_uninit(net_sim s)
       net_sim_remove_node(s, node);
       c++;
     }
-  L_NOTICE("#nodes:%d elapsed:%.2fs unicasts:%d multicasts:%d",
+  L_NOTICE("#nodes:%d elapsed:%.2fs unicasts:%d (%lld bytes) multicasts:%d (%lld bytes)",
            c,
            (float)(hnetd_time() - s->start) / HNETD_TIME_PER_SECOND,
-           s->sent_unicast, s->sent_multicast);
+           s->sent_unicast, s->sent_unicast_bytes,
+           s->sent_multicast, s->sent_multicast_bytes);
   sput_fail_unless(list_empty(&s->neighs), "no neighs");
   sput_fail_unless(list_empty(&s->messages), "no messages");
 }
@@ -638,6 +651,7 @@ static void _timeout(struct uloop_timeout *t)
 {
   net_node node = container_of(t, net_node_s, run_to);
   L_DEBUG("%s: dncp_run", node->name);
+  node->num_runs++;
   dncp_ext_timeout(node->d);
 }
 
@@ -824,12 +838,14 @@ _send(dncp_ext ext, dncp_ep ep,
   if (is_multicast)
     {
       s->sent_multicast++;
+      s->sent_multicast_bytes += len;
       sput_fail_unless(len <= HNCP_MAXIMUM_MULTICAST_SIZE,
                        "not too long multicast");
     }
   else
     {
       s->sent_unicast++;
+      s->sent_unicast_bytes += len;
       s->last_unicast_sent = hnetd_time();
     }
   int sent = 0;
@@ -27,6 +27,7 @@
 #include <libubox/uloop.h>
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <time.h>
 
 /* in ms */
 #define SINGLE_TEST_ERROR_TIMEOUT 2000
@@ -175,6 +176,13 @@ static void _test_basic_i(int i)
       rb = dtls_set_psk(d2, "foo", 3);
       sput_fail_unless(rb, "dtls_set_psk");
     }
+  if (i & 4)
+    {
+      rb = dtls_set_handshake_worker(d1, true);
+      sput_fail_unless(rb, "dtls_set_handshake_worker 1");
+      rb = dtls_set_handshake_worker(d2, true);
+      sput_fail_unless(rb, "dtls_set_handshake_worker 2");
+    }
 
   /* Start the instances once they have been configured */
   dtls_start(d1);
@@ -197,6 +205,20 @@ static void _test_basic_i(int i)
   uloop_run();
   sput_fail_unless(!pending_readable, "readable left");
 
+  /* The queued send came from the pool, and was released (with the
+   * worker, received datagrams are queued for it too) */
+  dtls_stats_s ds;
+  dtls_get_stats(d1, &ds);
+  sput_fail_unless((i & 4) || ds.num_pool_hits + ds.num_pool_misses == 1,
+                   "one queued buffer");
+  sput_fail_unless(!ds.queued_bytes, "queued bytes left (client)");
+  sput_fail_unless(!(i & 4) == !ds.num_worker_handshakes,
+                   "worker handshakes (client)");
+  dtls_get_stats(d2, &ds);
+  sput_fail_unless(!ds.queued_bytes, "queued bytes left (server)");
+  sput_fail_unless(!(i & 4) == !ds.num_worker_handshakes,
+                   "worker handshakes (server)");
+
   /* Do shutdown on one side, and expect other to behave accordingly */
   if (!(i & 2))
     {
@@ -246,6 +268,14 @@ static void _test_unknown_i(int i)
   dtls_set_unknown_cert_cb(d1, _unknown_cb, NULL);
   d2 = dtls_create(pbase+1);
   dtls_set_unknown_cert_cb(d2, _unknown_cb, NULL);
+  sput_fail_unless(d1->disable_session_resumption
+                   && d2->disable_session_resumption,
+                   "no session resumption with unknown cert cb");
+  if (i & 2)
+    {
+      dtls_set_handshake_worker(d1, true);
+      dtls_set_handshake_worker(d2, true);
+    }
   int rv;
   char *msg = "foo";
   struct uloop_timeout t = { .cb = _timeout };
@@ -259,7 +289,7 @@ static void _test_unknown_i(int i)
   rb = dtls_set_local_cert(d1, "test/cert1.pem", "test/key1.pem");
   sput_fail_unless(rb, "dtls_set_local_cert 1");
 
-  if (i == 1)
+  if (i & 1)
     {
       rb = dtls_set_verify_locations(d1, "test/cert2.pem", NULL);
       sput_fail_unless(rb, "dtls_set_verify_locations 1");
@@ -270,7 +300,7 @@ static void _test_unknown_i(int i)
   rb = dtls_set_local_cert(d2, "test/cert2.pem", "test/key2.pem");
   sput_fail_unless(rb, "dtls_set_local_cert 2");
 
-  if (i == 0)
+  if (!(i & 1))
     {
       rb = dtls_set_verify_locations(d2, "test/cert1.pem", NULL);
       sput_fail_unless(rb, "dtls_set_verify_locations 2");
@@ -296,6 +326,17 @@ static void _test_unknown_i(int i)
   uloop_timeout_set(&t, SINGLE_TEST_ERROR_TIMEOUT);
   uloop_run();
 
+  if (i & 2)
+    {
+      dtls_stats_s s1, s2;
+
+      /* The callback was called in the main thread on behalf of the
+       * worker */
+      dtls_get_stats(d1, &s1);
+      dtls_get_stats(d2, &s2);
+      sput_fail_unless(s1.num_worker_verifies + s2.num_worker_verifies == 1,
+                       "verified via main thread");
+    }
   dtls_destroy(d1);
   dtls_destroy(d2);
   uloop_timeout_cancel(&t);
@@ -303,6 +344,194 @@ static void _test_unknown_i(int i)
   sput_fail_unless(!pending_unknown, "no unknown left");
 }
 
+/* Number of reconnects done in the handshake benchmark */
+#define BENCH_CONNECTIONS 10
+
+static int64_t _cpu_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void _settle_timeout(struct uloop_timeout *t)
+{
+  uloop_end();
+}
+
+/* Reconnect to the same peer repeatedly, and return how much CPU it
+ * took altogether. */
+static int64_t _test_resumption_i(bool resumption)
+{
+  int pbase = 49200 + resumption * 2;
+  char *msg = "foo";
+  struct uloop_timeout t = { .cb = _timeout };
+  struct uloop_timeout t2 = { .cb = _no_connections_timeout };
+  struct uloop_timeout t3 = { .cb = _settle_timeout };
+  struct sockaddr_in6 src = {.sin6_family = AF_INET6 };
+  struct sockaddr_in6 dst = {.sin6_family = AF_INET6 };
+  dtls_stats_s s1, s2;
+  int64_t cpu;
+  int i, rv;
+
+#ifdef __APPLE__
+  src.sin6_len = sizeof(src);
+  dst.sin6_len = sizeof(dst);
+#endif /* __APPLE__ */
+  d1 = dtls_create(pbase);
+  d2 = dtls_create(pbase+1);
+  dtls_set_readable_cb(d2, _readable_cb, NULL);
+  sput_fail_unless(dtls_set_local_cert(d1, "test/cert1.pem", "test/key1.pem")
+                   && dtls_set_verify_locations(d1, "test/cert2.pem", NULL)
+                   && dtls_set_local_cert(d2, "test/cert2.pem", "test/key2.pem")
+                   && dtls_set_verify_locations(d2, "test/cert1.pem", NULL),
+                   "cert setup");
+  dtls_set_session_resumption(d1, resumption);
+  dtls_set_session_resumption(d2, resumption);
+  dtls_start(d1);
+  dtls_start(d2);
+  (void)inet_pton(AF_INET6, "::1", &src.sin6_addr);
+  (void)inet_pton(AF_INET6, "::1", &dst.sin6_addr);
+  src.sin6_port = htons(pbase);
+  dst.sin6_port = htons(pbase+1);
+
+  cpu = _cpu_us();
+  for (i = 0; i < BENCH_CONNECTIONS; i++)
+    {
+      smock_push_int("dtls_recv", 3);
+      smock_push("dtls_recv_src_in6", &src.sin6_addr);
+      smock_push("dtls_recv_buf", msg);
+      rv = dtls_send(d1, NULL, &dst, msg, strlen(msg));
+      sput_fail_unless(rv == 3, "sendto failed?");
+      pending_readable = 1;
+      uloop_timeout_set(&t, SINGLE_TEST_ERROR_TIMEOUT);
+      uloop_run();
+      sput_fail_unless(!pending_readable, "readable left");
+
+      dtls_connection dc = _connection_find(d1, true, &dst);
+      sput_fail_unless(dc, "no connection at src");
+      if (!dc)
+        break;
+      _connection_shutdown(dc);
+      uloop_timeout_set(&t2, 5);
+      uloop_run();
+      uloop_timeout_cancel(&t2);
+
+      /* All client connections share one port, so a late close_notify
+       * from the old connection would hit the new one (and
+       * abbreviated handshake is quick enough to be in the same epoch
+       * by then); let it arrive first. */
+      uloop_timeout_set(&t3, 20);
+      uloop_run();
+    }
+  cpu = _cpu_us() - cpu;
+  uloop_timeout_cancel(&t);
+
+  dtls_get_stats(d1, &s1);
+  dtls_get_stats(d2, &s2);
+  L_NOTICE("resumption %s: %d connections, %d+%d full, %d+%d resumed, "
+           "%lld us CPU", resumption ? "on" : "off", BENCH_CONNECTIONS,
+           s1.num_full_handshakes, s2.num_full_handshakes,
+           s1.num_resumed_handshakes, s2.num_resumed_handshakes,
+           (long long)cpu);
+  if (resumption)
+    {
+      sput_fail_unless(s1.num_full_handshakes == 1, "one full handshake");
+      sput_fail_unless(s1.num_resumed_handshakes == BENCH_CONNECTIONS - 1,
+                       "rest resumed");
+      sput_fail_unless(s2.num_resumed_handshakes == BENCH_CONNECTIONS - 1,
+                       "rest resumed (server)");
+    }
+  else
+    sput_fail_unless(!s1.num_resumed_handshakes
+                     && !s2.num_resumed_handshakes, "nothing resumed");
+  dtls_destroy(d1);
+  dtls_destroy(d2);
+  return cpu;
+}
+
+static void dtls_resumption_bench()
+{
+  int64_t full = _test_resumption_i(false);
+  int64_t resumed = _test_resumption_i(true);
+
+  L_NOTICE("handshake CPU: %lld us without, %lld us with resumption",
+           (long long)full, (long long)resumed);
+  sput_fail_unless(resumed < full, "resumption saves CPU");
+}
+
+static void dtls_queue_limit()
+{
+  dtls_limits_s limits = { .max_queued_bytes = 5 };
+  struct sockaddr_in6 dst = {.sin6_family = AF_INET6
+#ifdef __APPLE__
+                             , .sin6_len = sizeof(struct sockaddr_in6)
+#endif /* __APPLE__ */
+  };
+  char *msg = "foo";
+  dtls_stats_s ds;
+  int rv;
+
+  d1 = dtls_create(49300);
+  dtls_set_psk(d1, "foo", 3);
+  dtls_set_limits(d1, &limits);
+  dtls_start(d1);
+
+  /* Nobody listens there, so the data stays queued */
+  (void)inet_pton(AF_INET6, "::1", &dst.sin6_addr);
+  dst.sin6_port = htons(49301);
+  rv = dtls_send(d1, NULL, &dst, msg, strlen(msg));
+  sput_fail_unless(rv == 3, "first send queued");
+  rv = dtls_send(d1, NULL, &dst, msg, strlen(msg));
+  sput_fail_unless(rv < 0, "second send over the limit");
+  dtls_get_stats(d1, &ds);
+  sput_fail_unless(ds.queued_bytes == 3, "queued bytes");
+  sput_fail_unless(ds.num_queue_drops == 1, "one drop");
+  dtls_destroy(d1);
+}
+
+static void dtls_source_limit()
+{
+  struct sockaddr_in6 a1 = {.sin6_family = AF_INET6 };
+  struct sockaddr_in6 a2 = {.sin6_family = AF_INET6 };
+  dtls_source_stats_s ss[2];
+  dtls_stats_s ds;
+  int i, n1 = 0, n2 = 0;
+
+  d1 = dtls_create(49302);
+  (void)inet_pton(AF_INET6, "fe80::1", &a1.sin6_addr);
+  (void)inet_pton(AF_INET6, "fe80::2", &a2.sin6_addr);
+  _dtls_update_t(d1);
+
+  /* A chatty source gets its burst, and the other one is not starved
+   * by it. */
+  for (i = 0; i < 100; i++)
+    n1 += _source_allow(d1, &a1);
+  for (i = 0; i < 5; i++)
+    {
+      /* Different port, same source */
+      a2.sin6_port = htons(1000 + i);
+      n2 += _source_allow(d1, &a2);
+    }
+  L_DEBUG("allowed %d/100 and %d/5", n1, n2);
+  /* Alone, it gets half of input_pps; rest is for newcomers */
+  sput_fail_unless(n1 >= 50 && n1 < 60, "chatty source limited");
+  sput_fail_unless(n2 == 5, "other source not starved");
+
+  dtls_get_stats(d1, &ds);
+  sput_fail_unless(ds.num_source_drops == 100 - n1, "source drops");
+  sput_fail_unless(dtls_get_source_stats(d1, ss, 2) == 2, "two sources");
+  for (i = 0; i < 2; i++)
+    {
+      bool is_a1 = !memcmp(&ss[i].addr, &a1.sin6_addr, sizeof(ss[i].addr));
+
+      sput_fail_unless(ss[i].num_packets == (is_a1 ? 100 : 5), "packets");
+      sput_fail_unless(ss[i].num_drops == (is_a1 ? 100 - n1 : 0), "drops");
+    }
+  dtls_destroy(d1);
+}
+
 static void dtls_basic_sc_cert()
 {
   _test_basic_i(0);
@@ -334,6 +563,21 @@ static void dtls_unknown_2()
   _test_unknown_i(1);
 }
 
+static void dtls_basic_sc_cert_worker()
+{
+  _test_basic_i(4);
+}
+
+static void dtls_basic_cc_psk_worker()
+{
+  _test_basic_i(7);
+}
+
+static void dtls_unknown_1_worker()
+{
+  _test_unknown_i(2);
+}
+
 
 int main(int argc, char **argv)
 {
@@ -352,6 +596,12 @@ int main(int argc, char **argv)
   sput_maybe_run_test(dtls_basic_cc_psk, do {} while(0));
   sput_maybe_run_test(dtls_unknown_1, do {} while(0));
   sput_maybe_run_test(dtls_unknown_2, do {} while(0));
+  sput_maybe_run_test(dtls_resumption_bench, do {} while(0));
+  sput_maybe_run_test(dtls_queue_limit, do {} while(0));
+  sput_maybe_run_test(dtls_source_limit, do {} while(0));
+  sput_maybe_run_test(dtls_basic_sc_cert_worker, do {} while(0));
+  sput_maybe_run_test(dtls_basic_cc_psk_worker, do {} while(0));
+  sput_maybe_run_test(dtls_unknown_1_worker, do {} while(0));
   sput_leave_suite(); /* optional */
   sput_finish_testing();
   return sput_get_return_value();
@@ -203,6 +203,94 @@ void hncp_int(void)
   dncp_ext_timeout(o);
   sput_fail_unless(o->own_node->update_number == 2, "update number ok");
 
+  /* Own node update should not need full network hash recalculation,
+   * yet result in same network hash as one. */
+  int full = o->num_network_hash_full;
+  dncp_add_tlv(o, 125, NULL, 0, 0);
+  dncp_ext_timeout(o);
+  sput_fail_unless(o->own_node->update_number == 3, "update number ok");
+  sput_fail_unless(o->num_network_hash_full == full, "no full recalculation");
+  dncp_hash_s h = o->network_hash;
+  o->network_hash_dirty = true;
+  o->network_hash_full_dirty = true;
+  dncp_calculate_network_hash(o);
+  sput_fail_unless(o->num_network_hash_full == full + 1, "full recalculation");
+  sput_fail_unless(!memcmp(&h, &o->network_hash, DNCP_HASH_LEN(o)),
+                   "network hash same");
+
+  /* Local TLV changes should be spliced into the published container,
+   * and the result should match producing it from scratch. */
+  int tlvs_full = o->num_tlvs_full;
+  dncp_tlv t3 = dncp_add_tlv(o, 126, "foo", 3, 0);
+  dncp_add_tlv(o, 122, NULL, 0, 0);
+  dncp_remove_tlv_matching(o, 123, NULL, 0);
+  dncp_ext_timeout(o);
+  sput_fail_unless(o->own_node->update_number == 4, "update number ok");
+  sput_fail_unless(o->num_tlvs_full == tlvs_full, "no full container rebuild");
+  struct tlv_attr *a = tlv_memdup(dncp_node_get_tlvs(o->own_node));
+  o->tlvs_dirty = true;
+  o->tlvs_full_dirty = true;
+  dncp_self_flush(o->own_node);
+  sput_fail_unless(o->num_tlvs_full == tlvs_full + 1, "full container rebuild");
+  sput_fail_unless(tlv_attr_equal(a, dncp_node_get_tlvs(o->own_node)),
+                   "container same");
+  sput_fail_unless(o->own_node->update_number == 5, "update number ok");
+  free(a);
+
+  /* Removing and re-adding published TLV should NOT trigger new update. */
+  dncp_remove_tlv(o, t3);
+  dncp_add_tlv(o, 126, "foo", 3, 0);
+  dncp_ext_timeout(o);
+  sput_fail_unless(o->own_node->update_number == 5, "update number ok");
+
+  hncp_uninit(&s);
+}
+
+static int tlv_cb_count[2];
+
+static void _tlv_cb(dncp_subscriber s,
+                    dncp_node n, struct tlv_attr *tlv, bool add)
+{
+  tlv_cb_count[add]++;
+}
+
+void hncp_subscribe_filter(void)
+{
+  hncp_s s;
+  dncp o;
+  dncp_subscriber_s all, some;
+
+  hncp_init(&s);
+  o = hncp_get_dncp(&s);
+  dncp_ext_timeout(o);
+
+  memset(&all, 0, sizeof(all));
+  all.tlv_change_cb = _tlv_cb;
+  dncp_subscribe(o, &all);
+
+  memset(&some, 0, sizeof(some));
+  some.tlv_change_cb = _tlv_cb;
+  dncp_subscriber_add_tlv_type(&some, 123);
+  dncp_subscribe(o, &some);
+
+  memset(tlv_cb_count, 0, sizeof(tlv_cb_count));
+  dncp_add_tlv(o, 123, NULL, 0, 0);
+  dncp_add_tlv(o, 124, NULL, 0, 0);
+  dncp_self_flush(o->own_node);
+  sput_fail_unless(tlv_cb_count[true] == 3, "3 adds (2 all, 1 filtered)");
+  sput_fail_unless(tlv_cb_count[false] == 0, "no removes");
+
+  memset(tlv_cb_count, 0, sizeof(tlv_cb_count));
+  dncp_remove_tlv_matching(o, 124, NULL, 0);
+  dncp_self_flush(o->own_node);
+  sput_fail_unless(tlv_cb_count[true] == 0, "no adds");
+  sput_fail_unless(tlv_cb_count[false] == 1, "1 remove (unfiltered)");
+
+  memset(tlv_cb_count, 0, sizeof(tlv_cb_count));
+  dncp_unsubscribe(o, &some);
+  sput_fail_unless(tlv_cb_count[false] == 1, "1 remove on unsubscribe");
+
+  dncp_unsubscribe(o, &all);
   hncp_uninit(&s);
 }
 
@@ -230,6 +318,19 @@ void hncp_hash(void)
   hncp_uninit(&s);
 }
 
+void hncp_keepalive_multiplier(void)
+{
+  hncp_s s;
+
+  /* 2.1, not 2; integer arithmetic on it used to truncate. */
+  sput_fail_unless(HNCP_KEEPALIVE_INTERVAL * HNCP_KEEPALIVE_MULTIPLIER
+                   == 42 * HNETD_TIME_PER_SECOND, "2.1 intervals");
+  hncp_init(&s);
+  sput_fail_unless(dncp_get_ext(hncp_get_dncp(&s))
+                   ->conf.keepalive_multiplier_percent == 210, "210%");
+  hncp_uninit(&s);
+}
+
 int main(int argc, char **argv)
 {
   setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
@@ -237,6 +338,8 @@ int main(int argc, char **argv)
   sput_start_testing();
   sput_enter_suite("hncp"); /* optional */
   sput_run_test(hncp_hash);
+  sput_run_test(hncp_keepalive_multiplier);
+  sput_run_test(hncp_subscribe_filter);
   sput_run_test(hncp_ext);
   sput_run_test(hncp_int);
   sput_leave_suite(); /* optional */
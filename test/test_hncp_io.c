@@ -27,16 +27,25 @@
 dncp_ep_s static_ep = { .ifname = LOOPBACK_NAME,
                         .accept_insecure_nonlocal_traffic = true };
 
-#define dncp_find_ep_by_name(o, n) &static_ep
+#define dncp_find_ep_by_name(o, n) ((void)(o), (void)(n), &static_ep)
 #include "hncp_io.c"
 #include "sput.h"
 #include "smock.h"
 
 #include "fake_log.h"
 
+#include <poll.h>
+
 /* Lots of stubs here, rather not put __unused all over the place. */
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 
+hncp_ep_s static_hep;
+
+void *dncp_ep_get_ext_data(dncp_ep ep)
+{
+  return &static_hep;
+}
+
 void dncp_ext_ep_ready(dncp_ep ep, bool ready)
 {
   smock_pull_string_is("dncp_ready", ep->ifname);
@@ -48,7 +57,26 @@ void dncp_ext_timeout(dncp o)
   smock_pull("dncp_run");
 }
 
+void dncp_ext_ep_carrier(dncp_ep ep, bool up)
+{
+}
+
 int pending_packets = 0;
+int pending_peer_states = 0;
+int peers_connected = 0;
+
+void dncp_ext_ep_peer_state(dncp_ep ep,
+                            struct sockaddr_in6 *local,
+                            struct sockaddr_in6 *remote,
+                            bool connected)
+{
+  sput_fail_unless(ep == &static_ep, "peer state ep");
+  sput_fail_unless(local->sin6_scope_id == if_nametoindex(LOOPBACK_NAME),
+                   "peer state local scope id");
+  peers_connected += connected ? 1 : -1;
+  if (!--pending_peer_states)
+    uloop_end();
+}
 
 void dncp_ext_readable(dncp o)
 {
@@ -133,8 +161,462 @@ static void dncp_io_basic_2()
 
   uloop_run();
 
+  /* Both directions of the endpoint <> ifindex mapping should be cached */
+  sput_fail_unless(static_hep.ifindex == (int)if_nametoindex(ifname),
+                   "ifindex cached");
+  sput_fail_unless(_find_ep_by_ifindex(&h2, static_hep.ifindex) == &static_ep,
+                   "ep by ifindex");
+  hncp_io_set_ifindex(&h2, NULL, static_hep.ifindex);
+  sput_fail_unless(!_find_ep_by_ifindex(&h2, if_nametoindex(ifname)),
+                   "ifindex removed");
+
+  hncp_io_uninit(&h1);
+  hncp_io_uninit(&h2);
+  memset(&static_hep, 0, sizeof(static_hep));
+}
+
+static void dncp_io_batch()
+{
+  hncp_s h1, h2;
+  char *msgs[] = { "foo", "bar", "baz" };
+  char buf[64];
+  struct sockaddr_in6 src, dst;
+  unsigned int i;
+  int r, fd;
+
+  memset(&h1, 0, sizeof(h1));
+  memset(&h2, 0, sizeof(h2));
+  h1.udp_port = 62002;
+  h2.udp_port = 62003;
+  sput_fail_unless(hncp_io_init(&h1), "dncp_io_init h1");
+  sput_fail_unless(hncp_io_init(&h2), "dncp_io_init h2");
+
+  /* Queue up few packets, send them and then read them in one go. */
+  memset(&dst, 0, sizeof(dst));
+  dst.sin6_family = AF_INET6;
+  dst.sin6_port = htons(h2.udp_port);
+  (void)inet_pton(AF_INET6, "::1", &dst.sin6_addr);
+#ifdef __APPLE__
+  dst.sin6_len = sizeof(dst);
+#endif /* __APPLE__ */
+  udp46_send_queue_start(h1.u46_server);
+  for (i = 0 ; i < ARRAY_SIZE(msgs) ; i++)
+    {
+      r = udp46_send(h1.u46_server, NULL, &dst, msgs[i], strlen(msgs[i]));
+      sput_fail_unless(r == (int)strlen(msgs[i]), "udp46_send");
+    }
+  udp46_send_stats_s ss;
+  udp46_get_send_stats(h1.u46_server, &ss);
+  sput_fail_unless(ss.packets == 0, "nothing sent before flush");
+  udp46_send_queue_flush(h1.u46_server);
+  udp46_get_send_stats(h1.u46_server, &ss);
+  sput_fail_unless(ss.flushes == 1, "one flush");
+  sput_fail_unless(ss.packets == (int)ARRAY_SIZE(msgs), "all packets flushed");
+  sput_fail_unless(ss.max_batch == (int)ARRAY_SIZE(msgs), "max batch");
+  for (i = 0 ; i < ARRAY_SIZE(msgs) ; i++)
+    {
+      r = udp46_recv(h2.u46_server, &src, NULL, buf, sizeof(buf));
+      sput_fail_unless(r == (int)strlen(msgs[i]), "udp46_recv");
+      sput_fail_unless(r > 0 && !memcmp(buf, msgs[i], r), "right payload");
+      sput_fail_unless(ntohs(src.sin6_port) == h1.udp_port, "right source");
+    }
+  r = udp46_recv(h2.u46_server, &src, NULL, buf, sizeof(buf));
+  sput_fail_unless(r < 0, "no more packets");
+
+  /* Full queue is flushed without waiting for the flush call. */
+  udp46_send_queue_start(h1.u46_server);
+  for (i = 0 ; i < 100 ; i++)
+    (void)udp46_send(h1.u46_server, NULL, &dst, msgs[0], strlen(msgs[0]));
+  udp46_get_send_stats(h1.u46_server, &ss);
+  sput_fail_unless(ss.flushes > 1, "flushed when full");
+  sput_fail_unless(ss.max_batch < 100, "queue capped");
+  udp46_send_queue_flush(h1.u46_server);
+  udp46_get_send_stats(h1.u46_server, &ss);
+  sput_fail_unless(ss.packets == (int)ARRAY_SIZE(msgs) + 100,
+                   "all packets flushed");
+  /* (udp46 would wait for uloop to tell it is readable again.) */
+  udp46_get_fds(h2.u46_server, NULL, &fd);
+  for (i = 0 ; i < 100 ; i++)
+    if (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) < 0)
+      break;
+  sput_fail_unless(i == 100, "all received");
+
+  /* Failures of queued sends show up in the statistics. */
+  (void)inet_pton(AF_INET6, "fe80::1", &dst.sin6_addr);
+  dst.sin6_scope_id = 12345;
+  udp46_send_queue_start(h1.u46_server);
+  r = udp46_send(h1.u46_server, NULL, &dst, msgs[0], strlen(msgs[0]));
+  sput_fail_unless(r == (int)strlen(msgs[0]), "udp46_send queued");
+  /* Invalid addresses are rejected already when queuing. */
+  dst.sin6_family = AF_INET;
+  r = udp46_send(h1.u46_server, NULL, &dst, msgs[0], strlen(msgs[0]));
+  sput_fail_unless(r < 0, "invalid dst not queued");
+  dst.sin6_family = AF_INET6;
+  udp46_send_queue_flush(h1.u46_server);
+  udp46_get_send_stats(h1.u46_server, &ss);
+  sput_fail_unless(ss.failed == 1, "failure counted");
+
+  hncp_io_uninit(&h1);
+  hncp_io_uninit(&h2);
+}
+
+static void dncp_io_large()
+{
+  udp46 s1 = udp46_create(62010);
+  udp46 s2 = udp46_create(62011);
+  static unsigned char big[20000], buf[sizeof(big)];
+  size_t lens[] = { 3, sizeof(big), 100, 5000, 3000, 3 };
+  struct sockaddr_in6 dst;
+  unsigned int i;
+  ssize_t r;
+
+  sput_fail_unless(s1 && s2, "udp46_create");
+  for (i = 0 ; i < sizeof(big) ; i++)
+    big[i] = i * 7;
+  sockaddr_in6_set(&dst, NULL, 62011);
+  (void)inet_pton(AF_INET6, "::1", &dst.sin6_addr);
+
+  /* Datagrams larger than the receive ring slots come through intact
+   * among the small ones (in the same batch). */
+  for (i = 0 ; i < ARRAY_SIZE(lens) ; i++)
+    {
+      r = udp46_send(s1, NULL, &dst, big, lens[i]);
+      sput_fail_unless(r == (ssize_t)lens[i], "udp46_send");
+    }
+  (void)poll(NULL, 0, 10);
+  for (i = 0 ; i < ARRAY_SIZE(lens) ; i++)
+    {
+      r = udp46_recv(s2, NULL, NULL, buf, sizeof(buf));
+      sput_fail_unless(r == (ssize_t)lens[i], "udp46_recv length");
+      sput_fail_unless(r > 0 && !memcmp(buf, big, r), "udp46_recv payload");
+    }
+  udp46_destroy(s1);
+  udp46_destroy(s2);
+}
+
+/* Read straight from the IPv6 socket (udp46 would wait for uloop to
+ * tell it is readable again); loopback delivery may be deferred a
+ * bit. */
+static int _recv_wait(hncp h, void *buf, size_t len)
+{
+  struct pollfd pfd = { .events = POLLIN };
+
+  udp46_get_fds(h->u46_server, NULL, &pfd.fd);
+  (void)poll(&pfd, 1, 100);
+  return recv(pfd.fd, buf, len, MSG_DONTWAIT);
+}
+
+static void dncp_io_filter()
+{
+  hncp_s h1, h2;
+  dncp_s d2;
+  char *msg = "foo";
+  char buf[64];
+  struct sockaddr_in6 dst;
+  int r;
+
+  memset(&h1, 0, sizeof(h1));
+  memset(&h2, 0, sizeof(h2));
+  memset(&d2, 0, sizeof(d2));
+  h1.udp_port = 62004;
+  h2.udp_port = 62005;
+  h2.dncp = &d2;
+  d2.ext = &h2.ext;
+  (void)inet_pton(AF_INET6, HNCP_MCAST_GROUP, &h2.multicast_address);
+  sput_fail_unless(hncp_io_init(&h1), "dncp_io_init h1");
+  sput_fail_unless(hncp_io_init(&h2), "dncp_io_init h2");
+  memset(&dst, 0, sizeof(dst));
+  dst.sin6_family = AF_INET6;
+  dst.sin6_port = htons(h2.udp_port);
+  (void)inet_pton(AF_INET6, "::1", &dst.sin6_addr);
+#ifdef __APPLE__
+  dst.sin6_len = sizeof(dst);
+#endif /* __APPLE__ */
+
+  /* Enabled interface -> traffic passes the filter. */
+  smock_push("dncp_ready", LOOPBACK_NAME);
+  smock_push_bool("dncp_ready_value", true);
+  sput_fail_unless(hncp_io_set_ifname_enabled(&h2, LOOPBACK_NAME, true),
+                   "enable");
+  sput_fail_unless(h2.num_enabled_ifindexes == 1, "one enabled");
+  r = udp46_send(h1.u46_server, NULL, &dst, msg, strlen(msg));
+  sput_fail_unless(r == (int)strlen(msg), "udp46_send");
+  r = _recv_wait(&h2, buf, sizeof(buf));
+  sput_fail_unless(r == (int)strlen(msg), "received on enabled");
+
+  /* The filter follows the interface index. */
+  hncp_io_set_ifindex(&h2, LOOPBACK_NAME, 9998);
+  sput_fail_unless(h2.num_enabled_ifindexes == 1
+                   && h2.enabled_ifindexes[0] == 9998, "index changed");
+  (void)udp46_send(h1.u46_server, NULL, &dst, msg, strlen(msg));
+  r = _recv_wait(&h2, buf, sizeof(buf));
+#ifdef SO_ATTACH_FILTER
+  sput_fail_unless(r < 0, "filtered on old index");
+#endif /* SO_ATTACH_FILTER */
+  hncp_io_set_ifindex(&h2, LOOPBACK_NAME, if_nametoindex(LOOPBACK_NAME));
+  (void)udp46_send(h1.u46_server, NULL, &dst, msg, strlen(msg));
+  r = _recv_wait(&h2, buf, sizeof(buf));
+  sput_fail_unless(r == (int)strlen(msg), "received on new index");
+
+  /* Nothing enabled -> the kernel drops it already. */
+  smock_push("dncp_ready", LOOPBACK_NAME);
+  smock_push_bool("dncp_ready_value", false);
+  sput_fail_unless(hncp_io_set_ifname_enabled(&h2, LOOPBACK_NAME, false),
+                   "disable");
+  sput_fail_unless(!h2.num_enabled_ifindexes, "none enabled");
+  r = udp46_send(h1.u46_server, NULL, &dst, msg, strlen(msg));
+  sput_fail_unless(r == (int)strlen(msg), "udp46_send");
+  r = _recv_wait(&h2, buf, sizeof(buf));
+#ifdef SO_ATTACH_FILTER
+  sput_fail_unless(r < 0, "filtered on disabled");
+#endif /* SO_ATTACH_FILTER */
+
+  /* Some other interface too. */
+  _set_ifindex_enabled(&h2, 9999, true);
+  (void)udp46_send(h1.u46_server, NULL, &dst, msg, strlen(msg));
+  r = _recv_wait(&h2, buf, sizeof(buf));
+#ifdef SO_ATTACH_FILTER
+  sput_fail_unless(r < 0, "filtered on other interface");
+#endif /* SO_ATTACH_FILTER */
+  _set_ifindex_enabled(&h2, if_nametoindex(LOOPBACK_NAME), true);
+  (void)udp46_send(h1.u46_server, NULL, &dst, msg, strlen(msg));
+  r = _recv_wait(&h2, buf, sizeof(buf));
+  sput_fail_unless(r == (int)strlen(msg), "received on second interface");
+
+  /* Interfaces that go away are no longer enabled. */
+  hncp_io_set_ifindex(&h2, NULL, 9999);
+  sput_fail_unless(h2.num_enabled_ifindexes == 1
+                   && h2.enabled_ifindexes[0]
+                   == (int)if_nametoindex(LOOPBACK_NAME), "gone removed");
+
+  hncp_io_uninit(&h1);
+  hncp_io_uninit(&h2);
+  memset(&static_hep, 0, sizeof(static_hep));
+}
+
+static void _stream_timeout(struct uloop_timeout *t)
+{
+  sput_fail_unless(false, "stream test timed out");
+  uloop_end();
+}
+
+static void dncp_io_stream()
+{
+  struct uloop_timeout to = { .cb = _stream_timeout };
+  hncp_s h1, h2;
+  dncp_s d1, d2;
+  char *msg = "foo";
+  char *ifname = LOOPBACK_NAME;
+  struct in6_addr a;
+
+  memset(&h1, 0, sizeof(h1));
+  memset(&h2, 0, sizeof(h2));
+  memset(&d1, 0, sizeof(d1));
+  memset(&d2, 0, sizeof(d2));
+  h1.udp_port = 62004;
+  h2.udp_port = 62005;
+  h1.dncp = &d1;
+  h2.dncp = &d2;
+  d1.ext = &h1.ext;
+  d2.ext = &h2.ext;
+  sput_fail_unless(hncp_io_init(&h1), "dncp_io_init h1");
+  sput_fail_unless(hncp_io_init(&h2), "dncp_io_init h2");
+  sput_fail_unless(hncp_io_set_stream_enabled(&h1, true), "stream h1");
+  sput_fail_unless(hncp_io_set_stream_enabled(&h2, true), "stream h2");
+
+  (void)inet_pton(AF_INET6, "::1", &a);
+  struct sockaddr_in6 src = {
+    .sin6_family = AF_INET6,
+    .sin6_port = htons(h1.udp_port),
+    .sin6_addr = a
+#ifdef __APPLE__
+    , .sin6_len = sizeof(struct sockaddr_in6)
+#endif /* __APPLE__ */
+  };
+  struct sockaddr_in6 dst = {
+    .sin6_family = AF_INET6,
+    .sin6_port = htons(h2.udp_port),
+    .sin6_addr = a
+#ifdef __APPLE__
+    , .sin6_len = sizeof(struct sockaddr_in6)
+#endif /* __APPLE__ */
+  };
+
+  /* Both ends should see the peer come up. */
+  sput_fail_unless(hncp_io_stream_connect(&h1, ifname, &dst), "connect");
+  sput_fail_unless(!static_ep.unicast_is_reliable_stream, "ep not stream");
+  pending_peer_states = 2;
+  uloop_timeout_set(&to, 5000);
+  uloop_run();
+  sput_fail_unless(peers_connected == 2, "both connected");
+  sput_fail_unless(stream46_get_num_connected(h1.stream) == 1, "h1 conn");
+  sput_fail_unless(stream46_get_num_connected(h2.stream) == 1, "h2 conn");
+
+  /* The stream is chosen per destination; others still get UDP. */
+  sput_fail_unless(stream46_is_connected(h1.stream, &dst), "h1 to h2");
+  sput_fail_unless(stream46_is_connected(h2.stream, &src), "h2 to h1");
+  dst.sin6_port = htons(h2.udp_port + 1);
+  sput_fail_unless(!stream46_is_connected(h1.stream, &dst), "h1 to other");
+  dst.sin6_port = htons(h2.udp_port);
+
+  /* Unicast goes over the connection, and appears to come from the
+   * listening port of the sender. */
+  smock_push_int("dncp_poll_io_recvfrom", 3);
+  smock_push_int("dncp_poll_io_recvfrom_src", &src);
+  smock_push_int("dncp_poll_io_recvfrom_dst", &dst);
+  smock_push_int("dncp_poll_io_recvfrom_buf", msg);
+  smock_push_int("dncp_poll_io_recvfrom_ifname", ifname);
+  h1.ext.cb.send(&h1.ext, &static_ep, NULL, &dst, msg, strlen(msg));
+  pending_packets++;
+  uloop_run();
+
+  /* .. and so does the reply, without new connections. */
+  smock_push_int("dncp_poll_io_recvfrom", 3);
+  smock_push_int("dncp_poll_io_recvfrom_src", &dst);
+  smock_push_int("dncp_poll_io_recvfrom_dst", &src);
+  smock_push_int("dncp_poll_io_recvfrom_buf", msg);
+  smock_push_int("dncp_poll_io_recvfrom_ifname", ifname);
+  h2.ext.cb.send(&h2.ext, &static_ep, NULL, &src, msg, strlen(msg));
+  pending_packets++;
+  uloop_run();
+  sput_fail_unless(stream46_get_num_connected(h2.stream) == 1, "h2 conn");
+
+  /* Closing one end is noticed by the other. */
   hncp_io_uninit(&h1);
+  pending_peer_states = 1;
+  uloop_run();
+  sput_fail_unless(peers_connected == 1, "h1 disconnected");
+  sput_fail_unless(stream46_get_num_connected(h2.stream) == 0, "h2 no conn");
+
+  uloop_timeout_cancel(&to);
   hncp_io_uninit(&h2);
+  peers_connected = 0;
+  static_ep.unicast_is_reliable_stream = false;
+  memset(&static_hep, 0, sizeof(static_hep));
+}
+
+static unsigned char big_buf[200000];
+static int big_received;
+
+static void _big_readable_cb(stream46 s, void *context)
+{
+  static unsigned char buf[sizeof(big_buf)];
+  ssize_t r;
+
+  while ((r = stream46_recv(s, NULL, NULL, buf, sizeof(buf))) >= 0)
+    {
+      sput_fail_unless(r == sizeof(big_buf), "big message length");
+      sput_fail_unless(!memcmp(buf, big_buf, r), "big message content");
+      big_received++;
+      uloop_end();
+    }
+}
+
+static void stream46_big()
+{
+  struct uloop_timeout to = { .cb = _stream_timeout };
+  stream46 s1 = stream46_create(62006);
+  stream46 s2 = stream46_create(62007);
+  struct sockaddr_in6 dst;
+  unsigned int i;
+
+  sput_fail_unless(s1 && s2, "stream46_create");
+  for (i = 0 ; i < sizeof(big_buf) ; i++)
+    big_buf[i] = i * 7;
+  sockaddr_in6_set(&dst, NULL, 62007);
+  (void)inet_pton(AF_INET6, "::1", &dst.sin6_addr);
+  stream46_set_readable_cb(s2, _big_readable_cb, NULL);
+
+  /* Way larger than what fits in a datagram. */
+  sput_fail_unless(stream46_send(s1, NULL, &dst, big_buf, sizeof(big_buf))
+                   == sizeof(big_buf), "stream46_send");
+  uloop_timeout_set(&to, 5000);
+  uloop_run();
+  uloop_timeout_cancel(&to);
+  sput_fail_unless(big_received == 1, "big message received");
+  stream46_destroy(s1);
+  stream46_destroy(s2);
+}
+
+/* Frames sent over a raw TCP connection that is closed right after;
+ * together, they are more than the receive buffer may hold. */
+#define EOF_FRAMES 10
+
+static struct uloop_fd eof_ufd;
+static unsigned char *eof_data;
+static size_t eof_len, eof_sent;
+static int eof_received;
+
+static void _eof_write_cb(struct uloop_fd *u, unsigned int events)
+{
+  ssize_t r = send(u->fd, eof_data + eof_sent, eof_len - eof_sent, 0);
+
+  if (r > 0)
+    eof_sent += r;
+  if (eof_sent == eof_len || (r < 0 && errno != EAGAIN && errno != EINTR))
+    {
+      uloop_fd_delete(u);
+      close(u->fd);
+    }
+}
+
+static void _eof_readable_cb(stream46 s, void *context)
+{
+  static unsigned char buf[sizeof(big_buf)];
+  ssize_t r;
+
+  while ((r = stream46_recv(s, NULL, NULL, buf, sizeof(buf))) >= 0)
+    {
+      sput_fail_unless(r == sizeof(big_buf), "eof message length");
+      sput_fail_unless(!memcmp(buf, big_buf, r), "eof message content");
+      if (++eof_received == EOF_FRAMES)
+        uloop_end();
+    }
+}
+
+static void stream46_eof()
+{
+  struct uloop_timeout to = { .cb = _stream_timeout };
+  stream46 s = stream46_create(62008);
+  struct sockaddr_in6 dst;
+  unsigned char *p;
+  unsigned int i;
+  int fd;
+
+  sput_fail_unless(s, "stream46_create");
+  for (i = 0 ; i < sizeof(big_buf) ; i++)
+    big_buf[i] = i * 7;
+  eof_len = EOF_FRAMES * (4 + sizeof(big_buf));
+  eof_data = p = malloc(eof_len);
+  sput_fail_unless(eof_data, "malloc");
+  for (i = 0 ; i < EOF_FRAMES ; i++)
+    {
+      p[0] = 0;
+      p[1] = sizeof(big_buf) >> 16;
+      p[2] = (sizeof(big_buf) >> 8) & 0xFF;
+      p[3] = sizeof(big_buf) & 0xFF;
+      memcpy(p + 4, big_buf, sizeof(big_buf));
+      p += 4 + sizeof(big_buf);
+    }
+  sockaddr_in6_set(&dst, NULL, 62008);
+  (void)inet_pton(AF_INET6, "::1", &dst.sin6_addr);
+  fd = socket(PF_INET6, SOCK_STREAM, 0);
+  sput_fail_unless(fd >= 0, "socket");
+  sput_fail_unless(!connect(fd, (struct sockaddr *)&dst, sizeof(dst)),
+                   "connect");
+  (void)fcntl(fd, F_SETFL, O_NONBLOCK);
+  eof_ufd.fd = fd;
+  eof_ufd.cb = _eof_write_cb;
+  uloop_fd_add(&eof_ufd, ULOOP_WRITE);
+  stream46_set_readable_cb(s, _eof_readable_cb, NULL);
+
+  uloop_timeout_set(&to, 5000);
+  uloop_run();
+  uloop_timeout_cancel(&to);
+  sput_fail_unless(eof_sent == eof_len, "all sent");
+  sput_fail_unless(eof_received == EOF_FRAMES, "all received before close");
+  stream46_destroy(s);
+  free(eof_data);
 }
 
 int main(int argc, char **argv)
@@ -147,6 +629,12 @@ int main(int argc, char **argv)
   argv += 1;
 
   sput_maybe_run_test(dncp_io_basic_2, do {} while(0));
+  sput_maybe_run_test(dncp_io_batch, do {} while(0));
+  sput_maybe_run_test(dncp_io_large, do {} while(0));
+  sput_maybe_run_test(dncp_io_filter, do {} while(0));
+  sput_maybe_run_test(dncp_io_stream, do {} while(0));
+  sput_maybe_run_test(stream46_big, do {} while(0));
+  sput_maybe_run_test(stream46_eof, do {} while(0));
   sput_leave_suite(); /* optional */
   sput_finish_testing();
   return sput_get_return_value();
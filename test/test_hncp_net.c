@@ -375,6 +375,14 @@ static void raw_hncp_tube(net_sim s, unsigned int num_nodes, bool no_conflicts)
 
   sput_fail_unless(net_sim_find_dncp(s, "node0")->nodes.avl.count >= num_nodes,
                    "enough nodes");
+  /* Growing the tube should not require only full prunes. */
+  dncp n0 = net_sim_find_dncp(s, "node0");
+  sput_fail_unless(n0->num_prune_incremental > 0, "incremental prunes");
+  /* Network state payload should be shared between the two endpoints
+   * (and retransmissions) of middle nodes. */
+  dncp n1 = net_sim_find_dncp(s, "node1");
+  sput_fail_unless(n1->num_net_state_builds < n1->num_net_state_sends,
+                   "network state payload reused");
   for (i = 0 ; i < num_nodes ; i++)
     {
       char buf[128];
@@ -469,6 +477,139 @@ void hncp_tube_beyond_multicast_unique(void)
   raw_hncp_tube(&s, BIG_TUBE_LENGTH, false);
 }
 
+/* Network state benchmark: how many bytes does it take for a change
+ * at one end of a big tube to propagate, with and without the set
+ * reconciliation summary in network state requests, and with and
+ * without rotating multicast windows / segmented replies. */
+static long long raw_sync_bench(bool disable_sync, bool disable_segment)
+{
+  net_sim_s s;
+  unsigned int i;
+  long long bytes;
+  char buf[128];
+
+  net_sim_init(&s);
+  s.disable_sd = true;
+  s.disable_multicast = true;
+  s.disable_pa = true;
+  s.disable_sync = disable_sync;
+  s.disable_segment = disable_segment;
+  for (i = 0 ; i < BIG_TUBE_LENGTH - 1 ; i++)
+    {
+      sprintf(buf, "node%d", i);
+      dncp n1 = net_sim_find_dncp(&s, buf);
+      sprintf(buf, "node%d", i+1);
+      dncp n2 = net_sim_find_dncp(&s, buf);
+      dncp_ep l1 = net_sim_dncp_find_ep_by_name(n1, "down");
+      dncp_ep l2 = net_sim_dncp_find_ep_by_name(n2, "up");
+      net_sim_set_connected(l1, l2, true);
+      net_sim_set_connected(l2, l1, true);
+    }
+  SIM_WHILE(&s, 100000, !net_sim_is_converged(&s));
+  L_NOTICE("sync %s segment %s: converged with %lld bytes",
+           disable_sync ? "off" : "on", disable_segment ? "off" : "on",
+           s.sent_unicast_bytes + s.sent_multicast_bytes);
+
+  bytes = s.sent_unicast_bytes + s.sent_multicast_bytes;
+  dncp n0 = net_sim_find_dncp(&s, "node0");
+  dncp_add_tlv(n0, 123, buf, 8, 0);
+  SIM_WHILE(&s, 1000, net_sim_is_converged(&s));
+  SIM_WHILE(&s, 100000, !net_sim_is_converged(&s));
+  bytes = s.sent_unicast_bytes + s.sent_multicast_bytes - bytes;
+  L_NOTICE("sync %s segment %s: change propagated with %lld bytes",
+           disable_sync ? "off" : "on", disable_segment ? "off" : "on",
+           bytes);
+  if (!disable_sync)
+    sput_fail_unless(n0->num_sync_sent > 0, "summaries sent");
+  net_sim_uninit(&s);
+  return bytes;
+}
+
+void hncp_sync_bench(void)
+{
+  long long full = raw_sync_bench(true, true);
+  long long sync = raw_sync_bench(false, true);
+  long long segment = raw_sync_bench(true, false);
+  long long both = raw_sync_bench(false, false);
+
+  L_NOTICE("change propagation: %lld bytes without, %lld with sync, "
+           "%lld with segments, %lld with both",
+           full, sync, segment, both);
+  sput_fail_unless(sync < full, "sync needs fewer bytes");
+  sput_fail_unless(segment < full, "segments need fewer bytes");
+  sput_fail_unless(both < full, "both need fewer bytes");
+}
+
+#define DELTA_TUBE_LENGTH 20
+#define DELTA_TLVS 30
+
+static long long raw_delta_bench(bool disable_delta)
+{
+  net_sim_s s;
+  unsigned int i;
+  long long bytes;
+  int applied = 0, failed = 0;
+  char buf[128];
+  dncp_tlv t = NULL;
+  net_node node;
+
+  net_sim_init(&s);
+  s.disable_sd = true;
+  s.disable_multicast = true;
+  s.disable_pa = true;
+  s.disable_delta = disable_delta;
+  for (i = 0 ; i < DELTA_TUBE_LENGTH - 1 ; i++)
+    {
+      sprintf(buf, "node%d", i);
+      dncp n1 = net_sim_find_dncp(&s, buf);
+      sprintf(buf, "node%d", i+1);
+      dncp n2 = net_sim_find_dncp(&s, buf);
+      dncp_ep l1 = net_sim_dncp_find_ep_by_name(n1, "down");
+      dncp_ep l2 = net_sim_dncp_find_ep_by_name(n2, "up");
+      net_sim_set_connected(l1, l2, true);
+      net_sim_set_connected(l2, l1, true);
+    }
+  /* Node with lots of data, of which only a little changes. */
+  dncp n0 = net_sim_find_dncp(&s, "node0");
+  memset(buf, 0, sizeof(buf));
+  for (i = 0 ; i < DELTA_TLVS ; i++)
+    {
+      buf[0] = i;
+      t = dncp_add_tlv(n0, 123, buf, 40, 0);
+    }
+  SIM_WHILE(&s, 100000, !net_sim_is_converged(&s));
+
+  bytes = s.sent_unicast_bytes + s.sent_multicast_bytes;
+  dncp_remove_tlv(n0, t);
+  buf[0] = i;
+  dncp_add_tlv(n0, 123, buf, 40, 0);
+  SIM_WHILE(&s, 1000, net_sim_is_converged(&s));
+  SIM_WHILE(&s, 100000, !net_sim_is_converged(&s));
+  bytes = s.sent_unicast_bytes + s.sent_multicast_bytes - bytes;
+  list_for_each_entry(node, &s.nodes, lh)
+    {
+      applied += node->d->num_node_deltas_applied;
+      failed += node->d->num_node_deltas_failed;
+    }
+  L_NOTICE("delta %s: change propagated with %lld bytes (%d deltas)",
+           disable_delta ? "off" : "on", bytes, applied);
+  if (!disable_delta)
+    sput_fail_unless(applied >= DELTA_TUBE_LENGTH - 1, "deltas applied");
+  sput_fail_unless(!failed, "no deltas failed");
+  net_sim_uninit(&s);
+  return bytes;
+}
+
+void hncp_delta_bench(void)
+{
+  long long full = raw_delta_bench(true);
+  long long delta = raw_delta_bench(false);
+
+  L_NOTICE("change propagation: %lld bytes without, %lld with deltas",
+           full, delta);
+  sput_fail_unless(delta < full, "deltas need fewer bytes");
+}
+
 /* Note: As we play with bitmasks,
    NUM_MONKEY_ROUTERS * NUM_MONKEY_PORTS^2 <= 31
 */
@@ -809,6 +950,394 @@ void hncp_expiration(void)
 }
 
 
+void hncp_verified_cache(void)
+{
+  net_sim_s s;
+  dncp n1, n2, n3;
+  dncp_ep l1, l21, l23, l3;
+  int hits, misses, i;
+
+  net_sim_init(&s);
+  /* Keep node data of n1 stable regardless of topology. */
+  s.disable_sd = true;
+  s.disable_multicast = true;
+  s.disable_pa = true;
+  n1 = net_sim_find_dncp(&s, "n1");
+  n2 = net_sim_find_dncp(&s, "n2");
+  n3 = net_sim_find_dncp(&s, "n3");
+  l1 = net_sim_dncp_find_ep_by_name(n1, "eth0");
+  l21 = net_sim_dncp_find_ep_by_name(n2, "eth0");
+  l23 = net_sim_dncp_find_ep_by_name(n2, "eth1");
+  l3 = net_sim_dncp_find_ep_by_name(n3, "eth0");
+  net_sim_set_connected(l1, l21, true);
+  net_sim_set_connected(l21, l1, true);
+  net_sim_set_connected(l23, l3, true);
+  net_sim_set_connected(l3, l23, true);
+  SIM_WHILE(&s, 1000, !net_sim_is_converged(&s));
+
+  /* Partition n3 until it forgets about n1 altogether. */
+  net_sim_set_connected(l23, l3, false);
+  net_sim_set_connected(l3, l23, false);
+  SIM_WHILE(&s, 10000,
+            dncp_find_node_by_node_id(n3, &n1->own_node->node_id, false));
+
+  /* n1 has not changed meanwhile, so the node data n3 gets again has
+   * been verified already. */
+  hits = n3->num_verified_hits;
+  net_sim_set_connected(l23, l3, true);
+  net_sim_set_connected(l3, l23, true);
+  SIM_WHILE(&s, 1000, !net_sim_is_converged(&s));
+  sput_fail_unless(dncp_find_node_by_node_id(n3, &n1->own_node->node_id,
+                                             false), "n1 known again");
+  sput_fail_unless(n3->num_verified_hits > hits, "verified cache hit");
+
+  /* Same key but different bytes (as with forged or corrupted node
+   * data) must not be a hit; the payload is hashed again instead. */
+  net_sim_set_connected(l23, l3, false);
+  net_sim_set_connected(l3, l23, false);
+  SIM_WHILE(&s, 10000,
+            dncp_find_node_by_node_id(n3, &n1->own_node->node_id, false));
+  for (i = 0; i < DNCP_VERIFIED_CACHE_SIZE; i++)
+    if (n3->verified[i].last_used)
+      ((unsigned char *)n3->verified[i].data)[0] ^= 0xff;
+  hits = n3->num_verified_hits;
+  misses = n3->num_verified_misses;
+  net_sim_set_connected(l23, l3, true);
+  net_sim_set_connected(l3, l23, true);
+  SIM_WHILE(&s, 1000, !net_sim_is_converged(&s));
+  sput_fail_unless(dncp_find_node_by_node_id(n3, &n1->own_node->node_id,
+                                             false), "n1 known again");
+  sput_fail_unless(n3->num_verified_hits == hits, "no hit on other bytes");
+  sput_fail_unless(n3->num_verified_misses > misses, "verified cache miss");
+
+  net_sim_uninit(&s);
+}
+
+/* Hub with a lot of unicast-only neighbors (= per-peer Trickle and
+ * keep-alive timers). */
+#define STAR_NEIGHBORS 40
+
+static dncp raw_neighbor_star(net_sim s, hnetd_time_t slack,
+                              dncp_ep *leaf_eps)
+{
+  dncp hub;
+  dncp_ep hub_ep;
+  char buf[128];
+  int i;
+
+  s->disable_sd = true;
+  s->disable_multicast = true;
+  s->disable_pa = true;
+  s->fake_unicast = true;
+  hub = net_sim_find_dncp(s, "hub");
+  hub->ext->conf.trickle_slack = slack;
+  hub_ep = net_sim_dncp_find_ep_by_name(hub, "eth0");
+  for (i = 0 ; i < STAR_NEIGHBORS ; i++)
+    {
+      sprintf(buf, "leaf%d", i);
+      dncp n = net_sim_find_dncp(s, buf);
+      n->ext->conf.trickle_slack = slack;
+      leaf_eps[i] = net_sim_dncp_find_ep_by_name(n, "eth0");
+      net_sim_set_connected(hub_ep, leaf_eps[i], true);
+      net_sim_set_connected(leaf_eps[i], hub_ep, true);
+    }
+  SIM_WHILE(s, 100000, !net_sim_is_converged(s));
+  sput_fail_unless(hub->neighbor_heap_len == STAR_NEIGHBORS,
+                   "all neighbors in heap");
+  return hub;
+}
+
+/* Timeouts should only look at the neighbors that need attention, yet
+ * notice when their keepalive interval changes. */
+void hncp_neighbor_star(void)
+{
+  net_sim_s s;
+  dncp hub;
+  dncp_ep leaf_eps[STAR_NEIGHBORS];
+  int i, runs, timeouts;
+
+  net_sim_init(&s);
+  hub = raw_neighbor_star(&s, HNCP_TRICKLE_SLACK, leaf_eps);
+
+  /* A change by one leaf affects only the hub's neighbor of it. */
+  dncp leaf0 = net_sim_find_dncp(&s, "leaf0");
+  leaf_eps[0]->keepalive_interval = HNCP_KEEPALIVE_INTERVAL * 4;
+  hnetd_time_t end = hnetd_time() + HNCP_KEEPALIVE_INTERVAL * 3;
+  SIM_WHILE(&s, 1000000, hnetd_time() < end);
+  for (i = 0 ; i < hub->neighbor_heap_len ; i++)
+    {
+      dncp_neighbor n = hub->neighbor_heap[i];
+      dncp_t_neighbor ne = dncp_tlv_neighbor(hub, &n->tlv->tlv);
+      bool is_leaf0 = !memcmp(dncp_tlv_get_node_id(hub, ne),
+                              &leaf0->own_node->node_id,
+                              DNCP_NI_LEN(hub));
+
+      sput_fail_unless(n->keepalive_interval
+                       == HNCP_KEEPALIVE_INTERVAL * (is_leaf0 ? 4 : 1),
+                       "neighbor interval");
+    }
+
+  /* Leaves send keepalives a lot less often than the hub assumed so
+   * far; it has to pick up the new intervals. */
+  for (i = 0 ; i < STAR_NEIGHBORS ; i++)
+    leaf_eps[i]->keepalive_interval = HNCP_KEEPALIVE_INTERVAL * 4;
+  runs = net_sim_node_from_dncp(hub)->num_runs;
+  timeouts = hub->num_neighbor_timeouts;
+  end = hnetd_time() + HNCP_KEEPALIVE_INTERVAL * 10;
+  SIM_WHILE(&s, 1000000, hnetd_time() < end);
+  runs = net_sim_node_from_dncp(hub)->num_runs - runs;
+  timeouts = hub->num_neighbor_timeouts - timeouts;
+  L_NOTICE("%d neighbors: %d runs, %d neighbor timeouts",
+           STAR_NEIGHBORS, runs, timeouts);
+  sput_fail_unless(!hub->num_neighbor_dropped, "no drops");
+  sput_fail_unless(hub->neighbor_heap_len == STAR_NEIGHBORS,
+                   "all neighbors still in heap");
+  sput_fail_unless(timeouts * 4 < runs * STAR_NEIGHBORS,
+                   "only due neighbors looked at");
+
+  net_sim_uninit(&s);
+}
+
+static int raw_trickle_slack(hnetd_time_t slack)
+{
+  net_sim_s s;
+  dncp hub;
+  dncp_ep leaf_eps[STAR_NEIGHBORS];
+  int wakeups;
+
+  net_sim_init(&s);
+  hub = raw_neighbor_star(&s, slack, leaf_eps);
+  wakeups = hub->num_wakeups;
+  hnetd_time_t end = hnetd_time() + HNCP_KEEPALIVE_INTERVAL * 10;
+  SIM_WHILE(&s, 1000000, hnetd_time() < end);
+  wakeups = hub->num_wakeups - wakeups;
+  L_NOTICE("slack %d: %d wakeups (%d per 1000s)",
+           (int)slack, wakeups, hub->wakeups_per_1000s);
+  sput_fail_unless(hub->num_wakeups == net_sim_node_from_dncp(hub)->num_runs,
+                   "wakeups counted");
+  sput_fail_unless(hub->wakeups_per_1000s > 0, "wakeup rate");
+  sput_fail_unless(!hub->num_neighbor_dropped, "no drops");
+  net_sim_uninit(&s);
+  return wakeups;
+}
+
+/* Idle per-peer timers should share wakeups when slack is allowed. */
+void hncp_trickle_slack(void)
+{
+  int exact = raw_trickle_slack(0);
+  int slack = raw_trickle_slack(HNCP_TRICKLE_SLACK);
+
+  sput_fail_unless(slack * 5 < exact * 4, "fewer wakeups with slack");
+}
+
+
+static bool _is_reachable(dncp o, dncp other)
+{
+  dncp_node n = dncp_find_node_by_node_id(o, &other->own_node->node_id,
+                                          false);
+
+  return n && n->last_reachable_prune == o->last_prune;
+}
+
+/* Line n1 - n2 - n3; cut the n2 - n3 link, and see how long it takes
+ * for both sides to realize they are partitioned. */
+static hnetd_time_t raw_carrier_cut(bool carrier)
+{
+  net_sim_s s;
+  dncp n1, n2, n3;
+  dncp_ep l1, l21, l23, l3;
+  hnetd_time_t t;
+
+  net_sim_init(&s);
+  s.disable_sd = true;
+  s.disable_multicast = true;
+  s.disable_pa = true;
+  n1 = net_sim_find_dncp(&s, "n1");
+  n2 = net_sim_find_dncp(&s, "n2");
+  n3 = net_sim_find_dncp(&s, "n3");
+  l1 = net_sim_dncp_find_ep_by_name(n1, "eth0");
+  l21 = net_sim_dncp_find_ep_by_name(n2, "eth0");
+  l23 = net_sim_dncp_find_ep_by_name(n2, "eth1");
+  l3 = net_sim_dncp_find_ep_by_name(n3, "eth0");
+  net_sim_set_connected(l1, l21, true);
+  net_sim_set_connected(l21, l1, true);
+  net_sim_set_connected(l23, l3, true);
+  net_sim_set_connected(l3, l23, true);
+  SIM_WHILE(&s, 1000, !net_sim_is_converged(&s));
+  sput_fail_unless(_is_reachable(n1, n3), "n3 reachable");
+
+  t = hnetd_time();
+  net_sim_set_connected(l23, l3, false);
+  net_sim_set_connected(l3, l23, false);
+  if (carrier)
+    {
+      dncp_ext_ep_carrier(l23, false);
+      dncp_ext_ep_carrier(l3, false);
+    }
+  SIM_WHILE(&s, 100000,
+            _is_reachable(n1, n3) || _is_reachable(n2, n3)
+            || _is_reachable(n3, n1)
+            || n1->network_hash_dirty || n2->network_hash_dirty
+            || memcmp(&n1->network_hash, &n2->network_hash, HNCP_HASH_LEN));
+  t = hnetd_time() - t;
+  L_NOTICE("carrier %s: partition noticed in %lld ms",
+           carrier ? "on" : "off", (long long)t);
+  if (carrier)
+    sput_fail_unless(n2->num_neighbor_dropped == 1, "neighbor dropped");
+  net_sim_uninit(&s);
+  return t;
+}
+
+void hncp_carrier_cut(void)
+{
+  hnetd_time_t timeout = raw_carrier_cut(false);
+  hnetd_time_t carrier = raw_carrier_cut(true);
+
+  /* Without carrier information, it takes keepalive interval *
+   * multiplier. */
+  sput_fail_unless(timeout > HNCP_KEEPALIVE_INTERVAL, "slow without carrier");
+  sput_fail_unless(carrier < HNETD_TIME_PER_SECOND, "fast with carrier");
+}
+
+/* Adaptive Trickle study: the same changes on one shared segment with
+ * lots of routers, and on a line of point-to-point links. */
+#define SHARED_ROUTERS 40
+#define P2P_ROUTERS 10
+#define ADAPTIVE_CHANGES 5
+
+static dncp_ep _adaptive_ep(dncp o, const char *ifname, bool adaptive)
+{
+  dncp_ep ep = net_sim_dncp_find_ep_by_name(o, ifname);
+
+  ep->trickle_adaptive = adaptive;
+  return ep;
+}
+
+static void _adaptive_wait(net_sim s, hnetd_time_t t)
+{
+  hnetd_time_t end = hnetd_time() + t;
+
+  SIM_WHILE(s, 1000000, hnetd_time() < end);
+}
+
+/* Returns the number of multicasts (= Trickle transmissions) due to a
+ * burst of changes. */
+static int raw_trickle_adaptive(bool shared, bool adaptive,
+                                hnetd_time_t *resync)
+{
+  net_sim_s s;
+  int i, j, routers = shared ? SHARED_ROUTERS : P2P_ROUTERS;
+  int multicasts, unicasts, idle_multicasts;
+  dncp_ep eps[SHARED_ROUTERS], down = NULL;
+  hnetd_time_t start, converged;
+  char buf[128];
+
+  net_sim_init(&s);
+  s.disable_sd = true;
+  s.disable_multicast = true;
+  s.disable_pa = true;
+  for (i = 0 ; i < routers ; i++)
+    {
+      sprintf(buf, "node%d", i);
+      dncp o = net_sim_find_dncp(&s, buf);
+      if (shared)
+        {
+          eps[i] = _adaptive_ep(o, "eth0", adaptive);
+          for (j = 0 ; j < i ; j++)
+            {
+              net_sim_set_connected(eps[i], eps[j], true);
+              net_sim_set_connected(eps[j], eps[i], true);
+            }
+          continue;
+        }
+      if (down)
+        {
+          eps[i] = _adaptive_ep(o, "up", adaptive);
+          net_sim_set_connected(down, eps[i], true);
+          net_sim_set_connected(eps[i], down, true);
+        }
+      down = _adaptive_ep(o, "down", adaptive);
+      if (!i)
+        eps[i] = down;
+    }
+  SIM_WHILE(&s, 1000000, !net_sim_is_converged(&s));
+
+  /* Let Trickle back off. */
+  _adaptive_wait(&s, 5 * 60 * HNETD_TIME_PER_SECOND);
+  dncp_ep_i l = container_of(eps[0], dncp_ep_i_s, conf);
+  sput_fail_unless(l->num_neighbors == (shared ? routers - 1 : 1),
+                   "neighbors counted");
+  if (adaptive && shared)
+    sput_fail_unless(l->trickle_imin > eps[0]->trickle_imin, "longer Imin");
+  if (adaptive && !shared)
+    sput_fail_unless(l->trickle_imax < eps[0]->trickle_imax, "shorter Imax");
+
+  /* A burst of changes, a few seconds apart. */
+  multicasts = s.sent_multicast;
+  unicasts = s.sent_unicast;
+  start = hnetd_time();
+  for (i = 0 ; i < ADAPTIVE_CHANGES ; i++)
+    {
+      sprintf(buf, "node%d", i * routers / ADAPTIVE_CHANGES);
+      dncp_add_tlv(net_sim_find_dncp(&s, buf), 123, buf, 8, 0);
+      _adaptive_wait(&s, 5 * HNETD_TIME_PER_SECOND);
+    }
+  if (!net_sim_is_converged(&s))
+    SIM_WHILE(&s, 1000000, !net_sim_is_converged(&s));
+  converged = hnetd_time() - start;
+  _adaptive_wait(&s, 30 * HNETD_TIME_PER_SECOND);
+  multicasts = s.sent_multicast - multicasts;
+  unicasts = s.sent_unicast - unicasts;
+
+  /* ..and what it costs to keep things as they are. */
+  idle_multicasts = s.sent_multicast;
+  _adaptive_wait(&s, 5 * 60 * HNETD_TIME_PER_SECOND);
+  idle_multicasts = s.sent_multicast - idle_multicasts;
+
+  /* Silent divergence: node0 changes while its point-to-point link
+   * is down, but not for long enough for node1 to drop it. */
+  *resync = 0;
+  if (!shared)
+    {
+      net_sim_set_connected(eps[0], eps[1], false);
+      net_sim_set_connected(eps[1], eps[0], false);
+      dncp_add_tlv(net_sim_find_dncp(&s, "node0"), 124, buf, 8, 0);
+      _adaptive_wait(&s, 15 * HNETD_TIME_PER_SECOND);
+      net_sim_set_connected(eps[0], eps[1], true);
+      net_sim_set_connected(eps[1], eps[0], true);
+      *resync = hnetd_time();
+      SIM_WHILE(&s, 1000000, !net_sim_is_converged(&s));
+      *resync = hnetd_time() - *resync;
+    }
+
+  L_NOTICE("%s adaptive %s: burst %d multicasts %d unicasts, "
+           "converged in %lld ms; idle %d multicasts; resync %lld ms",
+           shared ? "shared" : "p2p", adaptive ? "on" : "off",
+           multicasts, unicasts, (long long)converged, idle_multicasts,
+           (long long)*resync);
+  net_sim_uninit(&s);
+  return multicasts;
+}
+
+void hncp_trickle_adaptive(void)
+{
+  hnetd_time_t resync, adaptive_resync;
+  int shared = raw_trickle_adaptive(true, false, &resync);
+  int shared_adaptive = raw_trickle_adaptive(true, true, &resync);
+  int p2p = raw_trickle_adaptive(false, false, &resync);
+  int p2p_adaptive = raw_trickle_adaptive(false, true, &adaptive_resync);
+
+  L_NOTICE("shared segment: %d multicasts, %d adaptive",
+           shared, shared_adaptive);
+  L_NOTICE("point-to-point: %d multicasts, %d adaptive; "
+           "resync in %lld ms, %lld ms adaptive", p2p, p2p_adaptive,
+           (long long)resync, (long long)adaptive_resync);
+  sput_fail_unless(shared_adaptive < shared, "fewer multicasts when shared");
+  /* Within (reduced) Imax, and then some for slack and sync. */
+  sput_fail_unless(adaptive_resync < HNCP_TRICKLE_IMAX
+                   / DNCP_TRICKLE_P2P_IMAX_DIVISOR
+                   + 2 * HNETD_TIME_PER_SECOND, "faster resync on p2p");
+}
 
 #define test_setup() srandom(seed)
 #define maybe_run_test(fun) sput_maybe_run_test(fun, test_setup())
@@ -842,6 +1371,7 @@ int main(__unused int argc, __unused char **argv)
   sput_enter_suite("hncp_net"); /* optional */
   maybe_run_test(hncp_version);
   maybe_run_test(hncp_expiration);
+  maybe_run_test(hncp_verified_cache);
   maybe_run_test(hncp_two);
   maybe_run_test(hncp_bird14);
   maybe_run_test(hncp_bird14_u);
@@ -853,7 +1383,13 @@ int main(__unused int argc, __unused char **argv)
   maybe_run_test(hncp_tube_medium_nc);
   maybe_run_test(hncp_tube_beyond_multicast_nc);
   maybe_run_test(hncp_tube_beyond_multicast_unique);
+  maybe_run_test(hncp_sync_bench);
+  maybe_run_test(hncp_delta_bench);
   maybe_run_test(hncp_random_monkey);
+  maybe_run_test(hncp_neighbor_star);
+  maybe_run_test(hncp_trickle_slack);
+  maybe_run_test(hncp_carrier_cut);
+  maybe_run_test(hncp_trickle_adaptive);
   sput_leave_suite(); /* optional */
   sput_finish_testing();
   return sput_get_return_value();
@@ -35,6 +35,8 @@ void platform_restart_dhcpv4(__unused struct iface *c) {}
 void platform_set_snat(__unused struct iface *c, __unused const struct prefix *p) {}
 void hncp_sd_dump_link_fqdn(__unused hncp_sd sd, __unused dncp_ep l, __unused const char *ifname, __unused char *buf, __unused size_t buf_len) {}
 dncp_ep dncp_find_ep_by_name(__unused dncp h, __unused const char *ifname) { return NULL; }
+void hncp_io_set_ifindex(__unused hncp h, __unused const char *ifname, __unused int ifindex) {}
+void hncp_io_set_carrier(__unused hncp h, __unused const char *ifname, __unused bool up) {}
 void hncp_link_register(__unused struct hncp_link *c, __unused struct hncp_link_user *u) {}
 
 void intiface_mock(__unused struct iface_user *u, __unused const char *ifname, bool enabled)
@@ -0,0 +1,163 @@
+/*
+ * $Id: test_md5_mb.c $
+ *
+ * Author: agent <agent@local>
+ *
+ * Copyright (c) 2026 agent
+ *
+ */
+
+#include "hnetd.h"
+#include "md5_mb.h"
+#include "sput.h"
+#include "fake_log.h"
+
+#include <time.h>
+#include <libubox/md5.h>
+
+/* Make sure all backends available on this CPU produce the same
+ * output as libubox md5, and see how fast they are with node data
+ * sized inputs. */
+
+#define NUM_BUFS 300
+#define MAX_LEN 300
+
+#define BENCH_BUFS 1000
+#define BENCH_LEN 200
+#define BENCH_ROUNDS 200
+
+static unsigned char data[NUM_BUFS * MAX_LEN];
+
+static void _md5(const void *buf, size_t len, void *dst)
+{
+  md5_ctx_t ctx;
+
+  md5_begin(&ctx);
+  md5_hash(buf, len, &ctx);
+  md5_end(dst, &ctx);
+}
+
+static int64_t _now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void md5_mb_known(void)
+{
+  const char *s = "The quick brown fox jumps over the lazy dog";
+  const unsigned char exp[MD5_MB_HASH_LEN] = {
+    0x9e, 0x10, 0x7d, 0x9d, 0x37, 0x2b, 0xb6, 0x82,
+    0x6b, 0xd8, 0x1d, 0x35, 0x42, 0xa4, 0x19, 0xd6
+  };
+  const void *bufs[MD5_MB_LANES];
+  size_t lens[MD5_MB_LANES];
+  unsigned char res[MD5_MB_LANES][MD5_MB_HASH_LEN];
+  void *dsts[MD5_MB_LANES];
+  int b, i;
+
+  for (b = MD5_MB_BACKEND_SCALAR; b < NUM_MD5_MB_BACKEND; b++)
+    {
+      if (!md5_mb_set_backend(b))
+        continue;
+      for (i = 0; i < MD5_MB_LANES; i++)
+        {
+          bufs[i] = s;
+          lens[i] = strlen(s);
+          dsts[i] = res[i];
+        }
+      memset(res, 0, sizeof(res));
+      md5_mb_hash(MD5_MB_LANES, bufs, lens, dsts);
+      for (i = 0; i < MD5_MB_LANES; i++)
+        sput_fail_unless(!memcmp(res[i], exp, sizeof(exp)), "known hash");
+    }
+  sput_fail_unless(md5_mb_set_backend(MD5_MB_BACKEND_AUTO), "auto");
+}
+
+void md5_mb_lengths(void)
+{
+  const void *bufs[NUM_BUFS];
+  size_t lens[NUM_BUFS];
+  unsigned char res[NUM_BUFS][MD5_MB_HASH_LEN];
+  unsigned char exp[NUM_BUFS][MD5_MB_HASH_LEN];
+  void *dsts[NUM_BUFS];
+  int b, i, n;
+
+  for (i = 0; i < (int)sizeof(data); i++)
+    data[i] = random();
+  /* Every length from 0 up, so all the padding cases are covered,
+   * and mixed within a call, so lanes finish at different times. */
+  for (i = 0; i < NUM_BUFS; i++)
+    {
+      bufs[i] = data + i * MAX_LEN;
+      lens[i] = (i * 37) % MAX_LEN;
+      if (i < MAX_LEN / 2)
+        lens[i] = i;
+      dsts[i] = res[i];
+      _md5(bufs[i], lens[i], exp[i]);
+    }
+  for (b = MD5_MB_BACKEND_SCALAR; b < NUM_MD5_MB_BACKEND; b++)
+    {
+      if (!md5_mb_set_backend(b))
+        continue;
+      L_DEBUG("testing %s", md5_mb_get_backend_name());
+      for (n = 0; n <= NUM_BUFS; n += n < 20 ? 1 : 70)
+        {
+          memset(res, 0, sizeof(res));
+          md5_mb_hash(n, bufs, lens, dsts);
+          for (i = 0; i < n; i++)
+            if (memcmp(res[i], exp[i], MD5_MB_HASH_LEN))
+              break;
+          sput_fail_unless(i == n, "matches libubox md5");
+        }
+    }
+  sput_fail_unless(md5_mb_set_backend(MD5_MB_BACKEND_AUTO), "auto");
+}
+
+void md5_mb_bench(void)
+{
+  const void *bufs[BENCH_BUFS];
+  size_t lens[BENCH_BUFS];
+  static unsigned char res[BENCH_BUFS][MD5_MB_HASH_LEN];
+  void *dsts[BENCH_BUFS];
+  int64_t t, scalar = 0;
+  int b, i, r;
+
+  for (i = 0; i < BENCH_BUFS; i++)
+    {
+      bufs[i] = data + (i % NUM_BUFS) * MAX_LEN;
+      lens[i] = BENCH_LEN - i % 64;
+      dsts[i] = res[i];
+    }
+  for (b = MD5_MB_BACKEND_SCALAR; b < NUM_MD5_MB_BACKEND; b++)
+    {
+      if (!md5_mb_set_backend(b))
+        continue;
+      t = _now_ns();
+      for (r = 0; r < BENCH_ROUNDS; r++)
+        md5_mb_hash(BENCH_BUFS, bufs, lens, dsts);
+      t = _now_ns() - t;
+      if (b == MD5_MB_BACKEND_SCALAR)
+        scalar = t;
+      L_NOTICE("%s: %d x %d buffers in %lld us (%.2fx scalar)",
+               md5_mb_get_backend_name(), BENCH_ROUNDS, BENCH_BUFS,
+               (long long)t / 1000, t ? (double)scalar / t : 0.0);
+    }
+  sput_fail_unless(md5_mb_set_backend(MD5_MB_BACKEND_AUTO), "auto");
+}
+
+int main(__unused int argc, __unused char **argv)
+{
+  setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
+  openlog("test_md5_mb", LOG_CONS | LOG_PERROR, LOG_DAEMON);
+  sput_start_testing();
+  sput_enter_suite("md5_mb"); /* optional */
+  sput_run_test(md5_mb_known);
+  sput_run_test(md5_mb_lengths);
+  sput_run_test(md5_mb_bench);
+  sput_leave_suite(); /* optional */
+  sput_finish_testing();
+  return sput_get_return_value();
+}